@@ -116,19 +116,22 @@ class Recognizer {
 
   void InitDecoder() {
     CHECK(decoder_ == nullptr);
-    // Optional init context graph
+    // Optional init context graph, on a copy of the resource, so the shared
+    // resource is never changed
+    auto resource = resource_;
     if (context_.size() > 0) {
       context_config_->context_score = context_score_;
       auto context_graph =
           std::make_shared<wenet::ContextGraph>(*context_config_);
       context_graph->BuildContextGraph(context_, resource_->symbol_table);
-      resource_->context_graph = context_graph;
+      resource = std::make_shared<wenet::DecodeResource>(*resource_);
+      resource->context_graph = context_graph;
     }
 
     // Init decode options
     decode_options_->chunk_size = chunk_size_;
     // Init decoder
-    decoder_ = std::make_shared<wenet::AsrDecoder>(feature_pipeline_, resource_,
+    decoder_ = std::make_shared<wenet::AsrDecoder>(feature_pipeline_, resource,
                                                    *decode_options_);
   }
 
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <iomanip>
 #include <thread>
 #include <utility>
@@ -130,6 +131,9 @@ int main(int argc, char* argv[]) {
 
   g_decode_config = wenet::InitDecodeOptionsFromFlags();
   g_feature_config = wenet::InitFeaturePipelineConfigFromFlags();
+  // The decode threads are the decode workers of the threading policy
+  FLAGS_num_decode_workers = std::max(FLAGS_num_decode_workers,
+                                      FLAGS_thread_num);
   g_decode_resource = wenet::InitDecodeResourceFromFlags();
 
   if (FLAGS_wav_path.empty() && FLAGS_wav_scp.empty()) {
@@ -181,5 +185,13 @@ int main(int argc, char* argv[]) {
             << g_total_decode_time << "ms.";
   LOG(INFO) << "RTF: " << std::setprecision(4)
             << static_cast<float>(g_total_decode_time) / g_total_waves_dur;
+  const wenet::RescoringStats& stats = wenet::AsrDecoder::rescoring_stats();
+  LOG(INFO) << "Rescoring: rescored " << stats.num_rescored.load()
+            << " skipped " << stats.num_skipped.load()
+            << ", hypotheses rescored " << stats.num_rescored_hyps.load()
+            << " pruned " << stats.num_pruned_hyps.load() << " deduplicated "
+            << stats.num_deduped_hyps.load() << " cached "
+            << stats.num_cached_hyps.load() << ", background rescored "
+            << stats.num_background.load();
   return 0;
 }
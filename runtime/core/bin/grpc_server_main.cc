@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
 #include <grpcpp/ext/proto_server_reflection_plugin.h>
 #include <grpcpp/grpcpp.h>
 #include <grpcpp/health_check_service_interface.h>
@@ -32,9 +34,22 @@ int main(int argc, char* argv[]) {
 
   auto decode_config = wenet::InitDecodeOptionsFromFlags();
   auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
+  // The pooled sessions are the decode workers of the threading policy
+  FLAGS_num_decode_workers = std::max(FLAGS_num_decode_workers,
+                                      FLAGS_decoder_pool_size);
   auto decode_resource = wenet::InitDecodeResourceFromFlags();
+  // Ready to serve once the warmup is done
+  wenet::WarmupDecodeResourceFromFlags(*feature_config, *decode_config,
+                                       decode_resource);
+  auto decoder_pool = wenet::InitDecoderPoolFromFlags(
+      feature_config, decode_config, decode_resource);
+  auto resource_manager = wenet::InitResourceManagerFromFlags(
+      feature_config, decode_config, decode_resource, decoder_pool);
+  auto model_registry =
+      wenet::InitModelRegistryFromFlags(resource_manager, decoder_pool);
 
-  wenet::GrpcServer service(feature_config, decode_config, decode_resource);
+  wenet::GrpcServer service(feature_config, decode_config, model_registry,
+                            decoder_pool);
   grpc::EnableDefaultHealthCheckService(true);
   grpc::reflection::InitProtoReflectionServerBuilderPlugin();
   ServerBuilder builder;
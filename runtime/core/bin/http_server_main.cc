@@ -12,11 +12,16 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+
 #include "decoder/params.h"
 #include "http/http_server.h"
 #include "utils/log.h"
 
 DEFINE_int32(port, 10086, "http listening port");
+DEFINE_int32(admin_port, 0,
+             "localhost port of the admin requests (POST /reload), 0 means "
+             "disabled");
 
 int main(int argc, char* argv[]) {
   gflags::ParseCommandLineFlags(&argc, &argv, false);
@@ -24,10 +29,22 @@ int main(int argc, char* argv[]) {
 
   auto decode_config = wenet::InitDecodeOptionsFromFlags();
   auto feature_config = wenet::InitFeaturePipelineConfigFromFlags();
+  // The pooled sessions are the decode workers of the threading policy
+  FLAGS_num_decode_workers = std::max(FLAGS_num_decode_workers,
+                                      FLAGS_decoder_pool_size);
   auto decode_resource = wenet::InitDecodeResourceFromFlags();
+  // Ready to serve once the warmup is done
+  wenet::WarmupDecodeResourceFromFlags(*feature_config, *decode_config,
+                                       decode_resource);
+  auto decoder_pool = wenet::InitDecoderPoolFromFlags(
+      feature_config, decode_config, decode_resource);
+  auto resource_manager = wenet::InitResourceManagerFromFlags(
+      feature_config, decode_config, decode_resource, decoder_pool);
+  auto model_registry =
+      wenet::InitModelRegistryFromFlags(resource_manager, decoder_pool);
 
   wenet::HttpServer server(FLAGS_port, feature_config, decode_config,
-                           decode_resource);
+                           model_registry, decoder_pool, FLAGS_admin_port);
   LOG(INFO) << "Listening at port " << FLAGS_port;
   server.Start();
   return 0;
@@ -18,6 +18,7 @@
 #include <ctype.h>
 
 #include <algorithm>
+#include <functional>
 #include <limits>
 #include <utility>
 
@@ -25,6 +26,21 @@
 
 namespace wenet {
 
+std::shared_ptr<DecodeResource> GetSessionResource(
+    const std::shared_ptr<DecodeResource>& resource,
+    const std::vector<std::string>& contexts) {
+  if (contexts.empty() || resource->context_graph_cache == nullptr) {
+    return resource;
+  }
+  auto context_graph = resource->context_graph_cache->GetContextGraph(contexts);
+  if (context_graph == nullptr) {
+    return resource;
+  }
+  auto session_resource = std::make_shared<DecodeResource>(*resource);
+  session_resource->context_graph = context_graph;
+  return session_resource;
+}
+
 AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
                        std::shared_ptr<DecodeResource> resource,
                        const DecodeOptions& opts)
@@ -35,7 +51,6 @@ AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
       post_processor_(resource->post_processor),
       context_graph_(resource->context_graph),
       symbol_table_(resource->symbol_table),
-      fst_(resource->fst),
       unit_table_(resource->unit_table),
       opts_(opts),
       ctc_endpointer_(new CtcEndpoint(opts.ctc_endpoint_config)) {
@@ -43,6 +58,15 @@ AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
     // Check if model has a right to left decoder
     CHECK(model_->is_bidirectional_decoder());
   }
+  model_->set_keep_encoder_out(opts_.rescoring_weight != 0.0);
+  model_->set_state_storage(opts_.state_storage);
+  model_->set_rescoring_blank_thresh(opts_.rescoring_blank_thresh,
+                                     opts_.ctc_prefix_search_opts.blank);
+  // Thread safe copy, ComposeFst caches the expanded states inside, and it's
+  // cheap for VectorFst and ConstFst since they share the implementation.
+  if (resource->fst != nullptr) {
+    fst_.reset(resource->fst->Copy(true));
+  }
   if (nullptr == fst_) {
     searcher_.reset(new CtcPrefixBeamSearch(opts.ctc_prefix_search_opts,
                                             resource->context_graph));
@@ -51,9 +75,38 @@ AsrDecoder::AsrDecoder(std::shared_ptr<FeaturePipeline> feature_pipeline,
                                           resource->context_graph));
   }
   ctc_endpointer_->frame_shift_in_ms(frame_shift_in_ms());
+  // The background tasks run on the threads of the session rather than a new
+  // thread per chunk, one thread for each kind as they may overlap
+  int num_background_threads = 0;
+  if (opts_.rescoring_interval > 0 && opts_.rescoring_weight != 0.0) {
+    num_background_threads++;
+  }
+  if (opts_.pipelined_search) {
+    num_background_threads++;
+  }
+  if (num_background_threads > 0) {
+    background_pool_.reset(new ThreadPool(num_background_threads));
+  }
+}
+
+void AsrDecoder::set_context_graph(
+    std::shared_ptr<ContextGraph> context_graph) {
+  WaitBackgroundSearch();
+  context_graph_ = std::move(context_graph);
+  searcher_->set_context_graph(context_graph_);
+}
+
+RescoringStats& AsrDecoder::rescoring_stats() {
+  static RescoringStats stats;
+  return stats;
 }
 
 void AsrDecoder::Reset() {
+  WaitBackgroundRescoring();
+  WaitBackgroundSearch();
+  rescoring_cache_.clear();
+  rescoring_cache_frames_ = -1;
+  num_chunks_ = 0;
   start_ = false;
   result_.clear();
   num_frames_ = 0;
@@ -65,6 +118,11 @@ void AsrDecoder::Reset() {
 }
 
 void AsrDecoder::ResetContinuousDecoding() {
+  WaitBackgroundRescoring();
+  WaitBackgroundSearch();
+  rescoring_cache_.clear();
+  rescoring_cache_frames_ = -1;
+  num_chunks_ = 0;
   global_frame_offset_ = num_frames_;
   start_ = false;
   result_.clear();
@@ -88,6 +146,7 @@ DecodeState AsrDecoder::AdvanceDecoding(bool block) {
   DecodeState state = DecodeState::kEndBatch;
   model_->set_chunk_size(opts_.chunk_size);
   model_->set_num_left_chunks(opts_.num_left_chunks);
+  model_->set_max_att_cache_frames(opts_.max_att_cache_frames);
   int num_required_frames = model_->num_frames_for_chunk(start_);
   std::vector<std::vector<float>> chunk_feats;
   // Return immediately if we do not want to block
@@ -103,34 +162,156 @@ DecodeState AsrDecoder::AdvanceDecoding(bool block) {
   num_frames_ += chunk_feats.size();
   VLOG(2) << "Required " << num_required_frames << " get "
           << chunk_feats.size();
+  // The background rescoring should be done before the model is changed
+  WaitBackgroundRescoring();
   Timer timer;
+  // The CTC posterior is dense or the sparse top k, see AsrModel::sparse_ctc()
+  bool sparse_ctc = model_->sparse_ctc();
   std::vector<std::vector<float>> ctc_log_probs;
-  model_->ForwardEncoder(chunk_feats, &ctc_log_probs);
+  std::vector<SparseCtcFrame> sparse_log_probs;
+  if (sparse_ctc) {
+    model_->ForwardEncoder(chunk_feats, &sparse_log_probs);
+  } else {
+    model_->ForwardEncoder(chunk_feats, &ctc_log_probs);
+  }
   int forward_time = timer.Elapsed();
   if (opts_.ctc_wfst_search_opts.blank_scale != 1.0) {
+    float log_blank_scale = std::log(opts_.ctc_wfst_search_opts.blank_scale);
     for (int i = 0; i < ctc_log_probs.size(); i++) {
-      ctc_log_probs[i][0] = ctc_log_probs[i][0] +
-                            std::log(opts_.ctc_wfst_search_opts.blank_scale);
+      ctc_log_probs[i][0] = ctc_log_probs[i][0] + log_blank_scale;
+    }
+    for (auto& frame : sparse_log_probs) {
+      frame.blank_logp += log_blank_scale;
+      for (size_t j = 0; j < frame.indices.size(); ++j) {
+        if (frame.indices[j] == 0) frame.values[j] += log_blank_scale;
+      }
     }
   }
-  timer.Reset();
-  searcher_->Search(ctc_log_probs);
-  int search_time = timer.Elapsed();
-  VLOG(3) << "forward takes " << forward_time << " ms, search takes "
-          << search_time << " ms";
+  if (!opts_.pipelined_search) {
+    timer.Reset();
+    Search(ctc_log_probs, sparse_log_probs, sparse_ctc);
+    VLOG(3) << "forward takes " << forward_time << " ms, search takes "
+            << timer.Elapsed() << " ms";
+  } else {
+    // The search of the last chunk ran while this one was forwarded
+    timer.Reset();
+    WaitBackgroundSearch();
+    VLOG(3) << "forward takes " << forward_time << " ms, wait for search "
+            << timer.Elapsed() << " ms";
+  }
   UpdateResult();
 
+  // In the pipelined mode, the result is the one of the last chunk here
   if (state != DecodeState::kEndFeats) {
-    if (ctc_endpointer_->IsEndpoint(ctc_log_probs, DecodedSomething())) {
+    bool is_endpoint =
+        sparse_ctc
+            ? ctc_endpointer_->IsEndpoint(sparse_log_probs, DecodedSomething())
+            : ctc_endpointer_->IsEndpoint(ctc_log_probs, DecodedSomething());
+    if (is_endpoint) {
       VLOG(1) << "Endpoint is detected at " << num_frames_;
       state = DecodeState::kEndpoint;
     }
   }
 
+  num_chunks_++;
+  if (state == DecodeState::kEndBatch && opts_.rescoring_interval > 0 &&
+      num_chunks_ % opts_.rescoring_interval == 0) {
+    StartBackgroundRescoring();
+  }
+  if (opts_.pipelined_search) {
+    if (state == DecodeState::kEndBatch) {
+      StartBackgroundSearch(std::move(ctc_log_probs),
+                            std::move(sparse_log_probs), sparse_ctc);
+    } else {
+      // The results at the endpoint and the end are complete
+      Search(ctc_log_probs, sparse_log_probs, sparse_ctc);
+      UpdateResult();
+    }
+  }
   start_ = true;
   return state;
 }
 
+void AsrDecoder::Search(const std::vector<std::vector<float>>& ctc_log_probs,
+                        const std::vector<SparseCtcFrame>& sparse_log_probs,
+                        bool sparse_ctc) {
+  if (sparse_ctc) {
+    searcher_->Search(sparse_log_probs);
+  } else {
+    searcher_->Search(ctc_log_probs);
+  }
+}
+
+void AsrDecoder::StartBackgroundSearch(
+    std::vector<std::vector<float>> ctc_log_probs,
+    std::vector<SparseCtcFrame> sparse_log_probs, bool sparse_ctc) {
+  search_task_ = background_pool_->enqueue(
+      [this, sparse_ctc, ctc_log_probs = std::move(ctc_log_probs),
+       sparse_log_probs = std::move(sparse_log_probs)]() {
+        Search(ctc_log_probs, sparse_log_probs, sparse_ctc);
+      });
+}
+
+void AsrDecoder::WaitBackgroundSearch() {
+  if (search_task_.valid()) {
+    search_task_.get();
+  }
+}
+
+void AsrDecoder::StartBackgroundRescoring() {
+  if (0.0 == opts_.rescoring_weight) {
+    return;
+  }
+  // Copy the current nbest, the searcher goes on in the meantime
+  std::vector<std::vector<int>> hyps = searcher_->Inputs();
+  if (hyps.empty()) {
+    return;
+  }
+  rescoring_task_ = background_pool_->enqueue([this, hyps]() {
+    std::vector<float> rescoring_score;
+    RescoreWithCache(hyps, &rescoring_score);
+    rescoring_stats().num_background++;
+  });
+}
+
+void AsrDecoder::WaitBackgroundRescoring() {
+  if (rescoring_task_.valid()) {
+    rescoring_task_.get();
+  }
+}
+
+void AsrDecoder::RescoreWithCache(const std::vector<std::vector<int>>& hyps,
+                                  std::vector<float>* rescoring_score) {
+  RescoringStats& stats = rescoring_stats();
+  // The attention decoder attends to all the encoder outputs, so the cached
+  // scores are only valid if the encoder outputs are unchanged
+  int num_frames = model_->num_rescoring_frames();
+  if (num_frames < 0 || num_frames != rescoring_cache_frames_) {
+    rescoring_cache_.clear();
+    rescoring_cache_frames_ = num_frames;
+  }
+  std::vector<std::vector<int>> missing_hyps;
+  for (const auto& hyp : hyps) {
+    if (rescoring_cache_.find(hyp) == rescoring_cache_.end()) {
+      missing_hyps.push_back(hyp);
+    }
+  }
+  stats.num_cached_hyps += hyps.size() - missing_hyps.size();
+  if (!missing_hyps.empty()) {
+    std::vector<float> missing_score;
+    model_->AttentionRescoring(missing_hyps, opts_.reverse_weight,
+                               &missing_score);
+    stats.num_rescored_hyps += missing_hyps.size();
+    for (size_t i = 0; i < missing_hyps.size(); ++i) {
+      rescoring_cache_[missing_hyps[i]] = missing_score[i];
+    }
+  }
+  rescoring_score->resize(hyps.size());
+  for (size_t i = 0; i < hyps.size(); ++i) {
+    (*rescoring_score)[i] = rescoring_cache_[hyps[i]];
+  }
+}
+
 void AsrDecoder::UpdateResult(bool finish) {
   const auto& hypotheses = searcher_->Outputs();
   const auto& inputs = searcher_->Inputs();
@@ -215,6 +396,8 @@ void AsrDecoder::UpdateResult(bool finish) {
 }
 
 void AsrDecoder::AttentionRescoring() {
+  WaitBackgroundRescoring();
+  WaitBackgroundSearch();
   searcher_->FinalizeSearch();
   UpdateResult(true);
   // No need to do rescoring
@@ -229,15 +412,74 @@ void AsrDecoder::AttentionRescoring() {
     return;
   }
 
+  RescoringStats& stats = rescoring_stats();
+  // 1. Deduplicate the hypotheses with the same units, it's common in the
+  // nbest of CtcWfstBeamSearch, they only differ in words and share the
+  // rescoring score. unique_scores is the best ctc score of each unit sequence.
+  std::map<std::vector<int>, int> unique_index;
+  std::vector<int> hyp_to_unique(num_hyps);
+  std::vector<float> unique_scores;
+  for (int i = 0; i < num_hyps; ++i) {
+    auto it = unique_index.find(hypotheses[i]);
+    if (it == unique_index.end()) {
+      it = unique_index.emplace(hypotheses[i], unique_scores.size()).first;
+      unique_scores.push_back(result_[i].score);
+    } else {
+      stats.num_deduped_hyps++;
+      unique_scores[it->second] =
+          std::max(unique_scores[it->second], result_[i].score);
+    }
+    hyp_to_unique[i] = it->second;
+  }
+
+  // 2. Skip rescoring if ctc is confident enough
+  std::vector<float> sorted_scores(unique_scores);
+  std::sort(sorted_scores.begin(), sorted_scores.end(), std::greater<float>());
+  float best_score = sorted_scores[0];
+  if (opts_.rescoring_skip_margin > 0 &&
+      (sorted_scores.size() == 1 ||
+       best_score - sorted_scores[1] > opts_.rescoring_skip_margin)) {
+    stats.num_skipped++;
+    VLOG(2) << "Skip rescoring, unique hypotheses " << sorted_scores.size();
+    return;
+  }
+
+  // 3. Prune the hypotheses far below the best one
+  std::vector<std::vector<int>> rescore_hyps;
+  std::vector<int> rescore_index(unique_scores.size(), -1);
+  for (const auto& item : unique_index) {
+    int index = item.second;
+    if (opts_.rescoring_prune_beam > 0 &&
+        best_score - unique_scores[index] > opts_.rescoring_prune_beam) {
+      continue;
+    }
+    rescore_index[index] = rescore_hyps.size();
+    rescore_hyps.push_back(item.first);
+  }
+
   // TODO(zhendong.peng): Do we need rescoring while context matching?
   std::vector<float> rescoring_score;
-  model_->AttentionRescoring(hypotheses, opts_.reverse_weight,
-                             &rescoring_score);
+  RescoreWithCache(rescore_hyps, &rescoring_score);
+  stats.num_rescored++;
 
-  // Combine ctc score and rescoring score
+  // Combine ctc score and rescoring score. The pruned hypotheses are kept
+  // below the rescored ones in the order of their ctc scores, the score of
+  // each one is the worst rescored one minus its ctc gap to the best one.
+  float worst_score = std::numeric_limits<float>::max();
+  std::vector<int> pruned_hyps;
   for (size_t i = 0; i < num_hyps; ++i) {
-    result_[i].score = opts_.rescoring_weight * rescoring_score[i] +
+    int index = rescore_index[hyp_to_unique[i]];
+    if (index < 0) {
+      stats.num_pruned_hyps++;
+      pruned_hyps.push_back(i);
+      continue;
+    }
+    result_[i].score = opts_.rescoring_weight * rescoring_score[index] +
                        opts_.ctc_weight * result_[i].score;
+    worst_score = std::min(worst_score, result_[i].score);
+  }
+  for (int i : pruned_hyps) {
+    result_[i].score = worst_score - (best_score - result_[i].score);
   }
   std::sort(result_.begin(), result_.end(), DecodeResult::CompareFunc);
 }
@@ -16,6 +16,9 @@
 #ifndef DECODER_ASR_DECODER_H_
 #define DECODER_ASR_DECODER_H_
 
+#include <atomic>
+#include <future>
+#include <map>
 #include <memory>
 #include <string>
 #include <unordered_set>
@@ -27,12 +30,15 @@
 
 #include "decoder/asr_model.h"
 #include "decoder/context_graph.h"
+#include "decoder/context_graph_cache.h"
 #include "decoder/ctc_endpoint.h"
 #include "decoder/ctc_prefix_beam_search.h"
 #include "decoder/ctc_wfst_beam_search.h"
 #include "decoder/search_interface.h"
+#include "decoder/worker_groups.h"
 #include "frontend/feature_pipeline.h"
 #include "post_processor/post_processor.h"
+#include "utils/thread_pool.h"
 #include "utils/utils.h"
 
 namespace wenet {
@@ -43,6 +49,13 @@ struct DecodeOptions {
   // one chunk are 64 = 16*4
   int chunk_size = 16;
   int num_left_chunks = -1;
+  // Max number of the frames (after subsampling) of the attention cache if
+  // num_left_chunks < 0, the oldest frames slide out of the window, so the
+  // cost per chunk does not grow in long sessions. <= 0 means unbounded.
+  int max_att_cache_frames = -1;
+  // Storage of the caches and the encoder outputs between chunks, fp16/bf16
+  // or int8 cut the memory per session, see AsrModel::set_state_storage()
+  StorageType state_storage = StorageType::kFloat32;
 
   // final_score = rescoring_weight * rescoring_score + ctc_weight * ctc_score;
   // rescoring_score = left_to_right_score * (1 - reverse_weight) +
@@ -55,6 +68,30 @@ struct DecodeOptions {
   float ctc_weight = 0.5;
   float rescoring_weight = 1.0;
   float reverse_weight = 0.0;
+  // Adaptive attention rescoring, disabled if <= 0.
+  // Skip rescoring when the ctc score of the best hypothesis exceeds the
+  // second best (with different units) by more than rescoring_skip_margin.
+  float rescoring_skip_margin = 0.0;
+  // Only rescore the hypotheses whose ctc score is within
+  // rescoring_prune_beam of the best one, the others are kept in the results
+  // below the rescored ones.
+  float rescoring_prune_beam = 0.0;
+  // Compress the consecutive encoder frames whose ctc blank posterior is
+  // greater than it to one frame for rescoring, 1.0 means no compression.
+  float rescoring_blank_thresh = 1.0;
+  // If > 0, rescore the current nbest in the background every
+  // rescoring_interval chunks. The scores of whole hypotheses are cached and
+  // reused at the endpoint if the encoder outputs are unchanged since then,
+  // which requires rescoring_blank_thresh < 1.0 to merge the trailing blank
+  // frames. No decoder state is carried across the encoder outputs, a
+  // hypothesis missing from the cache is rescored from scratch.
+  int rescoring_interval = 0;
+  // Pipeline the encoder and the search of the chunks, the search of a chunk
+  // runs in the background while the encoder forwards the next one, which
+  // cuts the latency when the search is heavy (e.g. large WFSTs). The partial
+  // results lag one chunk behind, the results at the endpoint and the end are
+  // complete.
+  bool pipelined_search = false;
   CtcEndpointConfig ctc_endpoint_config;
   CtcPrefixBeamSearchOptions ctc_prefix_search_opts;
   CtcWfstBeamSearchOptions ctc_wfst_search_opts;
@@ -87,17 +124,46 @@ enum DecodeState {
   kWaitFeats = 0x03  // Feat is not enough for one chunk inference, wait
 };
 
+// Process wide counters of the adaptive attention rescoring
+struct RescoringStats {
+  std::atomic<int64_t> num_rescored{0};       // rescored decodings
+  std::atomic<int64_t> num_skipped{0};        // skipped for confident ctc
+  std::atomic<int64_t> num_rescored_hyps{0};  // hypotheses fed to decoder
+  std::atomic<int64_t> num_pruned_hyps{0};    // out of rescoring_prune_beam
+  std::atomic<int64_t> num_deduped_hyps{0};   // same units as another one
+  std::atomic<int64_t> num_background{0};     // background rescorings
+  std::atomic<int64_t> num_cached_hyps{0};    // scores reused from cache
+};
+
 // DecodeResource is thread safe, which can be shared for multiple
 // decoding threads
 struct DecodeResource {
   std::shared_ptr<AsrModel> model = nullptr;
   std::shared_ptr<fst::SymbolTable> symbol_table = nullptr;
-  std::shared_ptr<fst::VectorFst<fst::StdArc>> fst = nullptr;
+  // TLG, or the on the fly composition of TL and G, see lookahead_fst.h
+  std::shared_ptr<fst::StdFst> fst = nullptr;
   std::shared_ptr<fst::SymbolTable> unit_table = nullptr;
   std::shared_ptr<ContextGraph> context_graph = nullptr;
+  // Compiles and caches the per session context graphs
+  std::shared_ptr<ContextGraphCache> context_graph_cache = nullptr;
   std::shared_ptr<PostProcessor> post_processor = nullptr;
+  // If not nullptr, the sessions are placed on the groups (NUMA nodes) and
+  // use the resource replicas of them, see WorkerGroups
+  std::shared_ptr<WorkerGroups> worker_groups = nullptr;
+  // The feature config and the decoding options of the model profile (see
+  // ModelRegistry), the sessions of the resource use them instead of the
+  // ones of the command line if they are not nullptr
+  std::shared_ptr<FeaturePipelineConfig> feature_config = nullptr;
+  std::shared_ptr<DecodeOptions> decode_config = nullptr;
 };
 
+// Return the resource for one decoding session with per session contexts,
+// it's a shallow copy of `resource` with the context graph replaced by the
+// (cached) one of `contexts`, and `resource` itself is never changed.
+std::shared_ptr<DecodeResource> GetSessionResource(
+    const std::shared_ptr<DecodeResource>& resource,
+    const std::vector<std::string>& contexts);
+
 // Torch ASR decoder
 class AsrDecoder {
  public:
@@ -110,6 +176,9 @@ class AsrDecoder {
   void Rescoring();
   void Reset();
   void ResetContinuousDecoding();
+  // Replace the context graph (per session hotwords), it's called between
+  // the utterances, e.g. when the decoder is reused by DecoderPool
+  void set_context_graph(std::shared_ptr<ContextGraph> context_graph);
   bool DecodedSomething() const {
     return !result_.empty() && !result_[0].sentence.empty();
   }
@@ -128,10 +197,24 @@ class AsrDecoder {
            feature_pipeline_->config().sample_rate;
   }
   const std::vector<DecodeResult>& result() const { return result_; }
+  static RescoringStats& rescoring_stats();
 
  private:
   DecodeState AdvanceDecoding(bool block = true);
   void AttentionRescoring();
+  // Rescore hyps with the scores of the same hypotheses cached for the
+  // current encoder outputs, only the missing ones are fed to the model
+  void RescoreWithCache(const std::vector<std::vector<int>>& hyps,
+                        std::vector<float>* rescoring_score);
+  void StartBackgroundRescoring();
+  void WaitBackgroundRescoring();
+  void Search(const std::vector<std::vector<float>>& ctc_log_probs,
+              const std::vector<SparseCtcFrame>& sparse_log_probs,
+              bool sparse_ctc);
+  void StartBackgroundSearch(std::vector<std::vector<float>> ctc_log_probs,
+                             std::vector<SparseCtcFrame> sparse_log_probs,
+                             bool sparse_ctc);
+  void WaitBackgroundSearch();
 
   void UpdateResult(bool finish = false);
 
@@ -140,7 +223,7 @@ class AsrDecoder {
   std::shared_ptr<PostProcessor> post_processor_;
   std::shared_ptr<ContextGraph> context_graph_;
 
-  std::shared_ptr<fst::VectorFst<fst::StdArc>> fst_ = nullptr;
+  std::shared_ptr<fst::StdFst> fst_ = nullptr;
   // output symbol table
   std::shared_ptr<fst::SymbolTable> symbol_table_;
   // e2e unit symbol table
@@ -159,6 +242,24 @@ class AsrDecoder {
   int num_frames_in_current_chunk_ = 0;
   std::vector<DecodeResult> result_;
 
+  // For background rescoring
+  int num_chunks_ = 0;
+  // Attention rescoring scores of the encoder outputs of
+  // rescoring_cache_frames_ frames
+  std::map<std::vector<int>, float> rescoring_cache_;
+  int rescoring_cache_frames_ = -1;
+  // The background tasks are declared last, so they are done before the other
+  // members are destroyed.
+  // The rescoring task only runs between chunks, and it's waited for before
+  // the model is changed.
+  std::future<void> rescoring_task_;
+  // The search of the last chunk in the pipelined mode, it only touches the
+  // searcher, and it's waited for before the searcher is used otherwise.
+  std::future<void> search_task_;
+  // The persistent threads of the background tasks of the session, nullptr
+  // if there is none. It's destroyed first, after the pending tasks are run.
+  std::unique_ptr<ThreadPool> background_pool_;
+
  public:
   WENET_DISALLOW_COPY_AND_ASSIGN(AsrDecoder);
 };
@@ -2,9 +2,13 @@
 
 #include "decoder/asr_model.h"
 
+#include <algorithm>
+#include <cmath>
 #include <memory>
 #include <utility>
 
+#include "utils/log.h"
+
 namespace wenet {
 
 int AsrModel::num_frames_for_chunk(bool start) const {
@@ -22,6 +26,21 @@ int AsrModel::num_frames_for_chunk(bool start) const {
   return num_required_frames;
 }
 
+int AsrModel::num_output_frames(int num_frames) const {
+  // The inverse of num_frames_for_chunk(false), the trailing frames less
+  // than a subsampling step are dropped as by the convolutions
+  if (num_frames < right_context_ + 1) return 0;
+  return (num_frames - right_context_ - 1) / subsampling_rate_ + 1;
+}
+
+int AsrModel::encoder_offset() const {
+  // The attention cache is all the previous frames until the window is full
+  if (num_left_chunks_ < 0 && max_att_cache_frames_ > 0) {
+    return std::min(offset_, max_att_cache_frames_);
+  }
+  return offset_;
+}
+
 void AsrModel::CacheFeature(
     const std::vector<std::vector<float>>& chunk_feats) {
   // Cache feature for next chunk
@@ -39,6 +58,23 @@ void AsrModel::CacheFeature(
   }
 }
 
+void AsrModel::SelectRescoringFrames(const std::vector<float>& blank_logp,
+                                     std::vector<int>* frames) {
+  frames->clear();
+  if (rescoring_blank_thresh_ >= 1.0) {
+    for (size_t i = 0; i < blank_logp.size(); ++i) frames->push_back(i);
+    return;
+  }
+  const float log_thresh = std::log(rescoring_blank_thresh_);
+  for (size_t i = 0; i < blank_logp.size(); ++i) {
+    bool is_blank = blank_logp[i] > log_thresh;
+    if (!is_blank || !last_frame_blank_) {
+      frames->push_back(i);
+    }
+    last_frame_blank_ = is_blank;
+  }
+}
+
 void AsrModel::ForwardEncoder(
     const std::vector<std::vector<float>>& chunk_feats,
     std::vector<std::vector<float>>* ctc_prob) {
@@ -50,4 +86,21 @@ void AsrModel::ForwardEncoder(
   }
 }
 
+void AsrModel::ForwardEncoder(
+    const std::vector<std::vector<float>>& chunk_feats,
+    std::vector<SparseCtcFrame>* ctc_prob) {
+  ctc_prob->clear();
+  int num_frames = cached_feature_.size() + chunk_feats.size();
+  if (num_frames >= right_context_ + 1) {
+    this->ForwardEncoderSparseFunc(chunk_feats, ctc_prob);
+    this->CacheFeature(chunk_feats);
+  }
+}
+
+void AsrModel::ForwardEncoderSparseFunc(
+    const std::vector<std::vector<float>>& chunk_feats,
+    std::vector<SparseCtcFrame>* ctc_prob) {
+  LOG(FATAL) << "The model does not support the sparse ctc posterior.";
+}
+
 }  // namespace wenet
@@ -8,6 +8,8 @@
 #include <string>
 #include <vector>
 
+#include "decoder/ctc_posterior.h"
+#include "utils/compact_buffer.h"
 #include "utils/timer.h"
 #include "utils/utils.h"
 
@@ -23,20 +25,59 @@ class AsrModel {
     return is_bidirectional_decoder_;
   }
   virtual int offset() const { return offset_; }
+  // The offset of the next chunk fed to the encoder. It's offset() but with
+  // the sliding window of the attention cache, where the positions are
+  // relative to the start of the window, so they stay within the max length
+  // of the positional encoding of the encoder in infinite streams.
+  int encoder_offset() const;
 
   // If chunk_size > 0, streaming case. Otherwise, none streaming case
   virtual void set_chunk_size(int chunk_size) { chunk_size_ = chunk_size; }
   virtual void set_num_left_chunks(int num_left_chunks) {
     num_left_chunks_ = num_left_chunks;
   }
+  // Sliding window of the attention cache if num_left_chunks < 0, the cache
+  // keeps the last `frames` frames at most, <= 0 means unbounded
+  virtual void set_max_att_cache_frames(int frames) {
+    max_att_cache_frames_ = frames;
+  }
+  // Blank frame compression of the encoder outputs for attention rescoring,
+  // only the first frame of consecutive blank frames, whose blank posterior is
+  // greater than thresh, is kept. thresh >= 1.0 means no compression.
+  virtual void set_rescoring_blank_thresh(float thresh, int blank = 0) {
+    rescoring_blank_thresh_ = thresh;
+    blank_ = blank;
+  }
+  // Whether to keep the encoder outputs for attention rescoring, they are
+  // not required if rescoring is disabled
+  virtual void set_keep_encoder_out(bool keep) { keep_encoder_out_ = keep; }
+  // Storage type of the caches and the encoder outputs between chunks, they
+  // are converted to fp32 at the engine boundary. The states are reset if
+  // the type is changed.
+  virtual void set_state_storage(StorageType type) {
+    if (type == state_storage_) return;
+    state_storage_ = type;
+    Reset();
+  }
+  // Number of the encoder frames kept for attention rescoring, -1 if unknown
+  virtual int num_rescoring_frames() const { return -1; }
+  // Whether the CTC posterior of the model is the sparse top k, then the
+  // sparse ForwardEncoder() should be used
+  virtual bool sparse_ctc() const { return false; }
   // start: if it is the start chunk of one sentence
   virtual int num_frames_for_chunk(bool start) const;
+  // Number of the encoder output frames of `num_frames` input frames (the
+  // cached frames included) of one chunk after subsampling
+  int num_output_frames(int num_frames) const;
 
   virtual void Reset() = 0;
 
   virtual void ForwardEncoder(
       const std::vector<std::vector<float>>& chunk_feats,
       std::vector<std::vector<float>>* ctc_prob);
+  virtual void ForwardEncoder(
+      const std::vector<std::vector<float>>& chunk_feats,
+      std::vector<SparseCtcFrame>* ctc_prob);
 
   virtual void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
                                   float reverse_weight,
@@ -48,7 +89,14 @@ class AsrModel {
   virtual void ForwardEncoderFunc(
       const std::vector<std::vector<float>>& chunk_feats,
       std::vector<std::vector<float>>* ctc_prob) = 0;
+  virtual void ForwardEncoderSparseFunc(
+      const std::vector<std::vector<float>>& chunk_feats,
+      std::vector<SparseCtcFrame>* ctc_prob);
   virtual void CacheFeature(const std::vector<std::vector<float>>& chunk_feats);
+  // Select the frames of the chunk to keep for rescoring by their blank log
+  // probs, see set_rescoring_blank_thresh()
+  void SelectRescoringFrames(const std::vector<float>& blank_logp,
+                             std::vector<int>* frames);
 
   int right_context_ = 1;
   int subsampling_rate_ = 1;
@@ -57,7 +105,14 @@ class AsrModel {
   bool is_bidirectional_decoder_ = false;
   int chunk_size_ = 16;
   int num_left_chunks_ = -1;  // -1 means all left chunks
+  int max_att_cache_frames_ = -1;
   int offset_ = 0;
+  bool keep_encoder_out_ = true;
+  StorageType state_storage_ = StorageType::kFloat32;
+  float rescoring_blank_thresh_ = 1.0;
+  int blank_ = 0;
+  // If the last frame of the previous chunk is blank, reset it in Reset()
+  bool last_frame_blank_ = false;
 
   std::vector<std::vector<float>> cached_feature_;
 };
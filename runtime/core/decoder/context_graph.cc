@@ -14,145 +14,256 @@
 
 #include "decoder/context_graph.h"
 
+#include <algorithm>
 #include <fstream>
 #include <queue>
 #include <utility>
 
-#include "fst/determinize.h"
-
+#include "utils/log.h"
 #include "utils/string.h"
 #include "utils/utils.h"
 
 namespace wenet {
 
-// Split the UTF-8 string into unit ids according to unit_table
-bool SplitContextToUnits(const std::string& context,
-                         const std::shared_ptr<fst::SymbolTable>& unit_table,
-                         std::vector<int>* units) {
+namespace {
+
+// Binary format of the compiled context graph: magic, version, the scores
+// and the sources it's built from, then the flat tables one by one, each one
+// is prefixed by its size. The derived tables (the closure and the dense
+// table of the start state) are rebuilt after reading.
+const int32_t kContextGraphMagic = 0x58544357;  // "WCTX"
+const int32_t kContextGraphVersion = 3;
+// Unit ids of the saved graph beyond it are malformed, the dense table of the
+// start state is indexed by them
+const int kMaxUnitId = 1 << 24;
+// The closure has up to the states times the units arcs, e.g. when many
+// contexts share their prefixes and suffixes, beyond it the graph is warned
+const size_t kClosedArcsWarningBytes = 256 << 20;
+
+template <typename T>
+void WriteVector(const std::vector<T>& vec, std::ostream* os) {
+  int64_t size = vec.size();
+  os->write(reinterpret_cast<const char*>(&size), sizeof(size));
+  os->write(reinterpret_cast<const char*>(vec.data()), size * sizeof(T));
+}
+
+// `max_bytes` bounds the size read from the file
+template <typename T>
+bool ReadVector(std::istream* is, int64_t max_bytes, std::vector<T>* vec) {
+  int64_t size = 0;
+  is->read(reinterpret_cast<char*>(&size), sizeof(size));
+  if (!is->good() || size < 0 ||
+      static_cast<uint64_t>(size) > max_bytes / sizeof(T)) {
+    return false;
+  }
+  vec->resize(size);
+  is->read(reinterpret_cast<char*>(vec->data()), size * sizeof(T));
+  return is->good();
+}
+
+}  // namespace
+
+UnitTrie::UnitTrie(const fst::SymbolTable& unit_table) {
+  nodes_.emplace_back();
+  for (fst::SymbolTableIterator it(unit_table); !it.Done(); it.Next()) {
+    std::vector<std::string> chars;
+    SplitUTF8StringToChars(it.Symbol(), &chars);
+    int node = 0;
+    for (const auto& ch : chars) {
+      auto child = nodes_[node].children.find(ch);
+      if (child == nodes_[node].children.end()) {
+        nodes_[node].children[ch] = nodes_.size();
+        node = nodes_.size();
+        nodes_.emplace_back();
+      } else {
+        node = child->second;
+      }
+    }
+    if (node > 0) nodes_[node].unit_id = it.Value();
+  }
+  space_id_ = unit_table.Find(kSpaceSymbol);
+  space_node_ = FindChild(0, kSpaceSymbol);
+}
+
+int UnitTrie::FindChild(int node, const std::string& ch) const {
+  if (node < 0) return -1;
+  const auto& children = nodes_[node].children;
+  auto it = children.find(ch);
+  return it == children.end() ? -1 : it->second;
+}
+
+// Split the UTF-8 string into unit ids by greedy longest match
+bool UnitTrie::Split(const std::string& context,
+                     std::vector<int>* units) const {
   std::vector<std::string> chars;
   SplitUTF8StringToChars(context, &chars);
 
   bool no_oov = true;
   bool beginning = true;
   for (size_t start = 0; start < chars.size();) {
-    for (size_t end = chars.size(); end > start; --end) {
-      std::string unit;
-      for (size_t i = start; i < end; i++) {
-        unit += chars[i];
-      }
-      // Add '▁' at the beginning of English word.
-      // TODO(zhendong.peng): Support bpe model
-      if (IsAlpha(unit) && beginning) {
-        unit = kSpaceSymbol + unit;
+    int unit_id = -1;
+    size_t end = start;
+    // Add '▁' at the beginning of English word, the units starting with '▁'
+    // only consist of alphabets here.
+    // TODO(zhendong.peng): Support bpe model
+    if (beginning) {
+      int node = space_node_;
+      for (size_t i = start; i < chars.size() && IsAlpha(chars[i]); i++) {
+        node = FindChild(node, chars[i]);
+        if (node < 0) break;
+        if (nodes_[node].unit_id != -1) {
+          unit_id = nodes_[node].unit_id;
+          end = i + 1;
+        }
       }
-
-      int unit_id = unit_table->Find(unit);
-      if (unit_id != -1) {
-        units->emplace_back(unit_id);
-        start = end;
-        beginning = false;
-        continue;
+    }
+    // Units without '▁', the pure alphabet ones are excluded at the beginning
+    // of English word since '▁' is required there
+    int node = 0;
+    bool is_alpha = true;
+    for (size_t i = start; i < chars.size(); i++) {
+      node = FindChild(node, chars[i]);
+      if (node < 0) break;
+      is_alpha = is_alpha && IsAlpha(chars[i]);
+      if (nodes_[node].unit_id != -1 && i + 1 > end &&
+          !(beginning && is_alpha)) {
+        unit_id = nodes_[node].unit_id;
+        end = i + 1;
       }
+    }
 
-      if (end == start + 1) {
-        // Matching using '▁' separately for English
-        if (unit[0] == kSpaceSymbol[0]) {
-          units->emplace_back(unit_table->Find(kSpaceSymbol));
-          beginning = false;
-          break;
-        }
-        ++start;
-        if (unit == " ") {
-          beginning = true;
-          continue;
-        }
+    if (unit_id != -1) {
+      units->emplace_back(unit_id);
+      start = end;
+      beginning = false;
+    } else if (beginning && IsAlpha(chars[start]) && space_id_ != -1) {
+      // Matching using '▁' separately for English
+      units->emplace_back(space_id_);
+      beginning = false;
+    } else {
+      if (chars[start] == " ") {
+        beginning = true;
+      } else {
         no_oov = false;
-        LOG(WARNING) << unit << " is oov.";
+        LOG(WARNING) << chars[start] << " is oov.";
       }
+      ++start;
     }
   }
   return no_oov;
 }
 
-ContextGraph::ContextGraph(ContextConfig config) : config_(config) {}
+ContextGraph::ContextGraph(ContextConfig config,
+                           std::shared_ptr<const ContextGraph> base)
+    : config_(config), base_(std::move(base)) {}
 
-int ContextGraph::TraceContext(int cur_state, int unit_id, int* final_state) {
-  CHECK_GE(cur_state, 0);
-  int next_state = 0;
-  Matcher matcher(*graph_, fst::MATCH_INPUT);
-  matcher.SetState(cur_state);
-  if (matcher.Find(unit_id)) {
-    next_state = matcher.Value().nextstate;
-    if (graph_->Final(next_state) != Weight::Zero()) {
-      *final_state = next_state;
-    }
-    return next_state;
-  }
-  LOG(FATAL) << "Trace context failed.";
+void ContextGraph::BuildContextGraph(
+    const std::vector<std::string>& contexts,
+    const std::shared_ptr<fst::SymbolTable>& unit_table) {
+  BuildContextGraph(contexts, std::make_shared<UnitTrie>(*unit_table));
 }
 
 void ContextGraph::BuildContextGraph(
     const std::vector<std::string>& contexts,
-    const std::shared_ptr<fst::SymbolTable>& unit_table) {
-  // Split context phrase into unit ids according to the `unit_table`
-  std::unordered_map<std::string, std::vector<int>> context_units;
+    std::shared_ptr<const UnitTrie> unit_trie) {
+  unit_trie_ = std::move(unit_trie);
+  // Split context phrase into unit ids according to the `unit_trie_`
+  std::vector<std::vector<int>> context_units;
+  contexts_.clear();
   for (const auto& context : contexts) {
     std::vector<int> units;
-    bool no_oov = SplitContextToUnits(context, unit_table, &units);
+    bool no_oov = SplitContextToUnits(context, &units);
     if (!no_oov) {
       LOG(WARNING) << "Ignore unknown unit found during compilation.";
       continue;
     }
-    context_units[context] = units;
+    if (units.empty()) continue;
+    context_units.emplace_back(std::move(units));
+    contexts_.emplace_back(context);
   }
+  std::vector<int> finals;
+  BuildTrie(context_units, &finals);
+  // Convert context graph to AC automaton
+  BuildFailLinks(finals);
+  BuildClosure();
+}
+
+bool ContextGraph::SplitContextToUnits(const std::string& context,
+                                       std::vector<int>* units) const {
+  CHECK(unit_trie_ != nullptr) << "The graph is not built by a unit trie.";
+  return unit_trie_->Split(context, units);
+}
 
-  // Build the context graph
-  std::unique_ptr<fst::StdVectorFst> ofst(new fst::StdVectorFst());
-  int start_state = ofst->AddState();
-  ofst->SetStart(start_state);
+uint64_t ContextGraph::HashContexts(const std::vector<std::string>& contexts) {
+  uint64_t hash = HashBytes(nullptr, 0);
   for (const auto& context : contexts) {
-    if (context_units.count(context) == 0) continue;
-    std::vector<int> units = context_units[context];
-    int state = start_state;
-    int next_state = state;
-    for (size_t i = 0; i < units.size(); ++i) {
-      next_state = ofst->AddState();
-      if (i == units.size() - 1) {
-        ofst->SetFinal(next_state, Weight::One());
+    // Including the terminating '\0', so the boundaries are hashed as well
+    hash = HashBytes(context.c_str(), context.size() + 1, hash);
+  }
+  return hash;
+}
+
+void ContextGraph::BuildTrie(
+    const std::vector<std::vector<int>>& context_units,
+    std::vector<int>* finals) {
+  // Insert the contexts to the trie, the children are kept in a hash map
+  // keyed by (state, unit) during construction, and flattened later.
+  std::unordered_map<uint64_t, int> children;
+  std::vector<int> depths(1, 0);
+  finals->assign(1, -1);
+  auto key = [](int state, int unit_id) {
+    return (static_cast<uint64_t>(state) << 32) |
+           static_cast<uint32_t>(unit_id);
+  };
+  for (size_t i = 0; i < context_units.size(); i++) {
+    int state = 0;
+    for (int unit_id : context_units[i]) {
+      auto it = children.find(key(state, unit_id));
+      if (it != children.end()) {
+        state = it->second;
+      } else {
+        int next_state = finals->size();
+        children[key(state, unit_id)] = next_state;
+        finals->emplace_back(-1);
+        depths.emplace_back(depths[state] + 1);
+        state = next_state;
       }
-      float score =
-          i * config_.incremental_context_score + config_.context_score;
-      ofst->AddArc(state, fst::StdArc(units[i], units[i], score, next_state));
-      state = next_state;
     }
+    // The latter one wins for the duplicated contexts
+    (*finals)[state] = i;
   }
-  graph_ = std::unique_ptr<fst::StdVectorFst>(new fst::StdVectorFst());
-  // input/output label are sorted after Determinize
-  fst::Determinize(*ofst, graph_.get());
 
-  // Determinize will change the final state id
-  for (const auto& context : contexts) {
-    if (context_units.count(context) == 0) continue;
-    std::vector<int> units = context_units[context];
-    int final_state = -1;
-    int cur_state = 0;
-    for (int unit : units) {
-      cur_state = TraceContext(cur_state, unit, &final_state);
+  // Flatten the arcs to CSR, sorted by (state, ilabel)
+  std::vector<std::pair<uint64_t, int>> sorted_children(children.begin(),
+                                                         children.end());
+  children.clear();
+  std::sort(sorted_children.begin(), sorted_children.end());
+  int num_states = finals->size();
+  states_.assign(num_states, ContextState());
+  arcs_.clear();
+  arcs_.reserve(sorted_children.size());
+  size_t arc_index = 0;
+  for (int state = 0; state < num_states; state++) {
+    ContextState& context_state = states_[state];
+    context_state.arc_begin = arcs_.size();
+    float weight = depths[state] * config_.incremental_context_score +
+                   config_.context_score;
+    for (; arc_index < sorted_children.size() &&
+           static_cast<int>(sorted_children[arc_index].first >> 32) == state;
+         arc_index++) {
+      const auto& child = sorted_children[arc_index];
+      int ilabel = static_cast<int>(child.first & 0xFFFFFFFF);
+      arcs_.push_back({ilabel, child.second, weight});
     }
-    CHECK_GT(final_state, 0);
-    context_table_[final_state] = context;
+    context_state.arc_end = arcs_.size();
+    context_state.is_final = (*finals)[state] >= 0;
   }
-
-  // Convert context graph to AC automaton
-  ConvertToAC();
 }
 
-void ContextGraph::ConvertToAC() {
-  CHECK(graph_ != nullptr) << "Context graph should not be nullptr!";
-  int num_states = graph_->NumStates();
+void ContextGraph::BuildFailLinks(const std::vector<int>& finals) {
+  int num_states = states_.size();
   std::vector<int> fail_states(num_states, 0);
   std::vector<float> total_weights(num_states, 0);
-  Matcher matcher(*graph_, fst::MATCH_INPUT);
   // start state
   fail_states[0] = -1;
   total_weights[0] = 0;
@@ -165,16 +276,16 @@ void ContextGraph::ConvertToAC() {
     int state = states_queue.front();
     states_queue.pop();
 
-    for (ArcIterator aiter(*graph_, state); !aiter.Done(); aiter.Next()) {
-      const fst::StdArc& arc = aiter.Value();
+    for (int i = states_[state].arc_begin; i < states_[state].arc_end; i++) {
+      const ContextArc& arc = arcs_[i];
       int next_state = arc.nextstate;
-      total_weights[next_state] = total_weights[state] + arc.weight.Value();
+      total_weights[next_state] = total_weights[state] + arc.weight;
       // Backtracking the failure state for next_state
       for (int fail_state = fail_states[state]; fail_state != -1;
            fail_state = fail_states[fail_state]) {
-        matcher.SetState(fail_state);
-        if (matcher.Find(arc.ilabel)) {
-          fail_states[next_state] = matcher.Value().nextstate;
+        const ContextArc* fail_arc = FindArc(fail_state, arc.ilabel);
+        if (fail_arc != nullptr) {
+          fail_states[next_state] = fail_arc->nextstate;
           break;
         }
       }
@@ -182,71 +293,378 @@ void ContextGraph::ConvertToAC() {
     }
   }
 
-  // Compute fail weight, add fail arc
+  // Compute fail weight, add fail arc, and the contexts matched when entering
+  // each state, including the ones reached by following the fallback finals
+  outputs_.clear();
   for (int state = 0; state < num_states; state++) {
+    ContextState& context_state = states_[state];
+    context_state.output_begin = outputs_.size();
+    if (finals[state] >= 0) {
+      outputs_.emplace_back(finals[state]);
+    }
+    for (int s = fail_states[state]; s > 0 && finals[s] >= 0;
+         s = fail_states[s]) {
+      outputs_.emplace_back(finals[s]);
+    }
+    context_state.output_end = outputs_.size();
+
     int fail_state = fail_states[state];
     if (fail_state < 0) continue;
-    if (graph_->Final(fail_state) != Weight::Zero()) {
-      fallback_finals_[state] = fail_state;
-      if (graph_->NumArcs(fail_state) == 0) continue;
+    bool fail_has_arcs =
+        states_[fail_state].arc_end > states_[fail_state].arc_begin;
+    if (finals[fail_state] >= 0 && !fail_has_arcs) continue;
+    if (finals[state] >= 0 && fail_state == 0) continue;
+    context_state.fail_state = fail_state;
+    context_state.fail_weight = finals[state] >= 0
+                                    ? 0
+                                    : total_weights[fail_state] -
+                                          total_weights[state];
+  }
+}
+
+void ContextGraph::BuildClosure() {
+  int num_states = states_.size();
+  closed_arcs_.clear();
+  std::vector<bool> closed(num_states, false);
+  closed[0] = true;
+  std::vector<int> chain;
+  std::vector<ContextArc> merged;
+  auto arc_less = [](const ContextArc& a, const ContextArc& b) {
+    return a.ilabel < b.ilabel;
+  };
+  for (int state = 1; state < num_states; state++) {
+    // The fallback states are closed before the states falling back to them
+    chain.clear();
+    for (int s = state; s > 0 && !closed[s]; s = states_[s].fail_state) {
+      chain.emplace_back(s);
+    }
+    for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+      ContextState& context_state = states_[*it];
+      int fail_state = context_state.fail_state;
+      merged.assign(arcs_.begin() + context_state.arc_begin,
+                    arcs_.begin() + context_state.arc_end);
+      context_state.backoff_weight = 0;
+      context_state.backoff_to_start = fail_state == 0;
+      if (fail_state >= 0) {
+        context_state.backoff_weight = context_state.fail_weight;
+      }
+      // The arcs of the start state are looked up in its dense table
+      if (fail_state > 0) {
+        const ContextState& fail = states_[fail_state];
+        size_t num_arcs = merged.size();
+        for (int i = fail.closed_begin; i < fail.closed_end; i++) {
+          ContextArc arc = closed_arcs_[i];
+          auto end = merged.begin() + num_arcs;
+          auto pos = std::lower_bound(merged.begin(), end, arc, arc_less);
+          if (pos != end && pos->ilabel == arc.ilabel) continue;
+          arc.weight += context_state.fail_weight;
+          merged.emplace_back(arc);
+        }
+        std::inplace_merge(merged.begin(), merged.begin() + num_arcs,
+                           merged.end(), arc_less);
+        context_state.backoff_weight += fail.backoff_weight;
+        context_state.backoff_to_start = fail.backoff_to_start;
+      }
+      context_state.closed_begin = closed_arcs_.size();
+      closed_arcs_.insert(closed_arcs_.end(), merged.begin(), merged.end());
+      context_state.closed_end = closed_arcs_.size();
+      closed[*it] = true;
     }
-    if (graph_->Final(state) != Weight::Zero() && fail_state == 0) continue;
+  }
 
-    float fail_weight = total_weights[fail_state] - total_weights[state];
-    if (graph_->Final(state) != Weight::Zero()) {
-      fail_weight = 0;
+  // Dense goto table of the start state
+  start_arcs_.clear();
+  const ContextState& start = states_[0];
+  for (int i = start.arc_begin; i < start.arc_end; i++) {
+    int ilabel = arcs_[i].ilabel;
+    if (static_cast<size_t>(ilabel) >= start_arcs_.size()) {
+      start_arcs_.resize(ilabel + 1, -1);
     }
-    graph_->AddArc(state, fst::StdArc(0, 0, fail_weight, fail_state));
+    start_arcs_[ilabel] = i;
+  }
+  size_t closed_bytes = closed_arcs_.size() * sizeof(ContextArc) +
+                        start_arcs_.size() * sizeof(int);
+  if (closed_bytes > kClosedArcsWarningBytes) {
+    LOG(WARNING) << "The closure of the context graph of " << num_states
+                 << " states is " << (closed_bytes >> 20) << " MB, consider "
+                 << "fewer or shorter contexts.";
+  }
+}
+
+const ContextArc* ContextGraph::FindArc(int state, int unit_id) const {
+  const ContextState& context_state = states_[state];
+  auto begin = arcs_.begin() + context_state.arc_begin;
+  auto end = arcs_.begin() + context_state.arc_end;
+  auto it = std::lower_bound(
+      begin, end, unit_id,
+      [](const ContextArc& arc, int ilabel) { return arc.ilabel < ilabel; });
+  if (it != end && it->ilabel == unit_id) {
+    return &(*it);
+  }
+  return nullptr;
+}
+
+const ContextArc* ContextGraph::FindClosedArc(int state, int unit_id) const {
+  if (state == 0) {
+    if (unit_id < 0 || static_cast<size_t>(unit_id) >= start_arcs_.size() ||
+        start_arcs_[unit_id] < 0) {
+      return nullptr;
+    }
+    return &arcs_[start_arcs_[unit_id]];
+  }
+  const ContextState& context_state = states_[state];
+  auto begin = closed_arcs_.begin() + context_state.closed_begin;
+  auto end = closed_arcs_.begin() + context_state.closed_end;
+  auto it = std::lower_bound(
+      begin, end, unit_id,
+      [](const ContextArc& arc, int ilabel) { return arc.ilabel < ilabel; });
+  if (it != end && it->ilabel == unit_id) {
+    return &(*it);
   }
-  // Sort arcs by ilabel, means move the fallback arc from last to first for the
-  // matcher
-  fst::ArcSort(graph_.get(), fst::ILabelCompare<fst::StdArc>());
+  return nullptr;
 }
 
-int ContextGraph::GetNextState(int cur_state, int unit_id, float* score,
-                               std::unordered_set<std::string>* contexts) {
+void ContextGraph::CollectContexts(
+    int state, std::unordered_set<std::string>* contexts) const {
+  const ContextState& context_state = states_[state];
+  for (int i = context_state.output_begin; i < context_state.output_end;
+       i++) {
+    contexts->insert(contexts_[outputs_[i]]);
+  }
+}
+
+int ContextGraph::GetNextState(
+    int cur_state, int unit_id, float* score,
+    std::unordered_set<std::string>* contexts) const {
   CHECK_GE(cur_state, 0);
-  // Find(0) matches any epsilons on the underlying FST explicitly
   CHECK_NE(unit_id, 0);
-  int next_state = 0;
-
-  Matcher matcher(*graph_, fst::MATCH_INPUT);
-  matcher.SetState(cur_state);
-  if (matcher.Find(unit_id)) {
-    const fst::StdArc& arc = matcher.Value();
-    next_state = arc.nextstate;
-    *score += arc.weight.Value();
-    // Collect all contexts in the decode result
-    if (contexts != nullptr) {
-      if (graph_->Final(next_state) != Weight::Zero()) {
-        contexts->insert(context_table_[next_state]);
-      }
-      int fallback_final = next_state;
-      while (fallback_finals_.count(fallback_final) > 0) {
-        fallback_final = fallback_finals_[fallback_final];
-        contexts->insert(context_table_[fallback_final]);
-      }
+  if (base_ == nullptr) {
+    return NextState(cur_state, unit_id, score, contexts);
+  }
+  // The layered state is base_state * num_states() + state
+  int num_states = states_.size();
+  int base_state = base_->GetNextState(cur_state / num_states, unit_id, score,
+                                       contexts);
+  int state = NextState(cur_state % num_states, unit_id, score, contexts);
+  return base_state * num_states + state;
+}
+
+bool ContextGraph::IsFinalState(int state) const {
+  if (base_ == nullptr) return states_[state].is_final;
+  int num_states = states_.size();
+  return base_->IsFinalState(state / num_states) ||
+         states_[state % num_states].is_final;
+}
+
+int ContextGraph::NextState(int cur_state, int unit_id, float* score,
+                            std::unordered_set<std::string>* contexts) const {
+  const ContextState& context_state = states_[cur_state];
+  int next_state = -1;
+  if (unit_id == fst::kNoLabel) {
+    // Backoff one step by the fallback arc
+    if (context_state.fail_state < 0) return 0;
+    next_state = context_state.fail_state;
+    *score += context_state.fail_weight;
+  } else {
+    const ContextArc* arc = FindClosedArc(cur_state, unit_id);
+    if (arc == nullptr) {
+      // Fallback to the end of the chain at once, the start state has no
+      // fallback arc
+      *score += context_state.backoff_weight;
+      if (!context_state.backoff_to_start) return 0;
+      arc = FindClosedArc(0, unit_id);
+      if (arc == nullptr) return 0;
     }
+    next_state = arc->nextstate;
+    *score += arc->weight;
+  }
+  // Collect all contexts in the decode result
+  if (contexts != nullptr) {
+    CollectContexts(next_state, contexts);
+  }
+  // Leaves go back to the start state
+  return states_[next_state].is_leaf() ? 0 : next_state;
+}
 
-    // Leaves go back to the start state
-    if (graph_->NumArcs(next_state) == 0) {
-      return 0;
+bool ContextGraph::CheckTable() const {
+  int num_states = states_.size();
+  int num_arcs = arcs_.size();
+  int num_outputs = outputs_.size();
+  int num_contexts = contexts_.size();
+  if (num_states == 0 || states_[0].fail_state != -1) return false;
+  for (int state = 0; state < num_states; state++) {
+    const ContextState& context_state = states_[state];
+    if (context_state.arc_begin < 0 ||
+        context_state.arc_begin > context_state.arc_end ||
+        context_state.arc_end > num_arcs ||
+        context_state.output_begin < 0 ||
+        context_state.output_begin > context_state.output_end ||
+        context_state.output_end > num_outputs ||
+        context_state.fail_state < -1 ||
+        context_state.fail_state >= num_states) {
+      return false;
+    }
+    for (int i = context_state.arc_begin; i < context_state.arc_end; i++) {
+      const ContextArc& arc = arcs_[i];
+      if (arc.ilabel <= 0 || arc.ilabel > kMaxUnitId || arc.nextstate <= 0 ||
+          arc.nextstate >= num_states ||
+          (i > context_state.arc_begin && arcs_[i - 1].ilabel >= arc.ilabel)) {
+        return false;
+      }
+    }
+  }
+  for (int output : outputs_) {
+    if (output < 0 || output >= num_contexts) return false;
+  }
+  // The fallback chains must end, 1 means on the chain being walked, and 2
+  // means the chain of the state ends
+  std::vector<char> visited(num_states, 0);
+  std::vector<int> chain;
+  for (int state = 0; state < num_states; state++) {
+    chain.clear();
+    int s = state;
+    for (; s >= 0 && visited[s] == 0; s = states_[s].fail_state) {
+      visited[s] = 1;
+      chain.emplace_back(s);
     }
-    return next_state;
+    if (s >= 0 && visited[s] == 1) return false;
+    for (int c : chain) visited[c] = 2;
+  }
+  return true;
+}
+
+bool ContextGraph::Write(const std::string& filename,
+                         const ContextGraphSource& source) const {
+  std::ofstream os(filename, std::ios::binary);
+  if (!os.is_open()) {
+    LOG(WARNING) << "Failed to open " << filename;
+    return false;
+  }
+  int32_t header[] = {kContextGraphMagic, kContextGraphVersion};
+  os.write(reinterpret_cast<const char*>(header), sizeof(header));
+  float scores[] = {config_.context_score, config_.incremental_context_score};
+  os.write(reinterpret_cast<const char*>(scores), sizeof(scores));
+  uint64_t context_hash = source.context_hash;
+  os.write(reinterpret_cast<const char*>(&context_hash), sizeof(context_hash));
+  int64_t num_units = source.num_units;
+  os.write(reinterpret_cast<const char*>(&num_units), sizeof(num_units));
+  // The fields of the states one by one, not the struct with its padding
+  int num_states = states_.size();
+  std::vector<int32_t> arc_ends(num_states), fail_states(num_states),
+      output_ends(num_states), finals(num_states);
+  std::vector<float> fail_weights(num_states);
+  for (int i = 0; i < num_states; i++) {
+    arc_ends[i] = states_[i].arc_end;
+    fail_states[i] = states_[i].fail_state;
+    fail_weights[i] = states_[i].fail_weight;
+    output_ends[i] = states_[i].output_end;
+    finals[i] = states_[i].is_final;
+  }
+  WriteVector(arc_ends, &os);
+  WriteVector(fail_states, &os);
+  WriteVector(fail_weights, &os);
+  WriteVector(output_ends, &os);
+  WriteVector(finals, &os);
+  WriteVector(arcs_, &os);
+  WriteVector(outputs_, &os);
+  int64_t num_contexts = contexts_.size();
+  os.write(reinterpret_cast<const char*>(&num_contexts), sizeof(num_contexts));
+  for (const auto& context : contexts_) {
+    int64_t length = context.size();
+    os.write(reinterpret_cast<const char*>(&length), sizeof(length));
+    os.write(context.data(), length);
+  }
+  return os.good();
+}
+
+bool ContextGraph::Read(const std::string& filename,
+                        const ContextGraphSource& source) {
+  std::ifstream is(filename, std::ios::binary);
+  if (!is.is_open()) {
+    LOG(WARNING) << "Failed to open " << filename;
+    return false;
+  }
+  is.seekg(0, std::ios::end);
+  int64_t file_size = is.tellg();
+  is.seekg(0, std::ios::beg);
+  int32_t header[2] = {0};
+  is.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!is.good() || header[0] != kContextGraphMagic ||
+      header[1] != kContextGraphVersion) {
+    LOG(WARNING) << filename << " is not a compatible context graph.";
+    return false;
+  }
+  float scores[2] = {0};
+  is.read(reinterpret_cast<char*>(scores), sizeof(scores));
+  uint64_t context_hash = 0;
+  is.read(reinterpret_cast<char*>(&context_hash), sizeof(context_hash));
+  int64_t num_units = 0;
+  is.read(reinterpret_cast<char*>(&num_units), sizeof(num_units));
+  if (!is.good()) {
+    LOG(WARNING) << "Failed to read context graph from " << filename;
+    return false;
+  }
+  if (scores[0] != config_.context_score ||
+      scores[1] != config_.incremental_context_score ||
+      (source.context_hash != 0 && context_hash != source.context_hash) ||
+      (source.num_units >= 0 && num_units != source.num_units)) {
+    LOG(WARNING) << filename << " is stale, its scores, context list or unit "
+                 << "table differ from the current ones.";
+    return false;
   }
 
-  // Check whether the first arc is fallback arc
-  ArcIterator aiter(*graph_, cur_state);
-  const fst::StdArc& arc = aiter.Value();
-  // The start state has no fallback arc
-  if (arc.ilabel == 0) {
-    next_state = arc.nextstate;
-    *score += arc.weight.Value();
-    // fallback
-    return GetNextState(next_state, unit_id, score);
+  std::vector<int32_t> arc_ends, fail_states, output_ends, finals;
+  std::vector<float> fail_weights;
+  if (!ReadVector(&is, file_size, &arc_ends) ||
+      !ReadVector(&is, file_size, &fail_states) ||
+      !ReadVector(&is, file_size, &fail_weights) ||
+      !ReadVector(&is, file_size, &output_ends) ||
+      !ReadVector(&is, file_size, &finals) ||
+      !ReadVector(&is, file_size, &arcs_) ||
+      !ReadVector(&is, file_size, &outputs_)) {
+    LOG(WARNING) << "Failed to read context graph from " << filename;
+    return false;
+  }
+  int num_states = arc_ends.size();
+  if (fail_states.size() != arc_ends.size() ||
+      fail_weights.size() != arc_ends.size() ||
+      output_ends.size() != arc_ends.size() ||
+      finals.size() != arc_ends.size()) {
+    LOG(WARNING) << "Malformed context graph " << filename;
+    return false;
+  }
+  states_.assign(num_states, ContextState());
+  for (int i = 0; i < num_states; i++) {
+    ContextState& context_state = states_[i];
+    context_state.arc_begin = i > 0 ? arc_ends[i - 1] : 0;
+    context_state.arc_end = arc_ends[i];
+    context_state.fail_state = fail_states[i];
+    context_state.fail_weight = fail_weights[i];
+    context_state.output_begin = i > 0 ? output_ends[i - 1] : 0;
+    context_state.output_end = output_ends[i];
+    context_state.is_final = finals[i] != 0;
   }
 
-  return 0;
+  int64_t num_contexts = 0;
+  is.read(reinterpret_cast<char*>(&num_contexts), sizeof(num_contexts));
+  if (!is.good() || num_contexts < 0 || num_contexts > file_size) {
+    LOG(WARNING) << "Failed to read context graph from " << filename;
+    return false;
+  }
+  contexts_.resize(num_contexts);
+  for (auto& context : contexts_) {
+    int64_t length = 0;
+    is.read(reinterpret_cast<char*>(&length), sizeof(length));
+    if (!is.good() || length < 0 || length > file_size) break;
+    context.resize(length);
+    is.read(&context[0], length);
+  }
+  if (!is.good() || !CheckTable()) {
+    LOG(WARNING) << "Malformed context graph " << filename;
+    return false;
+  }
+  BuildClosure();
+  return true;
 }
 
 }  // namespace wenet
@@ -15,26 +15,39 @@
 #ifndef DECODER_CONTEXT_GRAPH_H_
 #define DECODER_CONTEXT_GRAPH_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
-#include "fst/compose.h"
 #include "fst/fst.h"
-#include "fst/matcher.h"
-#include "fst/vector-fst.h"
+#include "fst/symbol-table.h"
 
 namespace wenet {
 
-using ArcIterator = fst::ArcIterator<fst::StdFst>;
-using Matcher = fst::SortedMatcher<fst::StdFst>;
-using Weight = fst::StdArc::Weight;
+// Character level trie of the units in the unit table, it is used to split
+// the contexts into units by greedy longest match, which visits each char
+// of the context only once per starting position, instead of looking up the
+// symbol table for every substring.
+class UnitTrie {
+ public:
+  explicit UnitTrie(const fst::SymbolTable& unit_table);
+  // Split the UTF-8 string into unit ids, return false if there is any oov
+  bool Split(const std::string& context, std::vector<int>* units) const;
+
+ private:
+  struct Node {
+    std::unordered_map<std::string, int> children;
+    int unit_id = -1;
+  };
+  int FindChild(int node, const std::string& ch) const;
 
-bool SplitContextToUnits(const std::string& context,
-                         const std::shared_ptr<fst::SymbolTable>& unit_table,
-                         std::vector<int>* units);
+  std::vector<Node> nodes_;
+  int space_id_ = -1;    // Id of kSpaceSymbol
+  int space_node_ = -1;  // Node reached by kSpaceSymbol
+};
 
 struct ContextConfig {
   int max_contexts = 5000;
@@ -43,25 +56,121 @@ struct ContextConfig {
   float incremental_context_score = 0.0;
 };
 
+// The sources a compiled context graph is built from, a saved graph which
+// doesn't match them is stale
+struct ContextGraphSource {
+  uint64_t context_hash = 0;  // ContextGraph::HashContexts() of the list
+  int64_t num_units = -1;     // Size of the unit table
+};
+
+struct ContextArc {
+  int ilabel;
+  int nextstate;
+  float weight;
+};
+
+struct ContextState {
+  int arc_begin = 0;
+  int arc_end = 0;
+  int fail_state = -1;  // -1 means no fallback arc
+  float fail_weight = 0;
+  int output_begin = 0;
+  int output_end = 0;
+  // Failure-closed arcs, see ContextGraph::BuildClosure()
+  int closed_begin = 0;
+  int closed_end = 0;
+  // Total weight of the fallback arcs to the end of the fallback chain, and
+  // whether the chain ends at the start state
+  float backoff_weight = 0;
+  bool backoff_to_start = false;
+  bool is_final = false;
+  // Leaves go back to the start state
+  bool is_leaf() const { return arc_begin == arc_end && fail_state < 0; }
+};
+
 class ContextGraph {
  public:
-  explicit ContextGraph(ContextConfig config);
-  int TraceContext(int cur_state, int unit_id, int* final_state);
+  // @param base: if not nullptr, the graph is layered over it, e.g. a small
+  //        graph of the per request contexts over the shared graph of the
+  //        global ones, so the latter is not compiled again for each request.
+  //        The state is the pair of the states of both graphs, and the scores
+  //        of both are added.
+  explicit ContextGraph(ContextConfig config,
+                        std::shared_ptr<const ContextGraph> base = nullptr);
   void BuildContextGraph(const std::vector<std::string>& context,
                          const std::shared_ptr<fst::SymbolTable>& unit_table);
-  void ConvertToAC();
+  // The unit trie is kept by the graph, see SplitContextToUnits()
+  void BuildContextGraph(const std::vector<std::string>& context,
+                         std::shared_ptr<const UnitTrie> unit_trie);
+  // Split the context into units by the unit trie the graph is built with,
+  // return false if there is any oov
+  bool SplitContextToUnits(const std::string& context,
+                           std::vector<int>* units) const;
+  // Hash of the context list, it's saved with the graph to detect the stale
+  // ones, see ContextGraphSource
+  static uint64_t HashContexts(const std::vector<std::string>& contexts);
+  // Save/Load the compiled AC automaton, so that large catalogs are compiled
+  // only once offline. The scores and `source` are saved with it, and Read
+  // fails if they don't match the config and `source` (the unknown, 0 or -1,
+  // fields of `source` are not checked), or if the table is malformed.
+  bool Write(const std::string& filename,
+             const ContextGraphSource& source = ContextGraphSource()) const;
+  bool Read(const std::string& filename,
+            const ContextGraphSource& source = ContextGraphSource());
+  // unit_id == fst::kNoLabel means backoff to the fallback state
   int GetNextState(int cur_state, int unit_id, float* score,
-                   std::unordered_set<std::string>* contexts = nullptr);
+                   std::unordered_set<std::string>* contexts = nullptr) const;
   // check context state is the final state
-  bool IsFinalState(int state) {
-    return graph_->Final(state) != Weight::Zero();
-  }
+  bool IsFinalState(int state) const;
+  // The contexts of the graph itself, not including the ones of the base
+  const std::vector<std::string>& contexts() const { return contexts_; }
+  int num_states() const { return states_.size(); }
 
  private:
+  // GetNextState() of the graph itself
+  int NextState(int cur_state, int unit_id, float* score,
+                std::unordered_set<std::string>* contexts) const;
+  // Build the trie of the contexts and the AC failure links directly on the
+  // flat table below, `finals` maps the states to the context ids (-1 for the
+  // non-final ones)
+  void BuildTrie(const std::vector<std::vector<int>>& context_units,
+                 std::vector<int>* finals);
+  void BuildFailLinks(const std::vector<int>& finals);
+  // Merge the arcs of the fallback chain of each state into its closed arcs,
+  // the ones of the state itself win, and the fallback weights are added
+  void BuildClosure();
+  // Check the indexes of the table read from a file
+  bool CheckTable() const;
+  // Arcs of the state itself, used during construction
+  const ContextArc* FindArc(int state, int unit_id) const;
+  // Failure-closed arcs of the state, used by the lookups
+  const ContextArc* FindClosedArc(int state, int unit_id) const;
+  void CollectContexts(int state,
+                       std::unordered_set<std::string>* contexts) const;
+
   ContextConfig config_;
-  std::unique_ptr<fst::StdVectorFst> graph_;
-  std::unordered_map<int, int> fallback_finals_;  // States fallback to final
-  std::unordered_map<int, std::string> context_table_;  // Finals to context
+  std::shared_ptr<const ContextGraph> base_;
+  // nullptr if the graph is read from a file
+  std::shared_ptr<const UnitTrie> unit_trie_;
+
+  // Flat AC automaton of the contexts, arcs of all states are stored
+  // contiguously (sorted by ilabel within each state) in CSR format, and the
+  // contexts matched when entering a state (including the ones reached by
+  // following the fallback finals) are precomputed as well. Lookups on it
+  // require no matcher construction, no hashing and no allocation.
+  // The transitions are closed over the fallback arcs, so a lookup never
+  // walks the fallback chain: it reads the dense table of the start state,
+  // or binary searches the closed arcs of the other states (log of their
+  // out degree, which is small in a trie) and then reads the dense table at
+  // most once.
+  std::vector<ContextState> states_;
+  std::vector<ContextArc> arcs_;
+  std::vector<ContextArc> closed_arcs_;
+  // Dense goto table of the start state, which is the most visited one,
+  // indexed by unit id, -1 means no arc
+  std::vector<int> start_arcs_;
+  std::vector<int> outputs_;  // Indexes to contexts_
+  std::vector<std::string> contexts_;
 };
 
 }  // namespace wenet
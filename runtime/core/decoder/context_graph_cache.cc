@@ -0,0 +1,132 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/context_graph_cache.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "utils/log.h"
+#include "utils/string.h"
+
+namespace wenet {
+
+ContextGraphCache::ContextGraphCache(
+    const ContextConfig& config, std::shared_ptr<fst::SymbolTable> unit_table,
+    int capacity, std::shared_ptr<ContextGraph> global_graph)
+    : config_(config),
+      unit_table_(std::move(unit_table)),
+      capacity_(capacity),
+      global_graph_(std::move(global_graph)) {
+  CHECK(unit_table_ != nullptr);
+  CHECK_GT(capacity_, 0);
+  unit_trie_ = std::make_shared<UnitTrie>(*unit_table_);
+  if (global_graph_ != nullptr) {
+    global_contexts_ = Normalize(global_graph_->contexts());
+  }
+}
+
+std::vector<std::string> ContextGraphCache::Normalize(
+    const std::vector<std::string>& contexts) const {
+  std::vector<std::string> normalized;
+  normalized.reserve(contexts.size());
+  for (const auto& context : contexts) {
+    std::string trimmed = Trim(context);
+    if (!trimmed.empty() && !std::binary_search(global_contexts_.begin(),
+                                                global_contexts_.end(),
+                                                trimmed)) {
+      normalized.emplace_back(std::move(trimmed));
+    }
+  }
+  std::sort(normalized.begin(), normalized.end());
+  normalized.erase(std::unique(normalized.begin(), normalized.end()),
+                   normalized.end());
+  return normalized;
+}
+
+std::shared_ptr<ContextGraph> ContextGraphCache::Compile(
+    const std::vector<std::string>& contexts) const {
+  auto context_graph = std::make_shared<ContextGraph>(config_, global_graph_);
+  context_graph->BuildContextGraph(contexts, unit_trie_);
+  if (global_graph_ == nullptr ||
+      static_cast<int64_t>(global_graph_->num_states()) *
+              context_graph->num_states() <=
+          std::numeric_limits<int>::max()) {
+    return context_graph;
+  }
+  // The layered states don't fit in int, compile the union instead
+  LOG(WARNING) << "Too many states to layer the context graph, compile it "
+               << "with the " << global_contexts_.size() << " global contexts";
+  std::vector<std::string> all_contexts(contexts);
+  all_contexts.insert(all_contexts.end(), global_contexts_.begin(),
+                      global_contexts_.end());
+  context_graph = std::make_shared<ContextGraph>(config_);
+  context_graph->BuildContextGraph(all_contexts, unit_trie_);
+  return context_graph;
+}
+
+std::shared_ptr<ContextGraph> ContextGraphCache::GetContextGraph(
+    const std::vector<std::string>& contexts) {
+  std::vector<std::string> normalized = Normalize(contexts);
+  // Nothing beyond the global contexts
+  if (normalized.empty()) return global_graph_;
+  std::string key = JoinString("\n", normalized);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = table_.find(key);
+    if (it != table_.end()) {
+      hits_++;
+      entries_.splice(entries_.begin(), entries_, it->second);
+      return it->second->second;
+    }
+    misses_++;
+  }
+
+  // Compile without holding the lock, so other sessions are not blocked
+  auto context_graph = Compile(normalized);
+  VLOG(1) << "Compiled context graph of " << normalized.size() << " contexts";
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = table_.find(key);
+  if (it != table_.end()) {
+    // Compiled by another session in the meantime
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+  }
+  entries_.emplace_front(key, context_graph);
+  table_[key] = entries_.begin();
+  while (entries_.size() > capacity_) {
+    table_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+  return context_graph;
+}
+
+int ContextGraphCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+int ContextGraphCache::hits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hits_;
+}
+
+int ContextGraphCache::misses() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return misses_;
+}
+
+}  // namespace wenet
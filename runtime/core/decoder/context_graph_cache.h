@@ -0,0 +1,87 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_CONTEXT_GRAPH_CACHE_H_
+#define DECODER_CONTEXT_GRAPH_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "fst/symbol-table.h"
+
+#include "decoder/context_graph.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// ContextGraphCache compiles the per request context (hotword) lists to
+// context graphs, and keeps the most recently used ones in a LRU cache keyed
+// by the normalized context list, so the clients sending the same hotwords
+// (contact names, product SKUs...) again do not pay for the compilation.
+// It is thread safe and can be shared by all the decoding sessions.
+class ContextGraphCache {
+ public:
+  // @param global_graph: if not nullptr, the graph of the global contexts,
+  //        the per request graphs are layered over it, that is they match
+  //        both, see ContextGraph. Only the request contexts are compiled.
+  ContextGraphCache(const ContextConfig& config,
+                    std::shared_ptr<fst::SymbolTable> unit_table,
+                    int capacity = 100,
+                    std::shared_ptr<ContextGraph> global_graph = nullptr);
+
+  std::shared_ptr<ContextGraph> GetContextGraph(
+      const std::vector<std::string>& contexts);
+
+  int size() const;
+  int hits() const;
+  int misses() const;
+
+ private:
+  // Trim, remove empty and duplicated items and the global contexts, and sort
+  std::vector<std::string> Normalize(
+      const std::vector<std::string>& contexts) const;
+  // Compile the normalized request contexts
+  std::shared_ptr<ContextGraph> Compile(
+      const std::vector<std::string>& contexts) const;
+
+  using Entry = std::pair<std::string, std::shared_ptr<ContextGraph>>;
+
+  ContextConfig config_;
+  std::shared_ptr<fst::SymbolTable> unit_table_;
+  // Built once and shared by all the compilations
+  std::shared_ptr<const UnitTrie> unit_trie_;
+  int capacity_;
+  std::shared_ptr<ContextGraph> global_graph_;
+  // Normalized once, they are removed from the request contexts
+  std::vector<std::string> global_contexts_;
+
+  mutable std::mutex mutex_;
+  // Most recently used at front
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> table_;
+  int hits_ = 0;
+  int misses_ = 0;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ContextGraphCache);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_CONTEXT_GRAPH_CACHE_H_
@@ -46,20 +46,34 @@ static bool RuleActivated(const CtcEndpointRule& rule,
   return ans;
 }
 
+void CtcEndpoint::AcceptBlank(float blank_logp) {
+  float blank_prob = expf(blank_logp);
+  num_frames_decoded_++;
+  if (blank_prob > config_.blank_threshold * config_.blank_scale) {
+    num_frames_trailing_blank_++;
+  } else {
+    num_frames_trailing_blank_ = 0;
+  }
+}
+
 bool CtcEndpoint::IsEndpoint(
     const std::vector<std::vector<float>>& ctc_log_probs,
     bool decoded_something) {
   for (int t = 0; t < ctc_log_probs.size(); ++t) {
-    const auto& logp_t = ctc_log_probs[t];
-    float blank_prob = expf(logp_t[config_.blank]);
+    AcceptBlank(ctc_log_probs[t][config_.blank]);
+  }
+  return RulesActivated(decoded_something);
+}
 
-    num_frames_decoded_++;
-    if (blank_prob > config_.blank_threshold * config_.blank_scale) {
-      num_frames_trailing_blank_++;
-    } else {
-      num_frames_trailing_blank_ = 0;
-    }
+bool CtcEndpoint::IsEndpoint(const std::vector<SparseCtcFrame>& ctc_log_probs,
+                             bool decoded_something) {
+  for (const SparseCtcFrame& frame : ctc_log_probs) {
+    AcceptBlank(frame.blank_logp);
   }
+  return RulesActivated(decoded_something);
+}
+
+bool CtcEndpoint::RulesActivated(bool decoded_something) {
   CHECK_GE(num_frames_decoded_, num_frames_trailing_blank_);
   CHECK_GT(frame_shift_in_ms_, 0);
   int utterance_length = num_frames_decoded_ * frame_shift_in_ms_;
@@ -17,6 +17,8 @@
 
 #include <vector>
 
+#include "decoder/ctc_posterior.h"
+
 namespace wenet {
 
 struct CtcEndpointRule {
@@ -62,12 +64,18 @@ class CtcEndpoint {
   /// should terminate decoding.
   bool IsEndpoint(const std::vector<std::vector<float>>& ctc_log_probs,
                   bool decoded_something);
+  /// Same as above, only the blank log probs of the sparse frames are used.
+  bool IsEndpoint(const std::vector<SparseCtcFrame>& ctc_log_probs,
+                  bool decoded_something);
 
   void frame_shift_in_ms(int frame_shift_in_ms) {
     frame_shift_in_ms_ = frame_shift_in_ms;
   }
 
  private:
+  void AcceptBlank(float blank_logp);
+  bool RulesActivated(bool decoded_something);
+
   CtcEndpointConfig config_;
   int frame_shift_in_ms_ = -1;
   int num_frames_decoded_ = 0;
@@ -0,0 +1,54 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_CTC_POSTERIOR_H_
+#define DECODER_CTC_POSTERIOR_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace wenet {
+
+// Sparse CTC posterior of one frame, which is the output of the models
+// exported with `export_onnx_cpu.py --ctc_topk k`. Only the log probs of the
+// top k units and the blank are kept, instead of all the units of vocabulary.
+struct SparseCtcFrame {
+  float blank_logp = 0;
+  std::vector<float> values;     // top k log probs, in descending order
+  std::vector<int32_t> indices;  // unit ids of values
+
+  // Log prob of the units not in the top k, the top k-th one is used, which
+  // is the upper bound of them.
+  float floor() const { return values.empty() ? blank_logp : values.back(); }
+};
+
+// Convert the sparse frame to the dense log probs of the first
+// max(top k units, blank) + 1 units, the others are floor().
+inline void SparseToDense(const SparseCtcFrame& frame, int blank,
+                          std::vector<float>* logp) {
+  int size = blank + 1;
+  for (int32_t index : frame.indices) {
+    size = std::max(size, index + 1);
+  }
+  logp->assign(size, frame.floor());
+  for (size_t i = 0; i < frame.indices.size(); ++i) {
+    (*logp)[frame.indices[i]] = frame.values[i];
+  }
+  (*logp)[blank] = frame.blank_logp;
+}
+
+}  // namespace wenet
+
+#endif  // DECODER_CTC_POSTERIOR_H_
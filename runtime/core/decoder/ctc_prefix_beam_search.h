@@ -87,9 +87,15 @@ class CtcPrefixBeamSearch : public SearchInterface {
       const std::shared_ptr<ContextGraph>& context_graph = nullptr);
 
   void Search(const std::vector<std::vector<float>>& logp) override;
+  // The top k of the sparse posterior is used as the first beam directly
+  void Search(const std::vector<SparseCtcFrame>& logp) override;
   void Reset() override;
   void FinalizeSearch() override;
   SearchType Type() const override { return SearchType::kPrefixBeamSearch; }
+  void set_context_graph(
+      const std::shared_ptr<ContextGraph>& context_graph) override {
+    context_graph_ = context_graph;
+  }
   void UpdateHypotheses(
       const std::vector<std::pair<std::vector<int>, PrefixScore>>& hpys);
 
@@ -106,6 +112,10 @@ class CtcPrefixBeamSearch : public SearchInterface {
   const std::vector<std::vector<int>>& Times() const override { return times_; }
 
  private:
+  // Search one frame with the first beam candidates
+  void SearchFrame(const std::vector<float>& topk_score,
+                   const std::vector<int32_t>& topk_index);
+
   int abs_time_step_ = 0;
 
   // N-best list and corresponding likelihood_, in sorted order
@@ -26,15 +26,20 @@ void DecodableTensorScaled::Reset() {
   logp_.clear();
 }
 
-void DecodableTensorScaled::AcceptLoglikes(const std::vector<float>& logp) {
+void DecodableTensorScaled::AcceptLoglikes(const std::vector<float>& logp,
+                                           float floor) {
   ++num_frames_ready_;
   // TODO(Binbin Zhang): Avoid copy here
   logp_ = logp;
+  floor_ = floor;
 }
 
 float DecodableTensorScaled::LogLikelihood(int32 frame, int32 index) {
   CHECK_GT(index, 0);
   CHECK_LT(frame, num_frames_ready_);
+  if (static_cast<size_t>(index) > logp_.size()) {
+    return scale_ * floor_;
+  }
   return scale_ * logp_[index - 1];
 }
 
@@ -58,6 +63,13 @@ CtcWfstBeamSearch::CtcWfstBeamSearch(
   Reset();
 }
 
+void CtcWfstBeamSearch::set_context_graph(
+    const std::shared_ptr<ContextGraph>& context_graph) {
+  context_graph_ = context_graph;
+  decoder_.set_context_graph(context_graph);
+  Reset();
+}
+
 void CtcWfstBeamSearch::Reset() {
   num_frames_ = 0;
   decoded_frames_mapping_.clear();
@@ -77,33 +89,54 @@ void CtcWfstBeamSearch::Search(const std::vector<std::vector<float>>& logp) {
   }
   // Every time we get the log posterior, we decode it all before return
   for (int i = 0; i < logp.size(); i++) {
-    float blank_score = std::exp(logp[i][opts_.blank]);
-    if (blank_score > opts_.blank_skip_thresh * opts_.blank_scale) {
-      VLOG(3) << "skipping frame " << num_frames_ << " score " << blank_score;
-      is_last_frame_blank_ = true;
-      last_frame_prob_ = logp[i];
-    } else {
-      // Get the best symbol
-      int cur_best =
-          std::max_element(logp[i].begin(), logp[i].end()) - logp[i].begin();
-      // Optional, adding one blank frame if we has skipped it in two same
-      // symbols
-      if (cur_best != opts_.blank && is_last_frame_blank_ &&
-          cur_best == last_best_) {
-        decodable_.AcceptLoglikes(last_frame_prob_);
-        decoder_.AdvanceDecoding(&decodable_, 1);
-        decoded_frames_mapping_.push_back(num_frames_ - 1);
-        VLOG(2) << "Adding blank frame at symbol " << cur_best;
-      }
-      last_best_ = cur_best;
-
-      decodable_.AcceptLoglikes(logp[i]);
+    SearchFrame(logp[i]);
+  }
+  UpdateBestPath();
+}
+
+void CtcWfstBeamSearch::Search(const std::vector<SparseCtcFrame>& logp) {
+  if (0 == logp.size()) {
+    return;
+  }
+  std::vector<float> dense_logp;
+  for (const SparseCtcFrame& frame : logp) {
+    SparseToDense(frame, opts_.blank, &dense_logp);
+    SearchFrame(dense_logp, frame.floor());
+  }
+  UpdateBestPath();
+}
+
+void CtcWfstBeamSearch::SearchFrame(const std::vector<float>& logp,
+                                    float floor) {
+  float blank_score = std::exp(logp[opts_.blank]);
+  if (blank_score > opts_.blank_skip_thresh * opts_.blank_scale) {
+    VLOG(3) << "skipping frame " << num_frames_ << " score " << blank_score;
+    is_last_frame_blank_ = true;
+    last_frame_prob_ = logp;
+    last_frame_floor_ = floor;
+  } else {
+    // Get the best symbol
+    int cur_best = std::max_element(logp.begin(), logp.end()) - logp.begin();
+    // Optional, adding one blank frame if we has skipped it in two same
+    // symbols
+    if (cur_best != opts_.blank && is_last_frame_blank_ &&
+        cur_best == last_best_) {
+      decodable_.AcceptLoglikes(last_frame_prob_, last_frame_floor_);
       decoder_.AdvanceDecoding(&decodable_, 1);
-      decoded_frames_mapping_.push_back(num_frames_);
-      is_last_frame_blank_ = false;
+      decoded_frames_mapping_.push_back(num_frames_ - 1);
+      VLOG(2) << "Adding blank frame at symbol " << cur_best;
     }
-    num_frames_++;
+    last_best_ = cur_best;
+
+    decodable_.AcceptLoglikes(logp, floor);
+    decoder_.AdvanceDecoding(&decodable_, 1);
+    decoded_frames_mapping_.push_back(num_frames_);
+    is_last_frame_blank_ = false;
   }
+  num_frames_++;
+}
+
+void CtcWfstBeamSearch::UpdateBestPath() {
   // Get the best path
   inputs_.clear();
   outputs_.clear();
@@ -137,14 +170,9 @@ void CtcWfstBeamSearch::FinalizeSearch() {
       decoder_.GetBestPath(&lat, true);
       nbest_lats.push_back(std::move(lat));
     } else {
-      // Get N-best path by lattice(CompactLattice)
-      kaldi::CompactLattice clat;
-      decoder_.GetLattice(&clat, true);
-      kaldi::Lattice lat, nbest_lat;
-      fst::ConvertLattice(clat, &lat);
-      // TODO(Binbin Zhang): it's n-best word lists here, not character n-best
-      fst::ShortestPath(lat, &nbest_lat, opts_.nbest);
-      fst::ConvertNbestToVector(nbest_lat, &nbest_lats);
+      // Get N-best path (character n-best) from the tokens directly, which is
+      // much faster than determinizing the lattice
+      decoder_.GetNBestPaths(opts_.nbest, opts_.blank + 1, &nbest_lats, true);
     }
     int nbest = nbest_lats.size();
     inputs_.resize(nbest);
@@ -34,7 +34,9 @@ class DecodableTensorScaled : public kaldi::DecodableInterface {
   bool IsLastFrame(int32 frame) const override;
   float LogLikelihood(int32 frame, int32 index) override;
   int32 NumIndices() const override;
-  void AcceptLoglikes(const std::vector<float>& logp);
+  // @param floor: log prob of the units beyond logp, it's used for the
+  //        sparse ctc posterior, see SparseToDense()
+  void AcceptLoglikes(const std::vector<float>& logp, float floor = 0);
   void SetFinish() { done_ = true; }
 
  private:
@@ -42,6 +44,7 @@ class DecodableTensorScaled : public kaldi::DecodableInterface {
   float scale_ = 1.0;
   bool done_ = false;
   std::vector<float> logp_;
+  float floor_ = 0;
 };
 
 // LatticeFasterDecoderConfig has the following key members
@@ -64,9 +67,14 @@ class CtcWfstBeamSearch : public SearchInterface {
       const fst::Fst<fst::StdArc>& fst, const CtcWfstBeamSearchOptions& opts,
       const std::shared_ptr<ContextGraph>& context_graph);
   void Search(const std::vector<std::vector<float>>& logp) override;
+  // The sparse frames are converted to dense ones with floor log probs
+  void Search(const std::vector<SparseCtcFrame>& logp) override;
   void Reset() override;
   void FinalizeSearch() override;
   SearchType Type() const override { return SearchType::kWfstBeamSearch; }
+  // The search is reset, as the decoder restarts with the new graph
+  void set_context_graph(
+      const std::shared_ptr<ContextGraph>& context_graph) override;
   // For CTC prefix beam search, both inputs and outputs are hypotheses_
   const std::vector<std::vector<int>>& Inputs() const override {
     return inputs_;
@@ -78,6 +86,8 @@ class CtcWfstBeamSearch : public SearchInterface {
   const std::vector<std::vector<int>>& Times() const override { return times_; }
 
  private:
+  void SearchFrame(const std::vector<float>& logp, float floor = 0);
+  void UpdateBestPath();
   // Sub one and remove <blank>
   void ConvertToInputs(const std::vector<int>& alignment,
                        std::vector<int>* input,
@@ -88,6 +98,7 @@ class CtcWfstBeamSearch : public SearchInterface {
 
   int last_best_ = 0;  // last none blank best id
   std::vector<float> last_frame_prob_;
+  float last_frame_floor_ = 0;
   bool is_last_frame_blank_ = false;
   std::vector<std::vector<int>> inputs_, outputs_;
   std::vector<float> likelihood_;
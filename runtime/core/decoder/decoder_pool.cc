@@ -0,0 +1,147 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/decoder_pool.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+DecoderPool::DecoderPool(std::shared_ptr<FeaturePipelineConfig> feature_config,
+                         std::shared_ptr<DecodeOptions> decode_config,
+                         int capacity)
+    : feature_config_(std::move(feature_config)),
+      decode_config_(std::move(decode_config)),
+      capacity_(capacity) {
+  CHECK_GT(capacity_, 0);
+}
+
+std::unique_ptr<DecoderSession> DecoderPool::NewSession(
+    const std::shared_ptr<DecodeResource>& resource) const {
+  std::unique_ptr<DecoderSession> session(new DecoderSession);
+  // The ones of the model profile first
+  session->feature_config = resource->feature_config != nullptr
+                                ? resource->feature_config
+                                : feature_config_;
+  session->decode_config = resource->decode_config != nullptr
+                               ? resource->decode_config
+                               : decode_config_;
+  session->feature_pipeline =
+      std::make_shared<FeaturePipeline>(*session->feature_config);
+  session->decoder = std::make_shared<AsrDecoder>(
+      session->feature_pipeline, resource, *session->decode_config);
+  session->resource = resource;
+  return session;
+}
+
+void DecoderPool::Prefill(const std::shared_ptr<DecodeResource>& resource,
+                          int num_sessions) {
+  for (int i = 0; i < num_sessions; ++i) {
+    PushIdle(NewSession(resource));
+  }
+  VLOG(1) << "Prefilled " << num_sessions << " decoding sessions";
+}
+
+std::shared_ptr<DecoderSession> DecoderPool::Acquire(
+    const std::shared_ptr<DecodeResource>& resource,
+    const std::vector<std::string>& contexts) {
+  std::unique_ptr<DecoderSession> session = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The most recently released one first, it's likely still in cache
+    for (auto it = idle_.rbegin(); it != idle_.rend(); ++it) {
+      if ((*it)->resource == resource) {
+        session = std::move(*it);
+        idle_.erase(std::next(it).base());
+        break;
+      }
+    }
+  }
+  if (session == nullptr) {
+    session = NewSession(resource);
+  }
+  session->decoder->set_context_graph(
+      GetSessionResource(resource, contexts)->context_graph);
+  std::shared_ptr<DecoderPool> pool = shared_from_this();
+  return std::shared_ptr<DecoderSession>(
+      session.release(), [pool](DecoderSession* s) { pool->Release(s); });
+}
+
+void DecoderPool::Release(DecoderSession* session) {
+  std::unique_ptr<DecoderSession> released(session);
+  // Reset here, so the next connection gets a ready session
+  released->decoder->Reset();
+  PushIdle(std::move(released));
+}
+
+void DecoderPool::PushIdle(std::unique_ptr<DecoderSession> session) {
+  std::unique_ptr<DecoderSession> dropped = nullptr;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (IsRetired(session->resource)) {
+    dropped = std::move(session);
+    return;
+  }
+  idle_.emplace_back(std::move(session));
+  if (static_cast<int>(idle_.size()) > capacity_) {
+    // Destroyed out of the lock
+    dropped = std::move(idle_.front());
+    idle_.pop_front();
+  }
+}
+
+void DecoderPool::Retire(const std::shared_ptr<DecodeResource>& resource) {
+  std::vector<std::unique_ptr<DecoderSession>> dropped;
+  std::lock_guard<std::mutex> lock(mutex_);
+  // The expired ones are removed first, their addresses may be reused
+  retired_.erase(std::remove_if(retired_.begin(), retired_.end(),
+                                [](const std::weak_ptr<DecodeResource>& r) {
+                                  return r.expired();
+                                }),
+                 retired_.end());
+  retired_.emplace_back(resource);
+  if (resource->worker_groups != nullptr) {
+    for (int i = 0; i < resource->worker_groups->num_groups(); ++i) {
+      retired_.emplace_back(resource->worker_groups->resource(i));
+    }
+  }
+  for (auto it = idle_.begin(); it != idle_.end();) {
+    if (IsRetired((*it)->resource)) {
+      // Destroyed out of the lock
+      dropped.emplace_back(std::move(*it));
+      it = idle_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  VLOG(1) << "Dropped " << dropped.size() << " idle sessions of the retired "
+          << "resource";
+}
+
+bool DecoderPool::IsRetired(
+    const std::shared_ptr<DecodeResource>& resource) const {
+  for (const auto& retired : retired_) {
+    if (retired.lock() == resource) return true;
+  }
+  return false;
+}
+
+int DecoderPool::num_idle() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return idle_.size();
+}
+
+}  // namespace wenet
@@ -0,0 +1,100 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_DECODER_POOL_H_
+#define DECODER_DECODER_POOL_H_
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "decoder/asr_decoder.h"
+#include "frontend/feature_pipeline.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// One decoding session, the feature pipeline and the decoder on it
+struct DecoderSession {
+  // The configs the session is built with, they outlive the pipeline and
+  // the decoder, which refer to them
+  std::shared_ptr<FeaturePipelineConfig> feature_config;
+  std::shared_ptr<DecodeOptions> decode_config;
+  std::shared_ptr<FeaturePipeline> feature_pipeline;
+  std::shared_ptr<AsrDecoder> decoder;
+  // The resource the decoder is built with, without the per session contexts
+  std::shared_ptr<DecodeResource> resource;
+};
+
+// DecoderPool keeps the idle decoding sessions of the servers, so a new
+// connection takes a built session instead of copying the model states and
+// building the searcher (the WFST decoder) on the critical path. The
+// sessions are reset when they are released, and the least recently
+// released ones are dropped beyond the capacity. It is thread safe, and
+// must be created by std::make_shared.
+class DecoderPool : public std::enable_shared_from_this<DecoderPool> {
+ public:
+  // The sessions are built with the configs of their resources if it has
+  // them (see DecodeResource::decode_config), or the ones given here.
+  // @param capacity: max number of the idle sessions kept
+  DecoderPool(std::shared_ptr<FeaturePipelineConfig> feature_config,
+              std::shared_ptr<DecodeOptions> decode_config, int capacity);
+
+  // Build num_sessions idle sessions of `resource` ahead, e.g. at startup
+  void Prefill(const std::shared_ptr<DecodeResource>& resource,
+               int num_sessions);
+  // Take an idle session of `resource`, or build one if there is none, with
+  // the context graph of `contexts` (see GetSessionResource()). The session
+  // goes back to the pool when the returned pointer is released, the caller
+  // must stop decoding on it (join the decoding thread) before that.
+  std::shared_ptr<DecoderSession> Acquire(
+      const std::shared_ptr<DecodeResource>& resource,
+      const std::vector<std::string>& contexts);
+
+  // Drop the idle sessions of `resource` and its numa replicas, and the
+  // ones released later, e.g. when it's swapped out by a reload, so the stale
+  // sessions never take the places of the current ones
+  void Retire(const std::shared_ptr<DecodeResource>& resource);
+
+  int num_idle() const;
+
+ private:
+  std::unique_ptr<DecoderSession> NewSession(
+      const std::shared_ptr<DecodeResource>& resource) const;
+  void Release(DecoderSession* session);
+  // Push the idle session, and drop the oldest one beyond the capacity, or
+  // the session itself if its resource is retired
+  void PushIdle(std::unique_ptr<DecoderSession> session);
+  bool IsRetired(const std::shared_ptr<DecodeResource>& resource) const;
+
+  std::shared_ptr<FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<DecodeOptions> decode_config_;
+  int capacity_;
+
+  mutable std::mutex mutex_;
+  // Least recently released at front
+  std::deque<std::unique_ptr<DecoderSession>> idle_;
+  // The retired resources which are still alive, they are kept alive by
+  // their live sessions only
+  std::vector<std::weak_ptr<DecodeResource>> retired_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(DecoderPool);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_DECODER_POOL_H_
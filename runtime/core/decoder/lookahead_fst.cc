@@ -0,0 +1,55 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/lookahead_fst.h"
+
+#include <stdexcept>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+const char kOLabelLookAheadFstType[] = "wenet_olabel_lookahead";
+
+std::shared_ptr<OLabelLookAheadFst> ConvertToLookAheadFst(
+    const fst::StdFst& tl) {
+  // Lookahead on output label requires TL to be sorted by output label
+  std::shared_ptr<OLabelLookAheadFst> lookahead_fst = nullptr;
+  if (tl.Properties(fst::kOLabelSorted, true) == fst::kOLabelSorted) {
+    lookahead_fst = std::make_shared<OLabelLookAheadFst>(tl);
+  } else {
+    fst::StdVectorFst sorted_tl(tl);
+    fst::ArcSort(&sorted_tl, fst::OLabelCompare<fst::StdArc>());
+    lookahead_fst = std::make_shared<OLabelLookAheadFst>(sorted_tl);
+  }
+  return lookahead_fst;
+}
+
+std::shared_ptr<fst::StdFst> ComposeLookAheadFst(
+    const OLabelLookAheadFst& tl, fst::StdVectorFst* g) {
+  CHECK(g != nullptr);
+  // Map the input labels of G to the relabeled output labels of TL
+  fst::LabelLookAheadRelabeler<fst::StdArc>::Relabel(g, tl, true);
+  fst::ArcSort(g, fst::ILabelCompare<fst::StdArc>());
+  // ComposeFst will choose the lookahead matcher and filter automatically
+  // since TL is an output label lookahead fst, see DefaultLookAhead in
+  // fst/lookahead-filter.h for details.
+  auto composed = std::make_shared<fst::ComposeFst<fst::StdArc>>(tl, *g);
+  if (composed->Properties(fst::kError, true)) {
+    throw std::runtime_error("Lookahead composition of TL and G failed.");
+  }
+  return composed;
+}
+
+}  // namespace wenet
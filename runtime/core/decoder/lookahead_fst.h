@@ -0,0 +1,52 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_LOOKAHEAD_FST_H_
+#define DECODER_LOOKAHEAD_FST_H_
+
+#include <memory>
+
+#include "fst/fstlib.h"
+#include "fst/matcher-fst.h"
+
+namespace wenet {
+
+// Same as fst::StdOLabelLookAheadFst, we define our own fst type name here so
+// that we do not depend on the lookahead extension library of openfst.
+extern const char kOLabelLookAheadFstType[];
+
+using OLabelLookAheadFst = fst::MatcherFst<
+    fst::ConstFst<fst::StdArc>,
+    fst::LabelLookAheadMatcher<fst::SortedMatcher<fst::ConstFst<fst::StdArc>>,
+                               fst::olabel_lookahead_flags,
+                               fst::FastLogAccumulator<fst::StdArc>>,
+    kOLabelLookAheadFstType, fst::LabelLookAheadRelabeler<fst::StdArc>>;
+
+// Convert the static TL graph to an output label lookahead fst. Please note
+// the output labels of TL are relabeled in the conversion, so TL can only be
+// used together with a G relabeled by `ComposeLookAheadFst`.
+std::shared_ptr<OLabelLookAheadFst> ConvertToLookAheadFst(
+    const fst::StdFst& tl);
+
+// Compose TL and G on the fly with label and weight pushing lookahead
+// composition, which is equal to the TLG graph but only the states visited
+// in decoding are expanded. The input labels of `g` are relabeled in place.
+// The result is NOT thread safe since it caches the expanded states, please
+// make a copy by `Copy(true)` for each decoding thread.
+std::shared_ptr<fst::StdFst> ComposeLookAheadFst(
+    const OLabelLookAheadFst& tl, fst::StdVectorFst* g);
+
+}  // namespace wenet
+
+#endif  // DECODER_LOOKAHEAD_FST_H_
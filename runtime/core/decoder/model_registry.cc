@@ -0,0 +1,250 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/model_registry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <exception>
+#include <fstream>
+#include <utility>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "utils/log.h"
+#include "utils/string.h"
+#include "utils/timer.h"
+
+namespace wenet {
+
+namespace {
+
+// Incremented by the signal handler, and polled by the watching thread
+volatile std::sig_atomic_t num_reload_signals = 0;
+
+#ifndef _WIN32
+void OnReloadSignal(int) { num_reload_signals = num_reload_signals + 1; }
+#endif
+
+// Resident memory of the process, 0 if it's unknown
+int64_t ResidentBytes() {
+#ifdef __linux__
+  std::ifstream statm("/proc/self/statm");
+  int64_t size = 0, resident = 0;
+  if (statm >> size >> resident) {
+    return resident * sysconf(_SC_PAGESIZE);
+  }
+#endif
+  return 0;
+}
+
+}  // namespace
+
+ModelRegistry::ModelRegistry(std::shared_ptr<ResourceManager> default_manager,
+                             Factory factory, int64_t memory_budget,
+                             ResourceManager::Retire retire,
+                             MemoryProbe memory_probe)
+    : default_manager_(std::move(default_manager)),
+      factory_(std::move(factory)),
+      memory_budget_(memory_budget),
+      retire_(std::move(retire)),
+      memory_probe_(std::move(memory_probe)) {
+  CHECK(default_manager_ != nullptr);
+  CHECK(factory_ != nullptr);
+  if (memory_probe_ == nullptr) {
+    memory_probe_ = ResidentBytes;
+  }
+}
+
+ModelRegistry::~ModelRegistry() {
+  stop_ = true;
+  if (signal_thread_.joinable()) signal_thread_.join();
+}
+
+bool ModelRegistry::ReadConfig(const std::string& config) {
+  std::ifstream is(config);
+  if (!is.good()) {
+    LOG(ERROR) << "Failed to open model registry config " << config;
+    return false;
+  }
+  std::string line;
+  while (getline(is, line)) {
+    line = Trim(line);
+    if (line.empty() || line[0] == '#') continue;
+    std::vector<std::string> strs;
+    SplitString(line, &strs);
+    if (strs.size() != 2) {
+      LOG(ERROR) << "Expect `<name> <flagfile>` in " << config << ": " << line;
+      return false;
+    }
+    AddProfile(strs[0], strs[1]);
+  }
+  return true;
+}
+
+void ModelRegistry::AddProfile(const std::string& name,
+                               const std::string& flagfile) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CHECK(profiles_.find(name) == profiles_.end())
+      << "Duplicated model profile " << name;
+  profiles_[name].flagfile = flagfile;
+  LOG(INFO) << "Registered model profile " << name << ": " << flagfile;
+}
+
+std::shared_ptr<DecodeResource> ModelRegistry::resource(const std::string& name,
+                                                        int group) {
+  std::shared_ptr<ResourceManager> manager = default_manager_;
+  if (!name.empty()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = profiles_.find(name);
+      if (it == profiles_.end()) return nullptr;
+      it->second.last_used = ++clock_;
+      manager = it->second.manager;
+    }
+    if (manager == nullptr) {
+      manager = Load(name);
+      if (manager == nullptr) return nullptr;
+    }
+  }
+  std::shared_ptr<DecodeResource> resource = manager->resource();
+  if (group >= 0 && resource->worker_groups != nullptr) {
+    resource = resource->worker_groups->resource(group);
+  }
+  return resource;
+}
+
+std::shared_ptr<ResourceManager> ModelRegistry::Load(const std::string& name) {
+  std::lock_guard<std::mutex> load_lock(load_mutex_);
+  std::string flagfile;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Profile& profile = profiles_[name];
+    // Loaded by another session in the meantime
+    if (profile.manager != nullptr) return profile.manager;
+    flagfile = profile.flagfile;
+  }
+
+  LOG(INFO) << "Loading model profile " << name << " from " << flagfile;
+  Timer timer;
+  int64_t resident = memory_probe_();
+  std::shared_ptr<ResourceManager> manager;
+  try {
+    manager = factory_(flagfile);
+  } catch (const std::exception& e) {
+    LOG(ERROR) << "Failed to load model profile " << name << ": " << e.what();
+    return nullptr;
+  }
+  if (manager == nullptr) {
+    LOG(ERROR) << "Failed to load model profile " << name;
+    return nullptr;
+  }
+  // A rough estimate, see Profile::bytes
+  int64_t bytes = std::max<int64_t>(memory_probe_() - resident, 0);
+  LOG(INFO) << "Loaded model profile " << name << " in " << timer.Elapsed()
+            << "ms, " << (bytes >> 20) << "MB";
+
+  std::vector<std::shared_ptr<ResourceManager>> evicted;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Profile& profile = profiles_[name];
+    profile.manager = manager;
+    profile.bytes = bytes;
+    profile.last_used = ++clock_;
+    evicted = Evict(name);
+  }
+  // Out of the lock, the sessions of the evicted profiles are not pooled
+  // any more
+  if (retire_ != nullptr) {
+    for (const auto& evicted_manager : evicted) {
+      retire_(evicted_manager->resource());
+    }
+  }
+  return manager;
+}
+
+std::vector<std::shared_ptr<ResourceManager>> ModelRegistry::Evict(
+    const std::string& keep) {
+  std::vector<std::shared_ptr<ResourceManager>> evicted;
+  if (memory_budget_ <= 0) return evicted;
+  while (true) {
+    int64_t total = 0;
+    auto lru = profiles_.end();
+    for (auto it = profiles_.begin(); it != profiles_.end(); ++it) {
+      if (it->second.manager == nullptr) continue;
+      total += it->second.bytes;
+      if (it->first != keep &&
+          (lru == profiles_.end() ||
+           it->second.last_used < lru->second.last_used)) {
+        lru = it;
+      }
+    }
+    if (total <= memory_budget_ || lru == profiles_.end()) break;
+    LOG(INFO) << "Evict model profile " << lru->first << " ("
+              << (lru->second.bytes >> 20) << "MB) beyond the memory budget";
+    // Its resource is kept alive by the live sessions until they are done
+    evicted.emplace_back(std::move(lru->second.manager));
+    lru->second.manager = nullptr;
+    lru->second.bytes = 0;
+  }
+  return evicted;
+}
+
+bool ModelRegistry::Reload() {
+  bool started = default_manager_->Reload();
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto& item : profiles_) {
+    if (item.second.manager != nullptr) {
+      started = item.second.manager->Reload() && started;
+    }
+  }
+  return started;
+}
+
+int ModelRegistry::num_loaded() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return std::count_if(profiles_.begin(), profiles_.end(),
+                       [](const std::pair<const std::string, Profile>& item) {
+                         return item.second.manager != nullptr;
+                       });
+}
+
+void ModelRegistry::ReloadOnSignal() {
+#ifdef _WIN32
+  LOG(WARNING) << "Reload on signal is not supported on Windows";
+#else
+  CHECK(!signal_thread_.joinable());
+  std::signal(SIGHUP, OnReloadSignal);
+  signal_thread_ = std::thread(&ModelRegistry::WatchSignal, this);
+  LOG(INFO) << "Send SIGHUP to reload the decode resources";
+#endif
+}
+
+void ModelRegistry::WatchSignal() {
+  // Only the async-signal-safe counter is touched in the signal handler, the
+  // reload is started here
+  std::sig_atomic_t num_signals = num_reload_signals;
+  while (!stop_) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (num_reload_signals != num_signals) {
+      num_signals = num_reload_signals;
+      Reload();
+    }
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,125 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_MODEL_REGISTRY_H_
+#define DECODER_MODEL_REGISTRY_H_
+
+#include <atomic>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "decoder/asr_decoder.h"
+#include "decoder/resource_manager.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// ModelRegistry routes the sessions of one server process to the model
+// profiles (model, fst, contexts and ITN) of a config file, each line of
+// which is `<name> <flagfile>`, and the flagfile overrides the flags of the
+// command line for the profile, the decoding options and the feature config
+// included (see DecodeResource::decode_config), e.g.
+//
+//   # name     flagfile
+//   meeting    conf/meeting.flags
+//   telephony  conf/telephony.flags
+//
+// The default resource (of the command line) is always loaded. A profile is
+// loaded on the first session selecting it, and the least recently used ones
+// are evicted when the loaded profiles exceed the memory budget, their idle
+// sessions are retired and their resources are freed after their live
+// sessions. The engine thread pools and the session pool are shared by all
+// of them.
+class ModelRegistry {
+ public:
+  // Creates the manager of the profile of `flagfile`, it throws or returns
+  // nullptr on failure
+  using Factory = std::function<std::shared_ptr<ResourceManager>(
+      const std::string& flagfile)>;
+  // Resident memory of the process in bytes
+  using MemoryProbe = std::function<int64_t()>;
+
+  // @param memory_budget: bytes of the loaded profiles, 0 means no limit
+  // @param retire: if set, it's run on the resources of the evicted profiles,
+  //        e.g. to drop their idle sessions from DecoderPool
+  // @param memory_probe: measures the memory taken by the loading of each
+  //        profile, it reads /proc/self/statm by default
+  ModelRegistry(std::shared_ptr<ResourceManager> default_manager,
+                Factory factory, int64_t memory_budget = 0,
+                ResourceManager::Retire retire = nullptr,
+                MemoryProbe memory_probe = nullptr);
+  ~ModelRegistry();
+
+  // Add the profiles of the config file, return false on failure
+  bool ReadConfig(const std::string& config);
+  void AddProfile(const std::string& name, const std::string& flagfile);
+
+  // The current resource of the profile `name` (the default one if it's
+  // empty), it's loaded if it's not yet. nullptr if the profile is unknown
+  // or fails to load. If `group` >= 0, the replica of the numa node group.
+  std::shared_ptr<DecodeResource> resource(const std::string& name = "",
+                                           int group = -1);
+  // Reload the default and the loaded profiles in the background, return
+  // false if any of them is reloading already
+  bool Reload();
+  // Reload at SIGHUP, it's not supported on Windows
+  void ReloadOnSignal();
+  int num_loaded() const;
+
+ private:
+  struct Profile {
+    std::string flagfile;
+    // nullptr if it's not loaded
+    std::shared_ptr<ResourceManager> manager;
+    // Growth of the resident memory of the process during the loading, it's
+    // a rough estimate of the memory of the profile, e.g. the allocations of
+    // the other sessions in the meantime are counted, and the shared and
+    // lazily touched pages are not
+    int64_t bytes = 0;
+    int64_t last_used = 0;
+  };
+
+  std::shared_ptr<ResourceManager> Load(const std::string& name);
+  // Drop the least recently used profiles but `keep` beyond the budget, the
+  // dropped managers are returned to be freed out of the lock
+  std::vector<std::shared_ptr<ResourceManager>> Evict(const std::string& keep);
+  void WatchSignal();
+
+  std::shared_ptr<ResourceManager> default_manager_;
+  Factory factory_;
+  int64_t memory_budget_;
+  ResourceManager::Retire retire_;
+  MemoryProbe memory_probe_;
+
+  mutable std::mutex mutex_;
+  std::map<std::string, Profile> profiles_;
+  int64_t clock_ = 0;
+  // One profile is loaded at a time
+  std::mutex load_mutex_;
+
+  std::atomic<bool> stop_{false};
+  std::thread signal_thread_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ModelRegistry);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_MODEL_REGISTRY_H_
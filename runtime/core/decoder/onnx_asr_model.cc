@@ -18,18 +18,315 @@
 #include "decoder/onnx_asr_model.h"
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 #include <utility>
 
+#ifdef _MSC_VER
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "utils/file.h"
 #include "utils/string.h"
+#include "utils/timer.h"
 
 namespace wenet {
 
-Ort::Env OnnxAsrModel::env_ = Ort::Env(ORT_LOGGING_LEVEL_WARNING, "");
+namespace {
+
+std::string HexString(uint64_t value) {
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx",
+           static_cast<unsigned long long>(value));  // NOLINT
+  return hex;
+}
+
+// The level of the saved optimized graphs, the layout optimizations of
+// ORT_ENABLE_ALL are done at each load
+int SavedOptimizationLevel(int graph_optimization_level) {
+  return std::min(graph_optimization_level,
+                  static_cast<int>(ORT_ENABLE_EXTENDED));
+}
+
+// Process wide free list of the fp32 cache buffers of the compact states, so
+// the fp32 caches are only held by the sessions running a chunk, and they are
+// not allocated again for each chunk
+class CacheBufferPool {
+ public:
+  static CacheBufferPool& Instance() {
+    static CacheBufferPool pool;
+    return pool;
+  }
+
+  void Acquire(std::vector<float>* buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!buffers_.empty()) {
+      buffer->swap(buffers_.back());
+      buffers_.pop_back();
+    }
+  }
+
+  void Release(std::vector<float>* buffer) {
+    std::vector<float> released;
+    released.swap(*buffer);
+    if (released.capacity() == 0) return;
+    // 4 buffers (2 caches, ping-pong) for each running chunk
+    static const size_t max_buffers =
+        4 * std::max(1u, std::thread::hardware_concurrency());
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (buffers_.size() < max_buffers) {
+      buffers_.emplace_back(std::move(released));
+    }
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::vector<float>> buffers_;
+};
+
+}  // namespace
+
+std::shared_ptr<Ort::Env> OnnxAsrModel::env_ = nullptr;
+bool OnnxAsrModel::global_thread_pools_ = false;
+int OnnxAsrModel::global_intra_op_threads_ = 0;
+int OnnxAsrModel::global_inter_op_threads_ = 0;
+bool OnnxAsrModel::global_allow_spinning_ = true;
 Ort::SessionOptions OnnxAsrModel::session_options_ = Ort::SessionOptions();
+int OnnxAsrModel::graph_optimization_level_ = ORT_ENABLE_ALL;
+std::string OnnxAsrModel::optimized_model_dir_ = "";  // NOLINT
+bool OnnxAsrModel::load_from_memory_ = false;
+
+Ort::Env& OnnxAsrModel::env() {
+  if (env_ == nullptr) {
+    env_ = std::make_shared<Ort::Env>(ORT_LOGGING_LEVEL_WARNING, "");
+  }
+  return *env_;
+}
 
-void OnnxAsrModel::InitEngineThreads(int num_threads) {
+void OnnxAsrModel::InitEngineThreads(int num_threads, int num_inter_op_threads,
+                                     bool allow_spinning) {
+  if (global_thread_pools_) {
+    throw std::runtime_error(
+        "The sessions share the global thread pools, restart to change the "
+        "engine threading");
+  }
   session_options_.SetIntraOpNumThreads(num_threads);
+  session_options_.SetInterOpNumThreads(num_inter_op_threads);
+  session_options_.AddConfigEntry("session.intra_op.allow_spinning",
+                                  allow_spinning ? "1" : "0");
+}
+
+void OnnxAsrModel::InitGlobalThreadPools(int num_intra_op_threads,
+                                         int num_inter_op_threads,
+                                         bool allow_spinning) {
+  // Initialized already, e.g. by the resource replica of another node or by
+  // the previous load of a reload
+  if (global_thread_pools_) {
+    if (num_intra_op_threads != global_intra_op_threads_ ||
+        num_inter_op_threads != global_inter_op_threads_ ||
+        allow_spinning != global_allow_spinning_) {
+      throw std::runtime_error(
+          "The global thread pools are of " +
+          std::to_string(global_intra_op_threads_) + " intra-op and " +
+          std::to_string(global_inter_op_threads_) +
+          " inter-op threads, restart to change them");
+    }
+    return;
+  }
+  if (env_ != nullptr) {
+    throw std::runtime_error(
+        "The global thread pools must be initialized before reading models, "
+        "restart to change the engine threading");
+  }
+  global_thread_pools_ = true;
+  global_intra_op_threads_ = num_intra_op_threads;
+  global_inter_op_threads_ = num_inter_op_threads;
+  global_allow_spinning_ = allow_spinning;
+  const OrtApi& api = Ort::GetApi();
+  OrtThreadingOptions* threading_options = nullptr;
+  Ort::ThrowOnError(api.CreateThreadingOptions(&threading_options));
+  Ort::ThrowOnError(
+      api.SetGlobalIntraOpNumThreads(threading_options, num_intra_op_threads));
+  Ort::ThrowOnError(
+      api.SetGlobalInterOpNumThreads(threading_options, num_inter_op_threads));
+  Ort::ThrowOnError(
+      api.SetGlobalSpinControl(threading_options, allow_spinning ? 1 : 0));
+  env_ = std::make_shared<Ort::Env>(threading_options,
+                                    ORT_LOGGING_LEVEL_WARNING, "");
+  api.ReleaseThreadingOptions(threading_options);
+  session_options_.DisablePerSessionThreads();
+  LOG(INFO) << "Onnx global thread pools: " << num_intra_op_threads
+            << " intra-op threads, " << num_inter_op_threads
+            << " inter-op threads";
+}
+
+void OnnxAsrModel::InitSessionOptions(int graph_optimization_level,
+                                      const std::string& optimized_model_dir,
+                                      bool load_from_memory) {
+  // It throws rather than aborts, the reloads keep the current model
+  if (graph_optimization_level != ORT_DISABLE_ALL &&
+      graph_optimization_level != ORT_ENABLE_BASIC &&
+      graph_optimization_level != ORT_ENABLE_EXTENDED &&
+      graph_optimization_level != ORT_ENABLE_ALL) {
+    throw std::invalid_argument("Invalid graph optimization level " +
+                                std::to_string(graph_optimization_level));
+  }
+  graph_optimization_level_ = graph_optimization_level;
+  session_options_.SetGraphOptimizationLevel(
+      static_cast<GraphOptimizationLevel>(graph_optimization_level));
+  optimized_model_dir_ = optimized_model_dir;
+  load_from_memory_ = load_from_memory;
+}
+
+std::string OnnxAsrModel::ModelContentHash(const std::string& onnx_path) {
+  // The hash is kept in a sidecar file of the cache, keyed by the canonical
+  // path of the model, with the stamp of the model it's computed for
+  std::string canonical_path = CanonicalPath(onnx_path);
+  std::string name = onnx_path.substr(onnx_path.find_last_of("/\\") + 1);
+  std::string sidecar_path = JoinPath(
+      optimized_model_dir_,
+      name + "." +
+          HexString(HashBytes(canonical_path.data(), canonical_path.size())) +
+          ".hash");
+  std::string stamp = FileStamp(onnx_path);
+  std::ifstream is(sidecar_path);
+  std::string saved_stamp, hash;
+  if (std::getline(is, saved_stamp) && std::getline(is, hash) &&
+      saved_stamp == stamp && !hash.empty()) {
+    return hash;
+  }
+  is.close();
+
+  MappedFile model;
+  if (!model.Open(onnx_path)) {
+    throw std::runtime_error("Failed to read " + onnx_path);
+  }
+  Timer timer;
+  hash = HexString(HashBytes(model.data(), model.size()));
+  LOG(INFO) << "Hash " << onnx_path << " takes " << timer.Elapsed() << "ms";
+  // Written to a temporary file first, so the other processes sharing the
+  // cache never see a partial one. It's only an optimization, the failures
+  // are ignored.
+#ifdef _MSC_VER
+  std::string tmp_path = sidecar_path + "." + std::to_string(_getpid());
+#else
+  std::string tmp_path = sidecar_path + "." + std::to_string(getpid());
+#endif
+  std::ofstream os(tmp_path);
+  os << stamp << "\n" << hash << "\n";
+  os.close();
+  if (!os.good() || std::rename(tmp_path.c_str(), sidecar_path.c_str()) != 0) {
+    LOG(WARNING) << "Failed to save the model hash " << sidecar_path;
+    std::remove(tmp_path.c_str());
+  }
+  return hash;
+}
+
+std::string OnnxAsrModel::OptimizedModelPath(const std::string& onnx_path) {
+  // The optimized graph depends on the content of the model, the version of
+  // onnxruntime and the options, any of them changes the key, so stale
+  // graphs are never loaded
+  std::stringstream options;
+  options << ModelContentHash(onnx_path) << " "
+          << OrtGetApiBase()->GetVersionString() << " "
+          << SavedOptimizationLevel(graph_optimization_level_);
+  std::string options_str = options.str();
+  std::string key =
+      HexString(HashBytes(options_str.data(), options_str.size()));
+  std::string name = onnx_path.substr(onnx_path.find_last_of("/\\") + 1);
+  name = name.substr(0, name.rfind(".onnx"));
+  return JoinPath(optimized_model_dir_, name + "." + key + ".onnx");
+}
+
+bool OnnxAsrModel::SaveOptimizedModel(const std::string& onnx_path,
+                                      const std::string& optimized_path) {
+  // The layout optimizations of ORT_ENABLE_ALL are specific to the cpu, the
+  // saved graph may not run on the other machines sharing the cache
+  Ort::SessionOptions options = session_options_.Clone();
+  options.SetGraphOptimizationLevel(static_cast<GraphOptimizationLevel>(
+      SavedOptimizationLevel(graph_optimization_level_)));
+  // Written to a temporary file first, so the other processes sharing the
+  // cache never see a partial one
+#ifdef _MSC_VER
+  std::string tmp_path = optimized_path + "." + std::to_string(_getpid());
+  options.SetOptimizedModelFilePath(ToWString(tmp_path).c_str());
+#else
+  std::string tmp_path = optimized_path + "." + std::to_string(getpid());
+  options.SetOptimizedModelFilePath(tmp_path.c_str());
+#endif
+  try {
+#ifdef _MSC_VER
+    Ort::Session session(env(), ToWString(onnx_path).c_str(), options);
+#else
+    Ort::Session session(env(), onnx_path.c_str(), options);
+#endif
+  } catch (std::exception const& e) {
+    LOG(WARNING) << "Failed to optimize " << onnx_path << ": " << e.what();
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  if (std::rename(tmp_path.c_str(), optimized_path.c_str()) != 0) {
+    LOG(WARNING) << "Failed to save the optimized model " << optimized_path;
+    std::remove(tmp_path.c_str());
+    return false;
+  }
+  LOG(INFO) << "Save the optimized model " << optimized_path;
+  return true;
+}
+
+std::shared_ptr<Ort::Session> OnnxAsrModel::CreateSession(
+    const std::string& onnx_path) {
+  Ort::SessionOptions options = session_options_.Clone();
+  std::string model_path = onnx_path;
+  if (!optimized_model_dir_.empty()) {
+    std::string optimized_path = OptimizedModelPath(onnx_path);
+    if (FileExists(optimized_path) ||
+        SaveOptimizedModel(onnx_path, optimized_path)) {
+      // It is optimized already, load it and skip the saved optimizations
+      LOG(INFO) << "Load the optimized model " << optimized_path;
+      model_path = optimized_path;
+      if (graph_optimization_level_ <= ORT_ENABLE_EXTENDED) {
+        options.SetGraphOptimizationLevel(ORT_DISABLE_ALL);
+      }
+    }
+  }
+  MappedFile model;
+  if (load_from_memory_) {
+    if (!model.Open(model_path)) {
+      throw std::runtime_error("Failed to read " + model_path);
+    }
+  }
+
+  std::shared_ptr<Ort::Session> session = nullptr;
+  try {
+    if (model.is_open()) {
+      // The model is parsed in the constructor, the buffer is not required
+      // by the session any more
+      session = std::make_shared<Ort::Session>(env(), model.data(),
+                                               model.size(), options);
+    } else {
+#ifdef _MSC_VER
+      session = std::make_shared<Ort::Session>(
+          env(), ToWString(model_path).c_str(), options);
+#else
+      session =
+          std::make_shared<Ort::Session>(env(), model_path.c_str(), options);
+#endif
+    }
+  } catch (std::exception const& e) {
+    LOG(ERROR) << "error when load onnx model: " << e.what();
+    // The reloads keep the current model on failure
+    throw;
+  }
+  return session;
 }
 
 void OnnxAsrModel::GetInputOutputInfo(
@@ -80,26 +377,8 @@ void OnnxAsrModel::Read(const std::string& model_dir) {
   std::string ctc_onnx_path = model_dir + "/ctc.onnx";
 
   // 1. Load sessions
-  try {
-#ifdef _MSC_VER
-    encoder_session_ = std::make_shared<Ort::Session>(
-        env_, ToWString(encoder_onnx_path).c_str(), session_options_);
-    rescore_session_ = std::make_shared<Ort::Session>(
-        env_, ToWString(rescore_onnx_path).c_str(), session_options_);
-    ctc_session_ = std::make_shared<Ort::Session>(
-        env_, ToWString(ctc_onnx_path).c_str(), session_options_);
-#else
-    encoder_session_ = std::make_shared<Ort::Session>(
-        env_, encoder_onnx_path.c_str(), session_options_);
-    rescore_session_ = std::make_shared<Ort::Session>(
-        env_, rescore_onnx_path.c_str(), session_options_);
-    ctc_session_ = std::make_shared<Ort::Session>(env_, ctc_onnx_path.c_str(),
-                                                  session_options_);
-#endif
-  } catch (std::exception const& e) {
-    LOG(ERROR) << "error when load onnx model: " << e.what();
-    exit(0);
-  }
+  encoder_session_ = CreateSession(encoder_onnx_path);
+  rescore_session_ = CreateSession(rescore_onnx_path);
 
   // 2. Read metadata
   auto model_metadata = encoder_session_->GetModelMetadata();
@@ -141,12 +420,91 @@ void OnnxAsrModel::Read(const std::string& model_dir) {
   // 3. Read model nodes
   LOG(INFO) << "Onnx Encoder:";
   GetInputOutputInfo(encoder_session_, &encoder_in_names_, &encoder_out_names_);
-  LOG(INFO) << "Onnx CTC:";
-  GetInputOutputInfo(ctc_session_, &ctc_in_names_, &ctc_out_names_);
+  // The encoder of the fused export (export_onnx_cpu.py --fuse_ctc) outputs
+  // the CTC posterior as well, and there is no separate CTC model.
+  for (size_t i = 0; i < encoder_out_names_.size(); ++i) {
+    const char* name = encoder_out_names_[i];
+    if (!strcmp(name, "ctc_log_probs") || !strcmp(name, "ctc_topk_values")) {
+      ctc_out_index_ = i;
+    } else if (!strcmp(name, "ctc_topk_indices")) {
+      ctc_topk_indices_index_ = i;
+    } else if (!strcmp(name, "ctc_blank_logp")) {
+      ctc_blank_index_ = i;
+    }
+  }
+  if (ctc_out_index_ >= 0) {
+    LOG(INFO) << "Onnx CTC: fused in the encoder";
+    sparse_ctc_ = ctc_topk_indices_index_ >= 0;
+    if (sparse_ctc_ && (ctc_blank_index_ < 0 ||
+                        strcmp(encoder_out_names_[ctc_out_index_],
+                               "ctc_topk_values"))) {
+      throw std::runtime_error(
+          "The sparse CTC of " + encoder_onnx_path +
+          " should output ctc_topk_values, ctc_topk_indices and "
+          "ctc_blank_logp.");
+    }
+    if (!sparse_ctc_) {
+      Ort::TypeInfo ctc_type_info =
+          encoder_session_->GetOutputTypeInfo(ctc_out_index_);
+      ctc_output_dim_ =
+          ctc_type_info.GetTensorTypeAndShapeInfo().GetShape()[2];
+    }
+  } else {
+    ctc_session_ = CreateSession(ctc_onnx_path);
+    LOG(INFO) << "Onnx CTC:";
+    GetInputOutputInfo(ctc_session_, &ctc_in_names_, &ctc_out_names_);
+    // The outputs of the sparse CTC are looked up by name, and kept in the
+    // order of ctc_topk_values, ctc_topk_indices and ctc_blank_logp, which
+    // is the order they are bound and returned in ForwardChunk()
+    std::vector<const char*> sparse_names;
+    for (const char* sparse_name :
+         {"ctc_topk_values", "ctc_topk_indices", "ctc_blank_logp"}) {
+      for (auto name : ctc_out_names_) {
+        if (!strcmp(name, sparse_name)) sparse_names.push_back(name);
+      }
+    }
+    if (!sparse_names.empty() && sparse_names.size() != 3) {
+      throw std::runtime_error(
+          "The sparse CTC of " + ctc_onnx_path +
+          " should output ctc_topk_values, ctc_topk_indices and "
+          "ctc_blank_logp.");
+    }
+    sparse_ctc_ = !sparse_names.empty();
+    if (sparse_ctc_) {
+      ctc_out_names_ = sparse_names;
+    } else {
+      // The vocabulary size is static, it is used to preallocate the output
+      Ort::TypeInfo ctc_type_info = ctc_session_->GetOutputTypeInfo(0);
+      ctc_output_dim_ =
+          ctc_type_info.GetTensorTypeAndShapeInfo().GetShape()[2];
+    }
+  }
+  if (sparse_ctc_) {
+    LOG(INFO) << "Onnx CTC: sparse top k posterior";
+  }
   LOG(INFO) << "Onnx Rescore:";
   GetInputOutputInfo(rescore_session_, &rescore_in_names_, &rescore_out_names_);
 }
 
+void OnnxAsrModel::InitBatchEncoder(const std::string& batch_encoder_path,
+                                    int max_batch_size, int max_wait_ms,
+                                    int chunk_size, int num_left_chunks) {
+  std::shared_ptr<Ort::Session> session = CreateSession(batch_encoder_path);
+  auto batch_encoder =
+      std::make_shared<OnnxBatchEncoder>(session, max_batch_size, max_wait_ms);
+  // It throws rather than aborts, the reloads keep the current model
+  if (batch_encoder->output_size() != encoder_output_size_ ||
+      batch_encoder->cache_size() != chunk_size * num_left_chunks) {
+    throw std::runtime_error(
+        "The output and cache size of " + batch_encoder_path +
+        " should match the encoder and chunk_size * num_left_chunks.");
+  }
+  batch_encoder_ = batch_encoder;
+  chunk_size_ = chunk_size;
+  num_left_chunks_ = num_left_chunks;
+  batch_encoder_->InitState(&batch_state_);
+}
+
 OnnxAsrModel::OnnxAsrModel(const OnnxAsrModel& other) {
   // metadatas
   encoder_output_size_ = other.encoder_output_size_;
@@ -160,12 +518,20 @@ OnnxAsrModel::OnnxAsrModel(const OnnxAsrModel& other) {
   is_bidirectional_decoder_ = other.is_bidirectional_decoder_;
   chunk_size_ = other.chunk_size_;
   num_left_chunks_ = other.num_left_chunks_;
+  max_att_cache_frames_ = other.max_att_cache_frames_;
+  state_storage_ = other.state_storage_;
   offset_ = other.offset_;
+  ctc_output_dim_ = other.ctc_output_dim_;
+  ctc_out_index_ = other.ctc_out_index_;
+  ctc_topk_indices_index_ = other.ctc_topk_indices_index_;
+  ctc_blank_index_ = other.ctc_blank_index_;
+  sparse_ctc_ = other.sparse_ctc_;
 
   // sessions
   encoder_session_ = other.encoder_session_;
   ctc_session_ = other.ctc_session_;
   rescore_session_ = other.rescore_session_;
+  batch_encoder_ = other.batch_encoder_;
 
   // node names
   encoder_in_names_ = other.encoder_in_names_;
@@ -185,127 +551,443 @@ std::shared_ptr<AsrModel> OnnxAsrModel::Copy() const {
 
 void OnnxAsrModel::Reset() {
   offset_ = 0;
-  encoder_outs_.clear();
+  encoder_out_.clear();
+  encoder_out_frames_ = 0;
+  last_frame_blank_ = false;
   cached_feature_.clear();
-  // Reset att_cache
-  Ort::MemoryInfo memory_info =
-      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+  if (encoder_binding_ == nullptr) {
+    encoder_binding_ = std::make_shared<Ort::IoBinding>(*encoder_session_);
+    if (ctc_session_ != nullptr) {
+      ctc_binding_ = std::make_shared<Ort::IoBinding>(*ctc_session_);
+    }
+  }
+  // Reset att_cache and cnn_cache
+  int required_cache_size = 0;
   if (num_left_chunks_ > 0) {
-    int required_cache_size = chunk_size_ * num_left_chunks_;
+    required_cache_size = chunk_size_ * num_left_chunks_;
     offset_ = required_cache_size;
-    att_cache_.resize(num_blocks_ * head_ * required_cache_size *
-                          encoder_output_size_ / head_ * 2,
-                      0.0);
-    const int64_t att_cache_shape[] = {num_blocks_, head_, required_cache_size,
-                                       encoder_output_size_ / head_ * 2};
-    att_cache_ort_ = Ort::Value::CreateTensor<float>(
-        memory_info, att_cache_.data(), att_cache_.size(), att_cache_shape, 4);
-  } else {
-    att_cache_.resize(0, 0.0);
-    const int64_t att_cache_shape[] = {num_blocks_, head_, 0,
-                                       encoder_output_size_ / head_ * 2};
-    att_cache_ort_ = Ort::Value::CreateTensor<float>(
-        memory_info, att_cache_.data(), att_cache_.size(), att_cache_shape, 4);
   }
-
-  // Reset cnn_cache
-  cnn_cache_.resize(
-      num_blocks_ * encoder_output_size_ * (cnn_module_kernel_ - 1), 0.0);
+  const int64_t att_cache_shape[] = {num_blocks_, head_, required_cache_size,
+                                     encoder_output_size_ / head_ * 2};
   const int64_t cnn_cache_shape[] = {num_blocks_, 1, encoder_output_size_,
                                      cnn_module_kernel_ - 1};
-  cnn_cache_ort_ = Ort::Value::CreateTensor<float>(
-      memory_info, cnn_cache_.data(), cnn_cache_.size(), cnn_cache_shape, 4);
+  const int att_cache_size = num_blocks_ * head_ * required_cache_size *
+                             encoder_output_size_ / head_ * 2;
+  const int cnn_cache_size =
+      num_blocks_ * encoder_output_size_ * (cnn_module_kernel_ - 1);
+  cache_index_ = 0;
+  encoder_out_compact_.set_type(state_storage_);
+  if (compact_states()) {
+    att_cache_shape_.assign(att_cache_shape, att_cache_shape + 4);
+    cnn_cache_shape_.assign(cnn_cache_shape, cnn_cache_shape + 4);
+    att_cache_compact_.set_type(state_storage_);
+    att_cache_compact_.AssignZeros(att_cache_size);
+    cnn_cache_compact_.set_type(state_storage_);
+    cnn_cache_compact_.AssignZeros(cnn_cache_size);
+    for (int i = 0; i < 2; ++i) {
+      att_cache_ort_[i] = Ort::Value{nullptr};
+      cnn_cache_ort_[i] = Ort::Value{nullptr};
+      std::vector<float>().swap(att_cache_[i]);
+      std::vector<float>().swap(cnn_cache_[i]);
+    }
+  } else {
+    for (int i = 0; i < 2; ++i) {
+      att_cache_[i].assign(att_cache_size, 0.0);
+      att_cache_ort_[i] = Ort::Value::CreateTensor<float>(
+          memory_info_, att_cache_[i].data(), att_cache_[i].size(),
+          att_cache_shape, 4);
+      cnn_cache_[i].assign(cnn_cache_size, 0.0);
+      cnn_cache_ort_[i] = Ort::Value::CreateTensor<float>(
+          memory_info_, cnn_cache_[i].data(), cnn_cache_[i].size(),
+          cnn_cache_shape, 4);
+    }
+  }
+
+  // The scalars are updated in place for each chunk
+  offset_ort_ = Ort::Value::CreateTensor<int64_t>(memory_info_, &offset_int64_,
+                                                  1, nullptr, 0);
+  required_cache_size_ort_ = Ort::Value::CreateTensor<int64_t>(
+      memory_info_, &required_cache_size_int64_, 1, nullptr, 0);
+
+  if (batch_encoder_ != nullptr) {
+    batch_encoder_->InitState(&batch_state_);
+    offset_ = batch_state_.offset;
+  }
 }
 
 void OnnxAsrModel::ForwardEncoderFunc(
     const std::vector<std::vector<float>>& chunk_feats,
     std::vector<std::vector<float>>* out_prob) {
-  Ort::MemoryInfo memory_info =
-      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+  ForwardChunk(chunk_feats, out_prob, nullptr);
+}
+
+void OnnxAsrModel::ForwardEncoderSparseFunc(
+    const std::vector<std::vector<float>>& chunk_feats,
+    std::vector<SparseCtcFrame>* out_prob) {
+  CHECK(sparse_ctc());
+  ForwardChunk(chunk_feats, nullptr, out_prob);
+}
+
+void OnnxAsrModel::ForwardChunk(
+    const std::vector<std::vector<float>>& chunk_feats,
+    std::vector<std::vector<float>>* out_prob,
+    std::vector<SparseCtcFrame>* sparse_prob) {
   // 1. Prepare onnx required data, splice cached_feature_ and chunk_feats
-  // chunk
+  // chunk, all the buffers are reused across chunks
   int num_frames = cached_feature_.size() + chunk_feats.size();
   const int feature_dim = chunk_feats[0].size();
-  std::vector<float> feats;
+  feats_.resize(num_frames * feature_dim);
+  float* feats_data = feats_.data();
   for (size_t i = 0; i < cached_feature_.size(); ++i) {
-    feats.insert(feats.end(), cached_feature_[i].begin(),
-                 cached_feature_[i].end());
+    std::copy(cached_feature_[i].begin(), cached_feature_[i].end(),
+              feats_data);
+    feats_data += feature_dim;
   }
   for (size_t i = 0; i < chunk_feats.size(); ++i) {
-    feats.insert(feats.end(), chunk_feats[i].begin(), chunk_feats[i].end());
-  }
-  const int64_t feats_shape[3] = {1, num_frames, feature_dim};
-  Ort::Value feats_ort = Ort::Value::CreateTensor<float>(
-      memory_info, feats.data(), feats.size(), feats_shape, 3);
-  // offset
-  int64_t offset_int64 = static_cast<int64_t>(offset_);
-  Ort::Value offset_ort = Ort::Value::CreateTensor<int64_t>(
-      memory_info, &offset_int64, 1, std::vector<int64_t>{}.data(), 0);
+    std::copy(chunk_feats[i].begin(), chunk_feats[i].end(), feats_data);
+    feats_data += feature_dim;
+  }
+  if (batch_encoder_ != nullptr) {
+    ForwardBatchEncoder(feats_, num_frames, out_prob);
+    return;
+  }
+  if (num_frames != feats_frames_) {
+    const int64_t feats_shape[3] = {1, num_frames, feature_dim};
+    feats_ort_ = Ort::Value::CreateTensor<float>(
+        memory_info_, feats_.data(), feats_.size(), feats_shape, 3);
+    feats_frames_ = num_frames;
+  }
+  // offset, it's bounded with the sliding window, see encoder_offset()
+  offset_int64_ = static_cast<int64_t>(encoder_offset());
   // required_cache_size
   int64_t required_cache_size = chunk_size_ * num_left_chunks_;
-  Ort::Value required_cache_size_ort = Ort::Value::CreateTensor<int64_t>(
-      memory_info, &required_cache_size, 1, std::vector<int64_t>{}.data(), 0);
+  required_cache_size_int64_ = required_cache_size;
   // att_mask
-  Ort::Value att_mask_ort{nullptr};
-  std::vector<uint8_t> att_mask(required_cache_size + chunk_size_, 1);
   if (num_left_chunks_ > 0) {
+    if (static_cast<int64_t>(att_mask_.size()) !=
+        required_cache_size + chunk_size_) {
+      att_mask_.resize(required_cache_size + chunk_size_);
+      const int64_t att_mask_shape[] = {1, 1,
+                                        required_cache_size + chunk_size_};
+      att_mask_ort_ = Ort::Value::CreateTensor<bool>(
+          memory_info_, reinterpret_cast<bool*>(att_mask_.data()),
+          att_mask_.size(), att_mask_shape, 3);
+    }
+    std::fill(att_mask_.begin(), att_mask_.end(), 1);
     int chunk_idx = offset_ / chunk_size_ - num_left_chunks_;
     if (chunk_idx < num_left_chunks_) {
       for (int i = 0; i < (num_left_chunks_ - chunk_idx) * chunk_size_; ++i) {
-        att_mask[i] = 0;
+        att_mask_[i] = 0;
       }
     }
-    const int64_t att_mask_shape[] = {1, 1, required_cache_size + chunk_size_};
-    att_mask_ort = Ort::Value::CreateTensor<bool>(
-        memory_info, reinterpret_cast<bool*>(att_mask.data()), att_mask.size(),
-        att_mask_shape, 3);
   }
 
-  // 2. Encoder chunk forward
-  std::vector<Ort::Value> inputs;
+  // 2. Encoder chunk forward, the caches are ping-pong buffers, the input is
+  // [cache_index_] and the output is written to [1 - cache_index_] in place
+  bool bind_att_cache = num_left_chunks_ > 0;
+  bool bind_cnn_cache = cnn_module_kernel_ > 1;
+  if (compact_states()) {
+    LoadCaches(bind_att_cache, bind_cnn_cache);
+  }
+  int next_cache_index = 1 - cache_index_;
+  encoder_binding_->ClearBoundInputs();
+  encoder_binding_->ClearBoundOutputs();
   for (auto name : encoder_in_names_) {
     if (!strcmp(name, "chunk")) {
-      inputs.emplace_back(std::move(feats_ort));
+      encoder_binding_->BindInput(name, feats_ort_);
     } else if (!strcmp(name, "offset")) {
-      inputs.emplace_back(std::move(offset_ort));
+      encoder_binding_->BindInput(name, offset_ort_);
     } else if (!strcmp(name, "required_cache_size")) {
-      inputs.emplace_back(std::move(required_cache_size_ort));
+      encoder_binding_->BindInput(name, required_cache_size_ort_);
     } else if (!strcmp(name, "att_cache")) {
-      inputs.emplace_back(std::move(att_cache_ort_));
+      encoder_binding_->BindInput(name, att_cache_ort_[cache_index_]);
     } else if (!strcmp(name, "cnn_cache")) {
-      inputs.emplace_back(std::move(cnn_cache_ort_));
+      encoder_binding_->BindInput(name, cnn_cache_ort_[cache_index_]);
     } else if (!strcmp(name, "att_mask")) {
-      inputs.emplace_back(std::move(att_mask_ort));
+      encoder_binding_->BindInput(name, att_mask_ort_);
     }
   }
+  // The encoder output and the dense CTC posterior are written to the
+  // buffers of the session in place, see BindChunkOutputs(). The encoder
+  // output is not fetched at all for the fused export if rescoring is
+  // disabled. att_cache grows with the chunks if num_left_chunks <= 0, and
+  // there is no cnn_cache for transformer, they are allocated by onnx in that
+  // case, as well as the sparse CTC outputs. The outputs are returned in the
+  // order they are bound.
+  bool fused_ctc = ctc_out_index_ >= 0;
+  bool bind_ctc_prob = !sparse_ctc_ && ctc_output_dim_ > 0;
+  int num_frames_out = num_output_frames(num_frames);
+  BindChunkOutputs(num_frames_out);
+  int num_bound = 0;
+  if (!fused_ctc || keep_encoder_out_) {
+    encoder_binding_->BindOutput(encoder_out_names_[0], chunk_encoder_out_ort_);
+    num_bound++;
+  }
+  if (bind_att_cache) {
+    encoder_binding_->BindOutput(encoder_out_names_[1],
+                                 att_cache_ort_[next_cache_index]);
+  } else {
+    encoder_binding_->BindOutput(encoder_out_names_[1], memory_info_);
+  }
+  int att_cache_pos = num_bound++;
+  if (bind_cnn_cache) {
+    encoder_binding_->BindOutput(encoder_out_names_[2],
+                                 cnn_cache_ort_[next_cache_index]);
+  } else {
+    encoder_binding_->BindOutput(encoder_out_names_[2], memory_info_);
+  }
+  int cnn_cache_pos = num_bound++;
+  // The CTC outputs of the fused export, see ctc_out_index_
+  std::vector<int> ctc_out_pos;
+  if (fused_ctc) {
+    for (int index : {ctc_out_index_, ctc_topk_indices_index_,
+                      ctc_blank_index_}) {
+      if (index < 0) continue;
+      if (index == ctc_out_index_ && bind_ctc_prob) {
+        encoder_binding_->BindOutput(encoder_out_names_[index], ctc_prob_ort_);
+      } else {
+        encoder_binding_->BindOutput(encoder_out_names_[index], memory_info_);
+      }
+      ctc_out_pos.push_back(num_bound++);
+    }
+  }
+  encoder_session_->Run(Ort::RunOptions{nullptr}, *encoder_binding_);
 
-  std::vector<Ort::Value> ort_outputs = encoder_session_->Run(
-      Ort::RunOptions{nullptr}, encoder_in_names_.data(), inputs.data(),
-      inputs.size(), encoder_out_names_.data(), encoder_out_names_.size());
+  std::vector<Ort::Value> ort_outputs = encoder_binding_->GetOutputValues();
+  if (!bind_att_cache) {
+    att_cache_ort_[next_cache_index] = std::move(ort_outputs[att_cache_pos]);
+    if (num_left_chunks_ < 0 && max_att_cache_frames_ > 0) {
+      SlideAttCache(next_cache_index);
+    }
+  }
+  if (!bind_cnn_cache) {
+    cnn_cache_ort_[next_cache_index] = std::move(ort_outputs[cnn_cache_pos]);
+  }
+  cache_index_ = next_cache_index;
+  if (compact_states()) {
+    StoreCaches();
+  }
+
+  // ctc_outs are the sparse top k values, indices and the blank log probs,
+  // or the dense log probs if they are not written to ctc_prob_
+  std::vector<Ort::Value> ctc_outs;
+  if (fused_ctc) {
+    // 3. The CTC outputs are the outputs of the fused export
+    for (int pos : ctc_out_pos) {
+      ctc_outs.emplace_back(std::move(ort_outputs[pos]));
+    }
+  } else {
+    // 3. CTC forward of the encoder output in place
+    ctc_binding_->ClearBoundInputs();
+    ctc_binding_->ClearBoundOutputs();
+    ctc_binding_->BindInput(ctc_in_names_[0], chunk_encoder_out_ort_);
+    if (bind_ctc_prob) {
+      ctc_binding_->BindOutput(ctc_out_names_[0], ctc_prob_ort_);
+    } else {
+      for (auto name : ctc_out_names_) {
+        ctc_binding_->BindOutput(name, memory_info_);
+      }
+    }
+    ctc_session_->Run(Ort::RunOptions{nullptr}, *ctc_binding_);
+    if (!bind_ctc_prob) {
+      ctc_outs = ctc_binding_->GetOutputValues();
+    }
+  }
+
+  // 4. Copy to output, blank_logp is used for the blank frame compression.
+  // The output is the one given by the caller, a dense caller of the sparse
+  // posterior (e.g. one not checking sparse_ctc()) gets it densified.
+  std::vector<float> blank_logp;
+  int num_outputs = 0;
+  if (sparse_ctc_) {
+    std::vector<int64_t> topk_shape =
+        ctc_outs[0].GetTensorTypeAndShapeInfo().GetShape();
+    num_outputs = topk_shape[1];
+    int k = topk_shape[2];
+    const float* values = ctc_outs[0].GetTensorData<float>();
+    const int32_t* indices = ctc_outs[1].GetTensorData<int32_t>();
+    const float* blank_data = ctc_outs[2].GetTensorData<float>();
+    std::vector<SparseCtcFrame> sparse_frames;
+    if (sparse_prob == nullptr) sparse_prob = &sparse_frames;
+    sparse_prob->resize(num_outputs);
+    for (int i = 0; i < num_outputs; i++) {
+      SparseCtcFrame& frame = (*sparse_prob)[i];
+      frame.blank_logp = blank_data[i];
+      frame.values.assign(values + i * k, values + (i + 1) * k);
+      frame.indices.assign(indices + i * k, indices + (i + 1) * k);
+    }
+    blank_logp.assign(blank_data, blank_data + num_outputs);
+    if (out_prob != nullptr) {
+      // The vocabulary ends with sos/eos
+      out_prob->resize(num_outputs);
+      for (int i = 0; i < num_outputs; i++) {
+        std::vector<float>& logp = (*out_prob)[i];
+        SparseToDense((*sparse_prob)[i], blank_, &logp);
+        if (static_cast<int>(logp.size()) <= eos_) {
+          logp.resize(eos_ + 1, (*sparse_prob)[i].floor());
+        }
+      }
+    }
+  } else if (sparse_prob == nullptr) {
+    // The dense log probs are read in place, and the rows are copied once to
+    // the caller, who owns them (e.g. they are moved to the pipelined search)
+    num_outputs = num_frames_out;
+    int output_dim = ctc_output_dim_;
+    const float* logp_data = ctc_prob_.data();
+    if (!bind_ctc_prob) {
+      logp_data = ctc_outs[0].GetTensorData<float>();
+      std::vector<int64_t> ctc_shape =
+          ctc_outs[0].GetTensorTypeAndShapeInfo().GetShape();
+      num_outputs = ctc_shape[1];
+      output_dim = ctc_shape[2];
+    }
+    out_prob->resize(num_outputs);
+    blank_logp.resize(num_outputs);
+    for (int i = 0; i < num_outputs; i++) {
+      const float* row = logp_data + i * output_dim;
+      (*out_prob)[i].assign(row, row + output_dim);
+      blank_logp[i] = row[blank_];
+    }
+  } else {
+    LOG(FATAL) << "The model does not output the sparse ctc posterior.";
+  }
+  offset_ += num_outputs;
+
+  if (keep_encoder_out_) {
+    // The chunk is already at the end of encoder_out_, see BindChunkOutputs()
+    CompressEncoderOut(blank_logp);
+  }
+}
+
+void OnnxAsrModel::BindChunkOutputs(int num_frames_out) {
+  const int64_t encoder_out_shape[] = {1, num_frames_out, encoder_output_size_};
+  const int encoder_out_size = num_frames_out * encoder_output_size_;
+  if (keep_encoder_out_) {
+    // Written to the tail of encoder_out_, which is read by the rescoring,
+    // the view is created again as the buffer may grow
+    size_t start = encoder_out_.size();
+    encoder_out_.resize(start + encoder_out_size);
+    chunk_encoder_out_ort_ = Ort::Value::CreateTensor<float>(
+        memory_info_, encoder_out_.data() + start, encoder_out_size,
+        encoder_out_shape, 3);
+    chunk_encoder_out_frames_ = 0;
+  } else if (num_frames_out != chunk_encoder_out_frames_) {
+    chunk_encoder_out_.resize(encoder_out_size);
+    chunk_encoder_out_ort_ = Ort::Value::CreateTensor<float>(
+        memory_info_, chunk_encoder_out_.data(), chunk_encoder_out_.size(),
+        encoder_out_shape, 3);
+    chunk_encoder_out_frames_ = num_frames_out;
+  }
+  if (!sparse_ctc_ && ctc_output_dim_ > 0 &&
+      num_frames_out != ctc_prob_frames_) {
+    const int64_t ctc_prob_shape[] = {1, num_frames_out, ctc_output_dim_};
+    ctc_prob_.resize(num_frames_out * ctc_output_dim_);
+    ctc_prob_ort_ = Ort::Value::CreateTensor<float>(
+        memory_info_, ctc_prob_.data(), ctc_prob_.size(), ctc_prob_shape, 3);
+    ctc_prob_frames_ = num_frames_out;
+  }
+}
 
-  offset_ += static_cast<int>(
-      ort_outputs[0].GetTensorTypeAndShapeInfo().GetShape()[1]);
-  att_cache_ort_ = std::move(ort_outputs[1]);
-  cnn_cache_ort_ = std::move(ort_outputs[2]);
+void OnnxAsrModel::SlideAttCache(int index) {
+  Ort::Value& att_cache = att_cache_ort_[index];
+  std::vector<int64_t> shape = att_cache.GetTensorTypeAndShapeInfo().GetShape();
+  const int64_t num_frames = shape[2];
+  if (num_frames <= max_att_cache_frames_) return;
+  // (num_blocks, head, num_frames, d_k * 2) -> the last max_att_cache_frames_
+  // frames of each (block, head) row, the buffer is of fixed size once the
+  // window is full
+  const int64_t num_rows = shape[0] * shape[1];
+  const int64_t row_size = max_att_cache_frames_ * shape[3];
+  const float* src = att_cache.GetTensorData<float>() +
+                     (num_frames - max_att_cache_frames_) * shape[3];
+  std::vector<float>& buffer = att_cache_[index];
+  buffer.resize(num_rows * row_size);
+  for (int64_t i = 0; i < num_rows; ++i) {
+    std::memcpy(buffer.data() + i * row_size, src + i * num_frames * shape[3],
+                sizeof(float) * row_size);
+  }
+  shape[2] = max_att_cache_frames_;
+  att_cache = Ort::Value::CreateTensor<float>(memory_info_, buffer.data(),
+                                              buffer.size(), shape.data(), 4);
+}
 
-  std::vector<Ort::Value> ctc_inputs;
-  ctc_inputs.emplace_back(std::move(ort_outputs[0]));
+void OnnxAsrModel::LoadCaches(bool bind_att_cache, bool bind_cnn_cache) {
+  CacheBufferPool& pool = CacheBufferPool::Instance();
+  for (int i = 0; i < 2; ++i) {
+    if (i == cache_index_ || bind_att_cache) {
+      pool.Acquire(&att_cache_[i]);
+      att_cache_[i].resize(att_cache_compact_.size());
+      att_cache_ort_[i] = Ort::Value::CreateTensor<float>(
+          memory_info_, att_cache_[i].data(), att_cache_[i].size(),
+          att_cache_shape_.data(), att_cache_shape_.size());
+    }
+    if (i == cache_index_ || bind_cnn_cache) {
+      pool.Acquire(&cnn_cache_[i]);
+      cnn_cache_[i].resize(cnn_cache_compact_.size());
+      cnn_cache_ort_[i] = Ort::Value::CreateTensor<float>(
+          memory_info_, cnn_cache_[i].data(), cnn_cache_[i].size(),
+          cnn_cache_shape_.data(), cnn_cache_shape_.size());
+    }
+  }
+  att_cache_compact_.CopyTo(att_cache_[cache_index_].data());
+  cnn_cache_compact_.CopyTo(cnn_cache_[cache_index_].data());
+}
 
-  std::vector<Ort::Value> ctc_ort_outputs = ctc_session_->Run(
-      Ort::RunOptions{nullptr}, ctc_in_names_.data(), ctc_inputs.data(),
-      ctc_inputs.size(), ctc_out_names_.data(), ctc_out_names_.size());
-  encoder_outs_.push_back(std::move(ctc_inputs[0]));
+void OnnxAsrModel::StoreCaches() {
+  // The caches may be allocated by onnx, see ForwardChunk()
+  auto att_info = att_cache_ort_[cache_index_].GetTensorTypeAndShapeInfo();
+  att_cache_shape_ = att_info.GetShape();
+  att_cache_compact_.Assign(att_cache_ort_[cache_index_].GetTensorData<float>(),
+                            att_info.GetElementCount());
+  auto cnn_info = cnn_cache_ort_[cache_index_].GetTensorTypeAndShapeInfo();
+  cnn_cache_shape_ = cnn_info.GetShape();
+  cnn_cache_compact_.Assign(cnn_cache_ort_[cache_index_].GetTensorData<float>(),
+                            cnn_info.GetElementCount());
+  CacheBufferPool& pool = CacheBufferPool::Instance();
+  for (int i = 0; i < 2; ++i) {
+    att_cache_ort_[i] = Ort::Value{nullptr};
+    cnn_cache_ort_[i] = Ort::Value{nullptr};
+    pool.Release(&att_cache_[i]);
+    pool.Release(&cnn_cache_[i]);
+  }
+}
 
-  float* logp_data = ctc_ort_outputs[0].GetTensorMutableData<float>();
-  auto type_info = ctc_ort_outputs[0].GetTensorTypeAndShapeInfo();
+void OnnxAsrModel::CompressEncoderOut(const std::vector<float>& blank_logp) {
+  std::vector<int> frames;
+  SelectRescoringFrames(blank_logp, &frames);
+  // Move the kept frames forward in place
+  int start_frame =
+      encoder_out_.size() / encoder_output_size_ - blank_logp.size();
+  float* chunk_data = encoder_out_.data() + start_frame * encoder_output_size_;
+  for (size_t i = 0; i < frames.size(); ++i) {
+    if (frames[i] == static_cast<int>(i)) continue;
+    std::copy(chunk_data + frames[i] * encoder_output_size_,
+              chunk_data + (frames[i] + 1) * encoder_output_size_,
+              chunk_data + i * encoder_output_size_);
+  }
+  encoder_out_.resize((start_frame + frames.size()) * encoder_output_size_);
+  encoder_out_frames_ += frames.size();
+  if (compact_states()) {
+    // Only the chunk is in encoder_out_, see AttentionRescoring()
+    encoder_out_compact_.Append(encoder_out_.data(), encoder_out_.size());
+    encoder_out_.clear();
+  }
+}
 
-  int num_outputs = type_info.GetShape()[1];
-  int output_dim = type_info.GetShape()[2];
-  out_prob->resize(num_outputs);
-  for (int i = 0; i < num_outputs; i++) {
-    (*out_prob)[i].resize(output_dim);
-    memcpy((*out_prob)[i].data(), logp_data + i * output_dim,
-           sizeof(float) * output_dim);
+void OnnxAsrModel::ForwardBatchEncoder(
+    const std::vector<float>& feats, int num_frames,
+    std::vector<std::vector<float>>* out_prob) {
+  // The encoder output is appended to encoder_out_ for rescoring
+  batch_encoder_->Forward(feats, num_frames, num_output_frames(num_frames),
+                          &batch_state_, out_prob,
+                          keep_encoder_out_ ? &encoder_out_ : nullptr);
+  offset_ = batch_state_.offset;
+  if (keep_encoder_out_) {
+    std::vector<float> blank_logp(out_prob->size());
+    for (size_t i = 0; i < out_prob->size(); ++i) {
+      blank_logp[i] = (*out_prob)[i][blank_];
+    }
+    CompressEncoderOut(blank_logp);
   }
 }
 
@@ -333,9 +1015,14 @@ void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
     return;
   }
   // No encoder output
-  if (encoder_outs_.size() == 0) {
+  if (encoder_out_frames_ == 0) {
     return;
   }
+  if (compact_states()) {
+    // Decompressed for the decoder, and released at the end
+    encoder_out_.resize(encoder_out_compact_.size());
+    encoder_out_compact_.CopyTo(encoder_out_.data());
+  }
 
   std::vector<int64_t> hyps_lens;
   int max_hyps_len = 0;
@@ -345,18 +1032,8 @@ void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
     hyps_lens.emplace_back(static_cast<int64_t>(length));
   }
 
-  std::vector<float> rescore_input;
-  int encoder_len = 0;
-  for (int i = 0; i < encoder_outs_.size(); i++) {
-    float* encoder_outs_data = encoder_outs_[i].GetTensorMutableData<float>();
-    auto type_info = encoder_outs_[i].GetTensorTypeAndShapeInfo();
-    for (int j = 0; j < type_info.GetElementCount(); j++) {
-      rescore_input.emplace_back(encoder_outs_data[j]);
-    }
-    encoder_len += type_info.GetShape()[1];
-  }
-
-  const int64_t decode_input_shape[] = {1, encoder_len, encoder_output_size_};
+  const int64_t decode_input_shape[] = {1, encoder_out_frames_,
+                                        encoder_output_size_};
 
   std::vector<int64_t> hyps_pad;
 
@@ -379,8 +1056,9 @@ void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
 
   const int64_t hyps_lens_shape[] = {num_hyps};
 
+  // A view of encoder_out_, no copy here
   Ort::Value decode_input_tensor_ = Ort::Value::CreateTensor<float>(
-      memory_info, rescore_input.data(), rescore_input.size(),
+      memory_info, encoder_out_.data(), encoder_out_.size(),
       decode_input_shape, 3);
   Ort::Value hyps_pad_tensor_ = Ort::Value::CreateTensor<int64_t>(
       memory_info, hyps_pad.data(), hyps_pad.size(), hyps_pad_shape, 2);
@@ -425,6 +1103,9 @@ void OnnxAsrModel::AttentionRescoring(const std::vector<std::vector<int>>& hyps,
     (*rescoring_score)[i] =
         score * (1 - reverse_weight) + r_score * reverse_weight;
   }
+  if (compact_states()) {
+    std::vector<float>().swap(encoder_out_);
+  }
 }
 
 }  // namespace wenet
@@ -25,6 +25,7 @@
 #include "onnxruntime_cxx_api.h"  // NOLINT
 
 #include "decoder/asr_model.h"
+#include "decoder/onnx_batch_encoder.h"
 #include "utils/log.h"
 #include "utils/utils.h"
 
@@ -32,13 +33,43 @@ namespace wenet {
 
 class OnnxAsrModel : public AsrModel {
  public:
-  static void InitEngineThreads(int num_threads = 1);
+  // Each session has its own intra-op pool of num_threads threads. It throws
+  // if the global thread pools are in use, which only a restart changes.
+  static void InitEngineThreads(int num_threads = 1,
+                                int num_inter_op_threads = 1,
+                                bool allow_spinning = true);
+  // All the sessions share the process wide intra/inter-op pools instead of
+  // having their own, so the number of threads does not grow with the
+  // sessions. It must be called before any model is read, and it throws if
+  // the pools exist with other options, e.g. at a reload, since they live
+  // as long as the process.
+  static void InitGlobalThreadPools(int num_intra_op_threads,
+                                    int num_inter_op_threads,
+                                    bool allow_spinning = true);
+  // @param graph_optimization_level: 0 (disable all), 1 (basic), 2 (extended)
+  //        or 99 (all), see GraphOptimizationLevel of onnxruntime
+  // @param optimized_model_dir: if not empty, the optimized graphs are saved
+  //        in it at the first load, and the later loads (restarts) skip the
+  //        optimization. They are keyed by the content hash of the model,
+  //        the version of onnxruntime and the options.
+  //        Up to the extended level is saved, the layout optimizations of
+  //        level 99, which depend on the cpu, are done at each load.
+  // @param load_from_memory: load the models from the mmapped files instead
+  //        of the paths
+  static void InitSessionOptions(int graph_optimization_level,
+                                 const std::string& optimized_model_dir,
+                                 bool load_from_memory);
 
  public:
   OnnxAsrModel() = default;
   OnnxAsrModel(const OnnxAsrModel& other);
   void Read(const std::string& model_dir);
   void Reset() override;
+  int num_rescoring_frames() const override { return encoder_out_frames_; }
+  // The batched encoder only outputs the dense posterior
+  bool sparse_ctc() const override {
+    return sparse_ctc_ && batch_encoder_ == nullptr;
+  }
   void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
                           float reverse_weight,
                           std::vector<float>* rescoring_score) override;
@@ -46,14 +77,68 @@ class OnnxAsrModel : public AsrModel {
   void GetInputOutputInfo(const std::shared_ptr<Ort::Session>& session,
                           std::vector<const char*>* in_names,
                           std::vector<const char*>* out_names);
+  // Run the encoder chunks of all the copies (sessions) of the model in batch
+  // by the batched encoder in `batch_encoder_path`, see OnnxBatchEncoder.
+  // Its cache size is fixed, the sessions decode with the chunk_size and
+  // num_left_chunks given here, and it throws if they don't match it.
+  void InitBatchEncoder(const std::string& batch_encoder_path,
+                        int max_batch_size, int max_wait_ms, int chunk_size,
+                        int num_left_chunks);
 
  protected:
   void ForwardEncoderFunc(const std::vector<std::vector<float>>& chunk_feats,
                           std::vector<std::vector<float>>* ctc_prob) override;
+  void ForwardEncoderSparseFunc(
+      const std::vector<std::vector<float>>& chunk_feats,
+      std::vector<SparseCtcFrame>* ctc_prob) override;
+  // Forward the chunk, the CTC posterior is written to the one of ctc_prob
+  // and sparse_prob which is not nullptr, the sparse outputs are densified
+  // for ctc_prob, see SparseToDense()
+  void ForwardChunk(const std::vector<std::vector<float>>& chunk_feats,
+                    std::vector<std::vector<float>>* ctc_prob,
+                    std::vector<SparseCtcFrame>* sparse_prob);
+
+  // Create the session of onnx_path by the options of InitSessionOptions()
+  static std::shared_ptr<Ort::Session> CreateSession(
+      const std::string& onnx_path);
+  // Content hash of the model, it's computed once and saved in the
+  // optimized_model_dir, and read back while the FileStamp() of the model
+  // is unchanged
+  static std::string ModelContentHash(const std::string& onnx_path);
+  static std::string OptimizedModelPath(const std::string& onnx_path);
+  // Save the graph of onnx_path optimized up to the extended level to
+  // optimized_path, return false on failure
+  static bool SaveOptimizedModel(const std::string& onnx_path,
+                                 const std::string& optimized_path);
 
   float ComputeAttentionScore(const float* prob, const std::vector<int>& hyp,
                               int eos, int decode_out_len);
 
+  // Keep the last max_att_cache_frames_ frames of att_cache_ort_[index] in
+  // att_cache_[index], see set_max_att_cache_frames()
+  void SlideAttCache(int index);
+  // Compress the blank frames of the chunk, which is the last
+  // blank_logp.size() frames of encoder_out_, by their blank log probs, see
+  // set_rescoring_blank_thresh()
+  void CompressEncoderOut(const std::vector<float>& blank_logp);
+  // The states are kept in the reduced precision storage between chunks,
+  // see set_state_storage(). The batched encoder keeps its own fp32 states.
+  bool compact_states() const {
+    return state_storage_ != StorageType::kFloat32 && batch_encoder_ == nullptr;
+  }
+  // Decompress the caches to the fp32 buffers before the chunk forward, the
+  // output buffers are prepared as well if the outputs are bound to them
+  void LoadCaches(bool bind_att_cache, bool bind_cnn_cache);
+  // Compress the caches of cache_index_ after the chunk forward, and release
+  // the fp32 buffers
+  void StoreCaches();
+  // Prepare the output buffers of the chunk of num_frames_out frames, the
+  // encoder output is appended to encoder_out_ if it's kept, the others are
+  // only reallocated when the number of frames changes, e.g. at the last chunk
+  void BindChunkOutputs(int num_frames_out);
+  void ForwardBatchEncoder(const std::vector<float>& feats, int num_frames,
+                           std::vector<std::vector<float>>* ctc_prob);
+
  private:
   int encoder_output_size_ = 0;
   int num_blocks_ = 0;
@@ -63,28 +148,94 @@ class OnnxAsrModel : public AsrModel {
   // sessions
   // NOTE(Mddct): The Env holds the logging state used by all other objects.
   //  One Env must be created before using any other Onnxruntime functionality.
-  static Ort::Env env_;  // shared environment across threads.
+  // shared environment across threads, it is created at the first use, or
+  // with the global thread pools by InitGlobalThreadPools()
+  static std::shared_ptr<Ort::Env> env_;
+  static Ort::Env& env();
+  static bool global_thread_pools_;
+  static int global_intra_op_threads_;
+  static int global_inter_op_threads_;
+  static bool global_allow_spinning_;
   static Ort::SessionOptions session_options_;
+  static int graph_optimization_level_;
+  static std::string optimized_model_dir_;
+  static bool load_from_memory_;
   std::shared_ptr<Ort::Session> encoder_session_ = nullptr;
   std::shared_ptr<Ort::Session> rescore_session_ = nullptr;
   std::shared_ptr<Ort::Session> ctc_session_ = nullptr;
+  // Shared by all the copies, nullptr means no batching
+  std::shared_ptr<OnnxBatchEncoder> batch_encoder_ = nullptr;
 
   // node names
   std::vector<const char*> encoder_in_names_, encoder_out_names_;
   std::vector<const char*> ctc_in_names_, ctc_out_names_;
   std::vector<const char*> rescore_in_names_, rescore_out_names_;
 
-  // caches
-  Ort::Value att_cache_ort_{nullptr};
-  Ort::Value cnn_cache_ort_{nullptr};
-  std::vector<Ort::Value> encoder_outs_;
+  // caches, they are ping-pong buffers bound to the encoder in place, the
+  // input of current chunk is [cache_index_] and the output is written to
+  // [1 - cache_index_].
+  Ort::Value att_cache_ort_[2] = {Ort::Value{nullptr}, Ort::Value{nullptr}};
+  Ort::Value cnn_cache_ort_[2] = {Ort::Value{nullptr}, Ort::Value{nullptr}};
+  int cache_index_ = 0;
+  // Encoder outputs of all the chunks, (encoder_out_frames_, output_size),
+  // written by the encoder to the end of one contiguous buffer as the chunks
+  // are produced, so it is fed to the rescoring decoder without copies. Its
+  // capacity is kept across Reset().
+  std::vector<float> encoder_out_;
+  int encoder_out_frames_ = 0;
   // NOTE: Instead of making a copy of the xx_cache, ONNX only maintains
   //  its data pointer when initializing xx_cache_ort (see https://github.com/
   //  microsoft/onnxruntime/blob/master/onnxruntime/core/framework
   //  /tensor.cc#L102-L129), so we need the following variables to keep
   //  our data "alive" during the lifetime of decoder.
-  std::vector<float> att_cache_;
-  std::vector<float> cnn_cache_;
+  std::vector<float> att_cache_[2];
+  std::vector<float> cnn_cache_[2];
+  // The caches and the encoder outputs between chunks in the reduced
+  // precision storage, see compact_states(). The fp32 buffers above are only
+  // held while a chunk is running then, and encoder_out_ while rescoring.
+  CompactBuffer att_cache_compact_;
+  CompactBuffer cnn_cache_compact_;
+  CompactBuffer encoder_out_compact_;
+  std::vector<int64_t> att_cache_shape_;
+  std::vector<int64_t> cnn_cache_shape_;
+
+  // IO binding and the input/output buffers reused across chunks, so that a
+  // steady state chunk does not allocate them again
+  Ort::MemoryInfo memory_info_ =
+      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+  std::shared_ptr<Ort::IoBinding> encoder_binding_ = nullptr;
+  std::shared_ptr<Ort::IoBinding> ctc_binding_ = nullptr;
+  std::vector<float> feats_;
+  int feats_frames_ = 0;
+  Ort::Value feats_ort_{nullptr};
+  int64_t offset_int64_ = 0;
+  Ort::Value offset_ort_{nullptr};
+  int64_t required_cache_size_int64_ = 0;
+  Ort::Value required_cache_size_ort_{nullptr};
+  std::vector<uint8_t> att_mask_;
+  Ort::Value att_mask_ort_{nullptr};
+  int64_t ctc_output_dim_ = 0;  // <= 0 means dynamic
+  // The CTC posterior is dense log probs, or the sparse top k (values,
+  // indices and the blank log probs) of export_onnx_cpu.py --ctc_topk
+  bool sparse_ctc_ = false;
+  // Indices of the CTC outputs in the encoder outputs of the fused export,
+  // ctc_log_probs (or ctc_topk_values if sparse), ctc_topk_indices and
+  // ctc_blank_logp, -1 if CTC is a separate model
+  int ctc_out_index_ = -1;
+  int ctc_topk_indices_index_ = -1;
+  int ctc_blank_index_ = -1;
+  // The encoder output and the dense CTC posterior of the chunk, they are
+  // bound as the outputs and read in place, see BindChunkOutputs(). The
+  // encoder output is written to the end of encoder_out_ if it's kept for
+  // rescoring, and to chunk_encoder_out_ otherwise.
+  Ort::Value chunk_encoder_out_ort_{nullptr};
+  int chunk_encoder_out_frames_ = 0;
+  std::vector<float> chunk_encoder_out_;
+  int ctc_prob_frames_ = 0;
+  std::vector<float> ctc_prob_;
+  Ort::Value ctc_prob_ort_{nullptr};
+  // Streaming states of the batched encoder
+  BatchEncoderState batch_state_;
 };
 
 }  // namespace wenet
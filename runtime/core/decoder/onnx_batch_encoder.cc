@@ -0,0 +1,284 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/onnx_batch_encoder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+namespace {
+
+int FindName(const std::vector<std::string>& names, const std::string& name) {
+  auto it = std::find(names.begin(), names.end(), name);
+  return it == names.end() ? -1 : it - names.begin();
+}
+
+}  // namespace
+
+OnnxBatchEncoder::OnnxBatchEncoder(std::shared_ptr<Ort::Session> session,
+                                   int max_batch_size, int max_wait_ms)
+    : session_(std::move(session)),
+      max_batch_size_(max_batch_size),
+      max_wait_ms_(max_wait_ms) {
+  CHECK(session_ != nullptr);
+  CHECK_GT(max_batch_size_, 0);
+  Ort::AllocatorWithDefaultOptions allocator;
+  for (int i = 0; i < session_->GetInputCount(); ++i) {
+    char* name = session_->GetInputName(i, allocator);
+    in_names_.emplace_back(name);
+    allocator.Free(name);
+    Ort::TypeInfo type_info = session_->GetInputTypeInfo(i);
+    auto tensor_info = type_info.GetTensorTypeAndShapeInfo();
+    std::vector<int64_t> shape = tensor_info.GetShape();
+    if (in_names_[i] == "chunk_xs") {
+      CHECK(tensor_info.GetElementType() == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT)
+          << "Only fp32 batched encoder is supported.";
+      decoding_window_ = shape[1];
+      feature_dim_ = shape[2];
+    } else if (in_names_[i] == "att_cache") {
+      num_blocks_ = shape[1];
+      head_ = shape[2];
+      cache_size_ = shape[3];
+      d_k2_ = shape[4];
+    } else if (in_names_[i] == "cnn_cache") {
+      cnn_cache_size_ = shape[3];
+    }
+  }
+  for (int i = 0; i < session_->GetOutputCount(); ++i) {
+    char* name = session_->GetOutputName(i, allocator);
+    out_names_.emplace_back(name);
+    allocator.Free(name);
+    if (out_names_[i] == "chunk_out") {
+      Ort::TypeInfo type_info = session_->GetOutputTypeInfo(i);
+      output_size_ = type_info.GetTensorTypeAndShapeInfo().GetShape()[2];
+    }
+  }
+  CHECK_GE(FindName(out_names_, "ctc_log_probs"), 0)
+      << "Please export the batched encoder with --return_ctc_logprobs.";
+  CHECK_GT(cache_size_, 0) << "Batched encoder requires num_left_chunks > 0.";
+  for (const auto& name : in_names_) in_name_ptrs_.push_back(name.c_str());
+  for (const auto& name : out_names_) out_name_ptrs_.push_back(name.c_str());
+  LOG(INFO) << "Batched encoder: decoding_window " << decoding_window_
+            << " cache_size " << cache_size_ << " max_batch_size "
+            << max_batch_size_ << " max_wait_ms " << max_wait_ms_;
+
+  worker_ = std::thread(&OnnxBatchEncoder::Run, this);
+}
+
+OnnxBatchEncoder::~OnnxBatchEncoder() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  request_cond_.notify_all();
+  worker_.join();
+}
+
+void OnnxBatchEncoder::InitState(BatchEncoderState* state) const {
+  // Same as the initial states of the triton deployment, the cache is all
+  // masked at the beginning
+  state->offset = 0;
+  state->att_cache.assign(num_blocks_ * head_ * cache_size_ * d_k2_, 0.0);
+  state->cnn_cache.assign(num_blocks_ * output_size_ * cnn_cache_size_, 0.0);
+  state->cache_mask.assign(cache_size_, 0.0);
+}
+
+void OnnxBatchEncoder::Forward(const std::vector<float>& feats,
+                               int num_frames, int num_outputs,
+                               BatchEncoderState* state,
+                               std::vector<std::vector<float>>* ctc_prob,
+                               std::vector<float>* encoder_out) {
+  CHECK_LE(num_frames, decoding_window_);
+  Request request{&feats, num_frames, num_outputs, state, ctc_prob,
+                  encoder_out};
+  std::unique_lock<std::mutex> lock(mutex_);
+  requests_.push_back(&request);
+  request_cond_.notify_one();
+  done_cond_.wait(lock, [&request] { return request.done; });
+  if (request.error != nullptr) {
+    std::rethrow_exception(request.error);
+  }
+}
+
+void OnnxBatchEncoder::Run() {
+  while (true) {
+    std::vector<Request*> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      request_cond_.wait(lock, [this] { return stop_ || !requests_.empty(); });
+      if (stop_ && requests_.empty()) return;
+      // Wait for the chunks of the other streams within the latency budget
+      auto deadline = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(max_wait_ms_);
+      request_cond_.wait_until(lock, deadline, [this] {
+        return stop_ || static_cast<int>(requests_.size()) >= max_batch_size_;
+      });
+      while (!requests_.empty() &&
+             static_cast<int>(batch.size()) < max_batch_size_) {
+        batch.push_back(requests_.front());
+        requests_.pop_front();
+      }
+    }
+    // The error (of onnxruntime) fails the streams of the batch, instead of
+    // terminating the worker and the server
+    std::exception_ptr error = nullptr;
+    try {
+      ForwardBatch(batch);
+    } catch (const std::exception& e) {
+      LOG(ERROR) << "Batched encoder of " << batch.size()
+                 << " chunks failed: " << e.what();
+      error = std::current_exception();
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (Request* request : batch) {
+        request->error = error;
+        request->done = true;
+      }
+    }
+    done_cond_.notify_all();
+  }
+}
+
+void OnnxBatchEncoder::ForwardBatch(const std::vector<Request*>& batch) {
+  Ort::MemoryInfo memory_info =
+      Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
+  const int64_t batch_size = batch.size();
+  const int chunk_stride = decoding_window_ * feature_dim_;
+  const int att_cache_stride = num_blocks_ * head_ * cache_size_ * d_k2_;
+  const int cnn_cache_stride = num_blocks_ * output_size_ * cnn_cache_size_;
+
+  // 1. Stack the chunks (padded to decoding_window) and the states
+  std::vector<float> chunk_xs(batch_size * chunk_stride, 0.0);
+  std::vector<int32_t> chunk_lens(batch_size);
+  std::vector<int64_t> offset(batch_size);
+  std::vector<float> att_cache(batch_size * att_cache_stride);
+  std::vector<float> cnn_cache(batch_size * cnn_cache_stride);
+  std::vector<float> cache_mask(batch_size * cache_size_);
+  for (int i = 0; i < batch_size; ++i) {
+    const Request* request = batch[i];
+    const BatchEncoderState* state = request->state;
+    std::copy(request->feats->begin(), request->feats->end(),
+              chunk_xs.begin() + i * chunk_stride);
+    chunk_lens[i] = request->num_frames;
+    offset[i] = state->offset;
+    std::copy(state->att_cache.begin(), state->att_cache.end(),
+              att_cache.begin() + i * att_cache_stride);
+    std::copy(state->cnn_cache.begin(), state->cnn_cache.end(),
+              cnn_cache.begin() + i * cnn_cache_stride);
+    std::copy(state->cache_mask.begin(), state->cache_mask.end(),
+              cache_mask.begin() + i * cache_size_);
+  }
+
+  const int64_t chunk_xs_shape[] = {batch_size, decoding_window_,
+                                    feature_dim_};
+  const int64_t chunk_lens_shape[] = {batch_size};
+  const int64_t offset_shape[] = {batch_size, 1};
+  const int64_t att_cache_shape[] = {batch_size, num_blocks_, head_,
+                                     cache_size_, d_k2_};
+  const int64_t cnn_cache_shape[] = {batch_size, num_blocks_, output_size_,
+                                     cnn_cache_size_};
+  const int64_t cache_mask_shape[] = {batch_size, 1, cache_size_};
+  std::vector<Ort::Value> inputs;
+  for (const auto& name : in_names_) {
+    if (name == "chunk_xs") {
+      inputs.emplace_back(Ort::Value::CreateTensor<float>(
+          memory_info, chunk_xs.data(), chunk_xs.size(), chunk_xs_shape, 3));
+    } else if (name == "chunk_lens") {
+      inputs.emplace_back(Ort::Value::CreateTensor<int32_t>(
+          memory_info, chunk_lens.data(), chunk_lens.size(), chunk_lens_shape,
+          1));
+    } else if (name == "offset") {
+      inputs.emplace_back(Ort::Value::CreateTensor<int64_t>(
+          memory_info, offset.data(), offset.size(), offset_shape, 2));
+    } else if (name == "att_cache") {
+      inputs.emplace_back(Ort::Value::CreateTensor<float>(
+          memory_info, att_cache.data(), att_cache.size(), att_cache_shape,
+          5));
+    } else if (name == "cnn_cache") {
+      inputs.emplace_back(Ort::Value::CreateTensor<float>(
+          memory_info, cnn_cache.data(), cnn_cache.size(), cnn_cache_shape,
+          4));
+    } else if (name == "cache_mask") {
+      inputs.emplace_back(Ort::Value::CreateTensor<float>(
+          memory_info, cache_mask.data(), cache_mask.size(), cache_mask_shape,
+          3));
+    } else {
+      LOG(FATAL) << "Unknown input " << name << " of the batched encoder.";
+    }
+  }
+
+  // 2. Batched encoder and CTC forward
+  std::vector<Ort::Value> outputs = session_->Run(
+      Ort::RunOptions{nullptr}, in_name_ptrs_.data(), inputs.data(),
+      inputs.size(), out_name_ptrs_.data(), out_name_ptrs_.size());
+
+  // 3. Scatter the outputs and the new states back to the streams
+  const Ort::Value& ctc_ort = outputs[FindName(out_names_, "ctc_log_probs")];
+  const float* ctc_data = ctc_ort.GetTensorData<float>();
+  std::vector<int64_t> ctc_shape =
+      ctc_ort.GetTensorTypeAndShapeInfo().GetShape();
+  const int num_outputs = ctc_shape[1];
+  const int output_dim = ctc_shape[2];
+  const float* chunk_out =
+      outputs[FindName(out_names_, "chunk_out")].GetTensorData<float>();
+  const int64_t* r_offset =
+      outputs[FindName(out_names_, "r_offset")].GetTensorData<int64_t>();
+  const float* r_att_cache =
+      outputs[FindName(out_names_, "r_att_cache")].GetTensorData<float>();
+  const float* r_cache_mask =
+      outputs[FindName(out_names_, "r_cache_mask")].GetTensorData<float>();
+  const float* r_cnn_cache = nullptr;
+  int r_cnn_cache_index = FindName(out_names_, "r_cnn_cache");
+  if (r_cnn_cache_index >= 0) {
+    r_cnn_cache = outputs[r_cnn_cache_index].GetTensorData<float>();
+  }
+
+  for (int i = 0; i < batch_size; ++i) {
+    Request* request = batch[i];
+    // chunk_out_lens of the batched encoder is the padded length over the
+    // subsampling rate, which is more than the frames of the final partial
+    // chunk, so the valid frames are the ones of the unbatched encoder
+    int num_valid = std::min(num_outputs, request->num_outputs);
+    request->ctc_prob->resize(num_valid);
+    for (int j = 0; j < num_valid; ++j) {
+      const float* row = ctc_data + (i * num_outputs + j) * output_dim;
+      (*request->ctc_prob)[j].assign(row, row + output_dim);
+    }
+    if (request->encoder_out != nullptr) {
+      const float* out = chunk_out + i * num_outputs * output_size_;
+      request->encoder_out->insert(request->encoder_out->end(), out,
+                                   out + num_valid * output_size_);
+    }
+
+    BatchEncoderState* state = request->state;
+    state->offset = r_offset[i];
+    std::memcpy(state->att_cache.data(), r_att_cache + i * att_cache_stride,
+                sizeof(float) * att_cache_stride);
+    if (r_cnn_cache != nullptr) {
+      std::memcpy(state->cnn_cache.data(), r_cnn_cache + i * cnn_cache_stride,
+                  sizeof(float) * cnn_cache_stride);
+    }
+    std::memcpy(state->cache_mask.data(), r_cache_mask + i * cache_size_,
+                sizeof(float) * cache_size_);
+  }
+}
+
+}  // namespace wenet
@@ -0,0 +1,122 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_ONNX_BATCH_ENCODER_H_
+#define DECODER_ONNX_BATCH_ENCODER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "onnxruntime_cxx_api.h"  // NOLINT
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// Streaming states of one stream (decoding session) in the batched encoder
+struct BatchEncoderState {
+  int64_t offset = 0;
+  std::vector<float> att_cache;   // (num_blocks, head, cache_size, d_k * 2)
+  std::vector<float> cnn_cache;   // (num_blocks, output_size, kernel - 1)
+  std::vector<float> cache_mask;  // (1, cache_size)
+};
+
+// OnnxBatchEncoder collects the ready chunks of the streams (decoding
+// sessions) within a latency budget, and runs them in one batch, which makes
+// much better use of the cores than running the small GEMMs of each stream
+// one by one. The states of the streams are stacked before and scattered
+// back after the run, and the streams with different offsets are masked by
+// their own cache_mask.
+//
+// It requires the batched streaming encoder (with CTC), which is exported by
+// `wenet/bin/export_onnx_gpu.py --streaming --return_ctc_logprobs` in fp32.
+// Its inputs are chunk_xs, chunk_lens, offset, att_cache, cnn_cache and
+// cache_mask, the batch size is the only dynamic dimension, so the streams
+// must be decoded with num_left_chunks > 0.
+class OnnxBatchEncoder {
+ public:
+  // @param max_batch_size: max number of chunks in one batch
+  // @param max_wait_ms: max time to wait for more chunks once the first chunk
+  //        of a batch is ready
+  OnnxBatchEncoder(std::shared_ptr<Ort::Session> session, int max_batch_size,
+                   int max_wait_ms);
+  ~OnnxBatchEncoder();
+
+  int decoding_window() const { return decoding_window_; }
+  int cache_size() const { return cache_size_; }
+  int output_size() const { return output_size_; }
+
+  void InitState(BatchEncoderState* state) const;
+  // Forward one chunk of `num_frames` frames in `feats`, it blocks until the
+  // batch containing it is done. `num_outputs` is the number of the encoder
+  // frames of the chunk, see AsrModel::num_output_frames(), the batched
+  // encoder only knows the padded length. `state` is updated for the next
+  // chunk, and the encoder output of the chunk is appended to `encoder_out`
+  // if it's not nullptr. The error of the batch is rethrown to all of its
+  // streams.
+  void Forward(const std::vector<float>& feats, int num_frames,
+               int num_outputs, BatchEncoderState* state,
+               std::vector<std::vector<float>>* ctc_prob,
+               std::vector<float>* encoder_out);
+
+ private:
+  struct Request {
+    const std::vector<float>* feats;
+    int num_frames;
+    int num_outputs;
+    BatchEncoderState* state;
+    std::vector<std::vector<float>>* ctc_prob;
+    std::vector<float>* encoder_out;
+    bool done = false;
+    std::exception_ptr error = nullptr;
+  };
+
+  void Run();
+  void ForwardBatch(const std::vector<Request*>& batch);
+
+  std::shared_ptr<Ort::Session> session_;
+  int max_batch_size_ = 1;
+  int max_wait_ms_ = 0;
+
+  std::vector<std::string> in_names_, out_names_;
+  std::vector<const char*> in_name_ptrs_, out_name_ptrs_;
+  int feature_dim_ = 0;
+  int decoding_window_ = 0;
+  int num_blocks_ = 0;
+  int head_ = 0;
+  int cache_size_ = 0;
+  int d_k2_ = 0;  // d_k * 2
+  int output_size_ = 0;
+  int cnn_cache_size_ = 0;  // 0 for transformer
+
+  std::mutex mutex_;
+  std::condition_variable request_cond_;
+  std::condition_variable done_cond_;
+  std::deque<Request*> requests_;
+  bool stop_ = false;
+  std::thread worker_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(OnnxBatchEncoder);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_ONNX_BATCH_ENCODER_H_
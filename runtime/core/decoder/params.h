@@ -16,12 +16,23 @@
 #ifndef DECODER_PARAMS_H_
 #define DECODER_PARAMS_H_
 
+#include <algorithm>
+#include <exception>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "decoder/asr_decoder.h"
+#include "decoder/decoder_pool.h"
+#include "decoder/lookahead_fst.h"
+#include "decoder/model_registry.h"
+#include "decoder/resource_manager.h"
+#include "decoder/warmup.h"
 #ifdef USE_ONNX
 #include "decoder/onnx_asr_model.h"
 #endif
@@ -39,16 +50,83 @@
 #endif
 #include "frontend/feature_pipeline.h"
 #include "post_processor/post_processor.h"
+#include "utils/affinity.h"
 #include "utils/file.h"
 #include "utils/flags.h"
 #include "utils/string.h"
+#include "utils/thread_pool.h"
+#include "utils/timer.h"
 
 DEFINE_int32(device_id, 0, "set XPU DeviceID for ASR model");
 
+// Threading policy flags of the inference engine
+DEFINE_string(engine_threading, "per_session",
+              "threading policy of the inference engine, per_session: each "
+              "session runs on its own num_gemm_threads threads, which suits "
+              "a few heavy sessions; global: all the sessions share the "
+              "process wide pool of num_gemm_threads threads, which suits "
+              "many light sessions (onnx only, the torch pool is always "
+              "process wide)");
+DEFINE_int32(num_gemm_threads, 1,
+             "number of the GEMM (intra-op) threads, per session or in total "
+             "by engine_threading, 0 means the cores left by the decode "
+             "workers");
+DEFINE_int32(num_decode_workers, 1,
+             "expected number of the concurrent decoding sessions, it is "
+             "used to split the cores if num_gemm_threads is 0, and at least "
+             "thread_num of decoder_main or decoder_pool_size of the servers");
+DEFINE_int32(num_load_threads, 4,
+             "number of the threads to load the model, the fst, the symbol "
+             "tables, the contexts and the ITN concurrently, 1 means in "
+             "sequence");
+DEFINE_int32(num_inter_op_threads, 1,
+             "number of the inter-op threads of the inference engine");
+DEFINE_bool(engine_thread_spinning, true,
+            "whether the idle engine threads spin for the next job, disable "
+            "it if the cores are oversubscribed");
+DEFINE_bool(numa_affinity, false,
+            "load one replica of the model and the fst per NUMA node, and "
+            "pin the sessions of the servers to the cores of the node, the "
+            "memory grows with the nodes");
+DEFINE_int32(decoder_pool_size, 0,
+             "number of the idle decoding sessions the servers keep built "
+             "and reset for the new connections, 0 means no pooling");
+DEFINE_bool(reload_on_sighup, true,
+            "reload the model, fst, contexts and ITN of the servers from "
+            "the same paths at SIGHUP, the live sessions finish on the old "
+            "ones");
+DEFINE_bool(warmup_resource, true,
+            "warm up the decode resources of the servers with synthetic "
+            "audio at loading, the servers listen once it's done");
+DEFINE_string(model_registry, "",
+              "config of the model profiles the servers serve besides the "
+              "default one, each line is `<name> <flagfile>`, and the start "
+              "message selects one by its `model` field");
+DEFINE_int32(model_memory_budget_mb, 0,
+             "memory budget of the loaded model profiles, measured roughly "
+             "by the growth of the resident memory at each loading, the "
+             "least recently used ones are evicted beyond it, 0 means no "
+             "limit");
+
 // TorchAsrModel flags
 DEFINE_string(model_path, "", "pytorch exported model path");
 // OnnxAsrModel flags
 DEFINE_string(onnx_dir, "", "directory where the onnx model is saved");
+DEFINE_int32(onnx_max_batch_size, 1,
+             "max number of encoder chunks of different sessions run in one "
+             "batch, > 1 enables batching, which requires encoder_batch.onnx "
+             "exported by export_onnx_gpu.py --streaming "
+             "--return_ctc_logprobs in onnx_dir");
+DEFINE_int32(onnx_batch_max_wait_ms, 5,
+             "max time to wait for the chunks of other sessions to batch");
+DEFINE_int32(onnx_graph_optimization_level, 99,
+             "graph optimization level of onnxruntime, 0 (disable all), "
+             "1 (basic), 2 (extended) or 99 (all)");
+DEFINE_string(onnx_optimized_model_dir, "",
+              "existing directory to cache the optimized onnx models, the "
+              "restarts load them and skip the graph optimization");
+DEFINE_bool(onnx_load_from_memory, false,
+            "load the onnx models from the mmapped files");
 // XPUAsrModel flags
 DEFINE_string(xpu_model_dir, "",
               "directory where the XPU model and weights is saved");
@@ -66,6 +144,9 @@ DEFINE_string(feat_type, "kaldi", "Type of feature extraction: kaldi, whisper");
 
 // TLG fst
 DEFINE_string(fst_path, "", "TLG fst path");
+DEFINE_string(g_path, "",
+              "G fst path, if it is set, fst_path is the TL fst, and TL is "
+              "composed with G on the fly with lookahead composition");
 
 // ITN fst
 DEFINE_string(itn_model_dir, "",
@@ -75,6 +156,13 @@ DEFINE_string(itn_model_dir, "",
 // DecodeOptions flags
 DEFINE_int32(chunk_size, 16, "decoding chunk size");
 DEFINE_int32(num_left_chunks, -1, "left chunks in decoding");
+DEFINE_int32(max_att_cache_frames, -1,
+             "max frames of the attention cache if num_left_chunks < 0, it "
+             "is a sliding window over the left context, <= 0 means "
+             "unbounded");
+DEFINE_string(state_storage, "fp32",
+              "storage of the caches and the encoder outputs between chunks, "
+              "fp32, fp16, bf16 or int8 (onnx only)");
 DEFINE_double(ctc_weight, 0.5,
               "ctc weight when combining ctc score and rescoring score");
 DEFINE_double(rescoring_weight, 1.0,
@@ -83,6 +171,25 @@ DEFINE_double(reverse_weight, 0.0,
               "used for bitransformer rescoring. it must be 0.0 if decoder is"
               "conventional transformer decoder, and only reverse_weight > 0.0"
               "dose the right to left decoder will be calculated and used");
+DEFINE_double(rescoring_skip_margin, 0.0,
+              "skip rescoring when the ctc score of the best hypothesis "
+              "exceeds the second best by this margin, <= 0 means never skip");
+DEFINE_double(rescoring_prune_beam, 0.0,
+              "only rescore the hypotheses within this beam of the best ctc "
+              "score, the others are ranked below them by the ctc score, <= 0 "
+              "means no pruning");
+DEFINE_double(rescoring_blank_thresh, 1.0,
+              "merge the consecutive encoder frames whose ctc blank posterior "
+              "is greater than it to one frame for rescoring, 1.0 means no "
+              "merging");
+DEFINE_int32(rescoring_interval, 0,
+             "rescore the nbest in the background every rescoring_interval "
+             "chunks to save the rescoring time at the endpoint, 0 means "
+             "rescoring only at the endpoint. It requires "
+             "rescoring_blank_thresh < 1.0");
+DEFINE_bool(pipelined_search, false,
+            "search a chunk in the background while the encoder forwards the "
+            "next one, the partial results lag one chunk behind");
 DEFINE_int32(max_active, 7000, "max active states in ctc wfst search");
 DEFINE_int32(min_active, 200, "min active states in ctc wfst search");
 DEFINE_double(beam, 16.0, "beam in ctc wfst search");
@@ -102,13 +209,26 @@ DEFINE_int32(nbest, 10, "nbest for ctc wfst or prefix search");
 // SymbolTable flags
 DEFINE_string(dict_path, "",
               "dict symbol table path, required when LM is enabled");
+DEFINE_string(dict_binary_path, "",
+              "binary symbol table of dict_path, it is read instead of "
+              "dict_path if it's newer, otherwise it's written from dict_path "
+              "for the next loads");
 DEFINE_string(unit_path, "",
               "e2e model unit symbol table, it is used in both "
               "with/without LM scenarios for context/timestamp");
 
 // Context flags
 DEFINE_string(context_path, "", "context path, is used to build context graph");
+DEFINE_string(context_graph_path, "",
+              "compiled context graph path, it is loaded instead of "
+              "compiling context_path if it exists and matches context_path, "
+              "context_score and unit_path, otherwise the graph compiled "
+              "from context_path is saved to it");
 DEFINE_double(context_score, 3.0, "is used to rescore the decoded result");
+DEFINE_int32(context_cache_size, 100,
+             "max number of compiled per session context graphs to cache");
+DEFINE_bool(merge_global_context, true,
+            "layer the per session contexts over the ones in context_path");
 
 // PostProcessOptions flags
 DEFINE_int32(language_type, 0,
@@ -139,9 +259,33 @@ std::shared_ptr<DecodeOptions> InitDecodeOptionsFromFlags() {
   auto decode_config = std::make_shared<DecodeOptions>();
   decode_config->chunk_size = FLAGS_chunk_size;
   decode_config->num_left_chunks = FLAGS_num_left_chunks;
+  decode_config->max_att_cache_frames = FLAGS_max_att_cache_frames;
+  if (!StringToStorageType(FLAGS_state_storage,
+                           &decode_config->state_storage)) {
+    throw std::invalid_argument("Unknown state storage " +
+                                FLAGS_state_storage);
+  }
+  // int8 is only supported by onnx, the other models keep their states in
+  // floats, see InitDecodeResourceFromFlags() for the model in use
+  if (decode_config->state_storage == StorageType::kInt8 &&
+      FLAGS_onnx_dir.empty()) {
+    throw std::invalid_argument("state_storage int8 requires onnx_dir");
+  }
   decode_config->ctc_weight = FLAGS_ctc_weight;
   decode_config->reverse_weight = FLAGS_reverse_weight;
   decode_config->rescoring_weight = FLAGS_rescoring_weight;
+  decode_config->rescoring_skip_margin = FLAGS_rescoring_skip_margin;
+  decode_config->rescoring_prune_beam = FLAGS_rescoring_prune_beam;
+  decode_config->rescoring_blank_thresh = FLAGS_rescoring_blank_thresh;
+  // Every chunk adds encoder outputs, so the scores cached in the background
+  // are only reused at the endpoint if the trailing blank frames are merged.
+  // It throws rather than aborts, the reloads keep the current options.
+  if (FLAGS_rescoring_interval > 0 && FLAGS_rescoring_blank_thresh >= 1.0) {
+    throw std::invalid_argument(
+        "rescoring_interval requires rescoring_blank_thresh < 1.0");
+  }
+  decode_config->rescoring_interval = FLAGS_rescoring_interval;
+  decode_config->pipelined_search = FLAGS_pipelined_search;
   decode_config->ctc_wfst_search_opts.max_active = FLAGS_max_active;
   decode_config->ctc_wfst_search_opts.min_active = FLAGS_min_active;
   decode_config->ctc_wfst_search_opts.beam = FLAGS_beam;
@@ -161,48 +305,86 @@ std::shared_ptr<DecodeOptions> InitDecodeOptionsFromFlags() {
   return decode_config;
 }
 
-std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags() {
-  auto resource = std::make_shared<DecodeResource>();
-  const int kNumGemmThreads = 1;
+// Number of the GEMM threads by the threading policy, per session for
+// per_session and in total for global
+int NumGemmThreadsFromFlags() {
+  if (FLAGS_engine_threading != "per_session" &&
+      FLAGS_engine_threading != "global") {
+    throw std::runtime_error("Unsupported engine threading " +
+                             FLAGS_engine_threading);
+  }
+  if (FLAGS_num_gemm_threads > 0) return FLAGS_num_gemm_threads;
+  int num_cores = std::max(1u, std::thread::hardware_concurrency());
+  int num_workers = std::max(1, FLAGS_num_decode_workers);
+  if (FLAGS_engine_threading == "global") {
+    // The decode workers run the search on their own threads
+    return std::max(1, num_cores - num_workers);
+  }
+  return std::max(1, num_cores / num_workers);
+}
+
+std::shared_ptr<AsrModel> LoadModelFromFlags() {
+  const int num_gemm_threads = NumGemmThreadsFromFlags();
+  LOG(INFO) << "Engine threading " << FLAGS_engine_threading << ", "
+            << num_gemm_threads << " gemm threads";
   if (!FLAGS_onnx_dir.empty()) {
 #ifdef USE_ONNX
     LOG(INFO) << "Reading onnx model ";
-    OnnxAsrModel::InitEngineThreads(kNumGemmThreads);
+    if (FLAGS_engine_threading == "global") {
+      OnnxAsrModel::InitGlobalThreadPools(num_gemm_threads,
+                                          FLAGS_num_inter_op_threads,
+                                          FLAGS_engine_thread_spinning);
+    } else {
+      OnnxAsrModel::InitEngineThreads(num_gemm_threads,
+                                      FLAGS_num_inter_op_threads,
+                                      FLAGS_engine_thread_spinning);
+    }
+    OnnxAsrModel::InitSessionOptions(FLAGS_onnx_graph_optimization_level,
+                                     FLAGS_onnx_optimized_model_dir,
+                                     FLAGS_onnx_load_from_memory);
     auto model = std::make_shared<OnnxAsrModel>();
     model->Read(FLAGS_onnx_dir);
-    resource->model = model;
+    if (FLAGS_onnx_max_batch_size > 1) {
+      model->InitBatchEncoder(
+          wenet::JoinPath(FLAGS_onnx_dir, "encoder_batch.onnx"),
+          FLAGS_onnx_max_batch_size, FLAGS_onnx_batch_max_wait_ms,
+          FLAGS_chunk_size, FLAGS_num_left_chunks);
+    }
+    return model;
 #else
-    LOG(FATAL) << "Please rebuild with cmake options '-DONNX=ON'.";
+    throw std::runtime_error("Please rebuild with cmake options '-DONNX=ON'.");
 #endif
   } else if (!FLAGS_model_path.empty()) {
 #ifdef USE_TORCH
     LOG(INFO) << "Reading torch model " << FLAGS_model_path;
-    TorchAsrModel::InitEngineThreads(kNumGemmThreads);
+    TorchAsrModel::InitEngineThreads(num_gemm_threads,
+                                     FLAGS_num_inter_op_threads);
     auto model = std::make_shared<TorchAsrModel>();
     model->Read(FLAGS_model_path);
-    resource->model = model;
+    return model;
 #else
-    LOG(FATAL) << "Please rebuild with cmake options '-DTORCH=ON'.";
+    throw std::runtime_error(
+        "Please rebuild with cmake options '-DTORCH=ON'.");
 #endif
   } else if (!FLAGS_xpu_model_dir.empty()) {
 #ifdef USE_XPU
     LOG(INFO) << "Reading XPU WeNet model weight from " << FLAGS_xpu_model_dir;
     auto model = std::make_shared<XPUAsrModel>();
-    model->SetEngineThreads(kNumGemmThreads);
+    model->SetEngineThreads(num_gemm_threads);
     model->SetDeviceId(FLAGS_device_id);
     model->Read(FLAGS_xpu_model_dir);
-    resource->model = model;
+    return model;
 #else
-    LOG(FATAL) << "Please rebuild with cmake options '-DXPU=ON'.";
+    throw std::runtime_error("Please rebuild with cmake options '-DXPU=ON'.");
 #endif
   } else if (!FLAGS_bpu_model_dir.empty()) {
 #ifdef USE_BPU
     LOG(INFO) << "Reading Horizon BPU model from " << FLAGS_bpu_model_dir;
     auto model = std::make_shared<BPUAsrModel>();
     model->Read(FLAGS_bpu_model_dir);
-    resource->model = model;
+    return model;
 #else
-    LOG(FATAL) << "Please rebuild with cmake options '-DBPU=ON'.";
+    throw std::runtime_error("Please rebuild with cmake options '-DBPU=ON'.");
 #endif
   } else if (!FLAGS_openvino_dir.empty()) {
 #ifdef USE_OPENVINO
@@ -210,58 +392,99 @@ std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags() {
     auto model = std::make_shared<OVAsrModel>();
     model->InitEngineThreads(FLAGS_core_number);
     model->Read(FLAGS_openvino_dir);
-    resource->model = model;
+    return model;
 #else
-    LOG(FATAL) << "Please rebuild with cmake options '-DOPENVINO=ON'.";
+    throw std::runtime_error(
+        "Please rebuild with cmake options '-DOPENVINO=ON'.");
 #endif
-  } else {
-    LOG(FATAL) << "Please set ONNX, TORCH, XPU, BPU or OpenVINO model path!!!";
   }
+  throw std::runtime_error(
+      "Please set ONNX, TORCH, XPU, BPU or OpenVINO model path!!!");
+}
 
-  LOG(INFO) << "Reading unit table " << FLAGS_unit_path;
-  auto unit_table = std::shared_ptr<fst::SymbolTable>(
-      fst::SymbolTable::ReadText(FLAGS_unit_path));
-  CHECK(unit_table != nullptr);
-  resource->unit_table = unit_table;
-
-  if (!FLAGS_fst_path.empty()) {  // With LM
-    CHECK(!FLAGS_dict_path.empty());
-    LOG(INFO) << "Reading fst " << FLAGS_fst_path;
-    auto fst = std::shared_ptr<fst::VectorFst<fst::StdArc>>(
-        fst::VectorFst<fst::StdArc>::Read(FLAGS_fst_path));
-    CHECK(fst != nullptr);
-    resource->fst = fst;
-
-    LOG(INFO) << "Reading symbol table " << FLAGS_dict_path;
-    auto symbol_table = std::shared_ptr<fst::SymbolTable>(
-        fst::SymbolTable::ReadText(FLAGS_dict_path));
-    CHECK(symbol_table != nullptr);
-    resource->symbol_table = symbol_table;
-  } else {  // Without LM, symbol_table is the same as unit_table
-    resource->symbol_table = unit_table;
+// TLG, or the composition of TL and G, nullptr without LM
+std::shared_ptr<fst::StdFst> LoadFstFromFlags() {
+  if (FLAGS_fst_path.empty()) {
+    return nullptr;
+  }
+  LOG(INFO) << "Reading fst " << FLAGS_fst_path;
+  auto fst = std::shared_ptr<fst::VectorFst<fst::StdArc>>(
+      fst::VectorFst<fst::StdArc>::Read(FLAGS_fst_path));
+  if (fst == nullptr) {
+    throw std::runtime_error("Failed to read fst " + FLAGS_fst_path);
   }
+  if (FLAGS_g_path.empty()) {
+    return fst;
+  }
+  LOG(INFO) << "Reading G fst " << FLAGS_g_path;
+  auto g = std::shared_ptr<fst::VectorFst<fst::StdArc>>(
+      fst::VectorFst<fst::StdArc>::Read(FLAGS_g_path));
+  if (g == nullptr) {
+    throw std::runtime_error("Failed to read G fst " + FLAGS_g_path);
+  }
+  auto tl = ConvertToLookAheadFst(*fst);
+  return ComposeLookAheadFst(*tl, g.get());
+}
+
+struct ContextResource {
+  std::shared_ptr<ContextGraph> context_graph;
+  std::shared_ptr<ContextGraphCache> context_graph_cache;
+};
 
+ContextResource LoadContextResourceFromFlags(
+    std::shared_ptr<fst::SymbolTable> unit_table) {
+  ContextResource resource;
+  ContextConfig context_config;
+  context_config.context_score = FLAGS_context_score;
+  std::vector<std::string> contexts;
   if (!FLAGS_context_path.empty()) {
     LOG(INFO) << "Reading context " << FLAGS_context_path;
-    std::vector<std::string> contexts;
     std::ifstream infile(FLAGS_context_path);
+    if (!infile.good()) {
+      throw std::runtime_error("Failed to read context " + FLAGS_context_path);
+    }
     std::string context;
     while (getline(infile, context)) {
       contexts.emplace_back(Trim(context));
     }
-    ContextConfig config;
-    config.context_score = FLAGS_context_score;
-    resource->context_graph = std::make_shared<ContextGraph>(config);
-    resource->context_graph->BuildContextGraph(contexts, unit_table);
   }
+  // The saved graph is rebuilt if the scores, the context list or the unit
+  // table change after it's saved
+  ContextGraphSource source;
+  if (!FLAGS_context_path.empty()) {
+    source.context_hash = ContextGraph::HashContexts(contexts);
+  }
+  source.num_units = unit_table->NumSymbols();
+  if (!FLAGS_context_graph_path.empty() &&
+      FileExists(FLAGS_context_graph_path)) {
+    LOG(INFO) << "Reading context graph " << FLAGS_context_graph_path;
+    auto context_graph = std::make_shared<ContextGraph>(context_config);
+    if (context_graph->Read(FLAGS_context_graph_path, source)) {
+      resource.context_graph = context_graph;
+    } else {
+      LOG(WARNING) << "Rebuild context graph " << FLAGS_context_graph_path;
+    }
+  }
+  if (resource.context_graph == nullptr && !FLAGS_context_path.empty()) {
+    resource.context_graph = std::make_shared<ContextGraph>(context_config);
+    resource.context_graph->BuildContextGraph(contexts, unit_table);
+    if (!FLAGS_context_graph_path.empty()) {
+      LOG(INFO) << "Writing context graph " << FLAGS_context_graph_path;
+      resource.context_graph->Write(FLAGS_context_graph_path, source);
+    }
+  }
+  // The request contexts are layered over the global graph if merged
+  resource.context_graph_cache = std::make_shared<ContextGraphCache>(
+      context_config, unit_table, FLAGS_context_cache_size,
+      FLAGS_merge_global_context ? resource.context_graph : nullptr);
+  return resource;
+}
 
+std::shared_ptr<PostProcessor> LoadPostProcessorFromFlags() {
   PostProcessOptions post_process_opts;
   post_process_opts.language_type =
       FLAGS_language_type == 0 ? kMandarinEnglish : kIndoEuropean;
   post_process_opts.lowercase = FLAGS_lowercase;
-  resource->post_processor =
-      std::make_shared<PostProcessor>(std::move(post_process_opts));
-
   if (!FLAGS_itn_model_dir.empty()) {  // With ITN
     std::string itn_tagger_path =
         wenet::JoinPath(FLAGS_itn_model_dir, "zh_itn_tagger.fst");
@@ -274,13 +497,267 @@ std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags() {
       auto postprocessor =
           std::make_shared<wenet::PostProcessor>(std::move(post_process_opts));
       postprocessor->InitITNResource(itn_tagger_path, itn_verbalizer_path);
-      resource->post_processor = postprocessor;
+      return postprocessor;
     }
   }
+  return std::make_shared<PostProcessor>(std::move(post_process_opts));
+}
+
+// Run `func` on `pool` (on `cpus` if it's not empty), and log its time
+template <typename F>
+auto LoadAsync(ThreadPool* pool, const std::string& name,
+               const std::vector<int>& cpus, F func)
+    -> std::future<decltype(func())> {
+  return pool->enqueue([name, cpus, func]() {
+    if (!cpus.empty()) {
+      SetThreadAffinity(cpus);
+    }
+    Timer timer;
+    auto result = func();
+    LOG(INFO) << "Loaded " << name << " in " << timer.Elapsed() << "ms";
+    return result;
+  });
+}
 
+// Load the resource, the independent parts of which are loaded concurrently
+// on num_load_threads threads, and they run on `cpus` if it's not empty. It
+// throws on failure, so the reloads keep the current resource.
+std::shared_ptr<DecodeResource> LoadDecodeResourceFromFlags(
+    const std::vector<int>& cpus = {}) {
+  Timer timer;
+  if (!FLAGS_fst_path.empty() && FLAGS_dict_path.empty()) {  // With LM
+    throw std::runtime_error("dict_path is required by fst_path");
+  }
+  ThreadPool pool(std::max(1, FLAGS_num_load_threads));
+  // The tasks depending on the others are enqueued after them, so they never
+  // wait for a task which is not started
+  std::shared_future<std::shared_ptr<fst::SymbolTable>> unit_table =
+      LoadAsync(&pool, "unit table", cpus, []() {
+        LOG(INFO) << "Reading unit table " << FLAGS_unit_path;
+        auto unit_table = std::shared_ptr<fst::SymbolTable>(
+            fst::SymbolTable::ReadText(FLAGS_unit_path));
+        if (unit_table == nullptr) {
+          throw std::runtime_error("Failed to read unit table " +
+                                   FLAGS_unit_path);
+        }
+        return unit_table;
+      }).share();
+  auto model = LoadAsync(&pool, "model", cpus, LoadModelFromFlags);
+  auto fst = LoadAsync(&pool, "fst", cpus, LoadFstFromFlags);
+  auto symbol_table = LoadAsync(&pool, "symbol table", cpus, []() {
+    if (FLAGS_fst_path.empty()) return std::shared_ptr<fst::SymbolTable>();
+    auto symbol_table =
+        ReadSymbolTable(FLAGS_dict_path, FLAGS_dict_binary_path);
+    if (symbol_table == nullptr) {
+      throw std::runtime_error("Failed to read symbol table " +
+                               FLAGS_dict_path);
+    }
+    return symbol_table;
+  });
+  auto context = LoadAsync(&pool, "contexts", cpus, [unit_table]() {
+    return LoadContextResourceFromFlags(unit_table.get());
+  });
+  auto post_processor =
+      LoadAsync(&pool, "post processor", cpus, LoadPostProcessorFromFlags);
+
+  auto resource = std::make_shared<DecodeResource>();
+  resource->unit_table = unit_table.get();
+  resource->model = model.get();
+  resource->fst = fst.get();
+  // Without LM, symbol_table is the same as unit_table
+  resource->symbol_table = symbol_table.get();
+  if (resource->fst == nullptr) {
+    resource->symbol_table = resource->unit_table;
+  }
+  ContextResource context_resource = context.get();
+  resource->context_graph = context_resource.context_graph;
+  resource->context_graph_cache = context_resource.context_graph_cache;
+  resource->post_processor = post_processor.get();
+  LOG(INFO) << "Loaded the decode resource in " << timer.Elapsed() << "ms";
+  return resource;
+}
+
+// The resource flags are overridden by the model profiles while they load
+std::mutex& ResourceFlagsMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+std::shared_ptr<DecodeResource> InitDecodeResourceFromFlags() {
+  if (!FLAGS_numa_affinity) {
+    return LoadDecodeResourceFromFlags();
+  }
+  // One replica per node, it is loaded on a thread pinned to the node, so
+  // its memory is allocated on the node (first touch) and the engine threads
+  // created by the sessions are pinned to the node as well.
+  if (FLAGS_engine_threading == "global") {
+    LOG(WARNING) << "The global engine thread pool is not numa node local, "
+                 << "use --engine_threading per_session with numa_affinity";
+  }
+  std::vector<NumaNode> nodes = GetNumaNodes();
+  std::vector<std::shared_ptr<DecodeResource>> replicas(nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    LOG(INFO) << "Loading the resource replica of numa node " << nodes[i].id
+              << " with " << nodes[i].cpus.size() << " cpus";
+    // The failure is rethrown out of the loading thread
+    std::exception_ptr error = nullptr;
+    std::thread loader([&nodes, &replicas, &error, i]() {
+      SetThreadAffinity(nodes[i].cpus);
+      try {
+        replicas[i] = LoadDecodeResourceFromFlags(nodes[i].cpus);
+      } catch (...) {
+        error = std::current_exception();
+      }
+    });
+    loader.join();
+    if (error != nullptr) std::rethrow_exception(error);
+  }
+  // The sessions get the replica of their group by WorkerGroupBinding
+  auto resource = std::make_shared<DecodeResource>(*replicas[0]);
+  resource->worker_groups =
+      std::make_shared<WorkerGroups>(std::move(nodes), std::move(replicas));
   return resource;
 }
 
+// Build decoder_pool_size idle sessions of `resource` in the pool, they are
+// split among the numa nodes and built on them if numa_affinity is set
+void PrefillDecoderPoolFromFlags(
+    const std::shared_ptr<DecoderPool>& decoder_pool,
+    const std::shared_ptr<DecodeResource>& resource) {
+  const std::shared_ptr<WorkerGroups>& groups = resource->worker_groups;
+  if (groups == nullptr) {
+    decoder_pool->Prefill(resource, FLAGS_decoder_pool_size);
+    return;
+  }
+  int num_sessions = FLAGS_decoder_pool_size / groups->num_groups();
+  for (int i = 0; i < groups->num_groups(); ++i) {
+    std::thread builder([&decoder_pool, &groups, num_sessions, i]() {
+      SetThreadAffinity(groups->node(i).cpus);
+      decoder_pool->Prefill(groups->resource(i), num_sessions);
+    });
+    builder.join();
+  }
+}
+
+// The pool of the decoding sessions for the servers, nullptr if it's
+// disabled
+std::shared_ptr<DecoderPool> InitDecoderPoolFromFlags(
+    std::shared_ptr<FeaturePipelineConfig> feature_config,
+    std::shared_ptr<DecodeOptions> decode_config,
+    const std::shared_ptr<DecodeResource>& resource) {
+  if (FLAGS_decoder_pool_size <= 0) {
+    return nullptr;
+  }
+  auto decoder_pool = std::make_shared<DecoderPool>(
+      std::move(feature_config), std::move(decode_config),
+      FLAGS_decoder_pool_size);
+  PrefillDecoderPoolFromFlags(decoder_pool, resource);
+  return decoder_pool;
+}
+
+// Warm up the resource before it serves if warmup_resource is set
+void WarmupDecodeResourceFromFlags(
+    const FeaturePipelineConfig& feature_config,
+    const DecodeOptions& decode_config,
+    const std::shared_ptr<DecodeResource>& resource) {
+  if (FLAGS_warmup_resource) {
+    WarmupDecodeResource(feature_config, decode_config, resource);
+  }
+}
+
+// The manager of the resource of the servers, the reloaded resource is warmed
+// up and the pool is prefilled with its sessions before it is swapped in,
+// and the sessions of the old one are dropped from the pool after that.
+std::shared_ptr<ResourceManager> InitResourceManagerFromFlags(
+    std::shared_ptr<FeaturePipelineConfig> feature_config,
+    std::shared_ptr<DecodeOptions> decode_config,
+    std::shared_ptr<DecodeResource> resource,
+    std::shared_ptr<DecoderPool> decoder_pool) {
+  auto warmup = [feature_config, decode_config,
+                 decoder_pool](const std::shared_ptr<DecodeResource>& r) {
+    WarmupDecodeResourceFromFlags(*feature_config, *decode_config, r);
+    if (decoder_pool != nullptr) {
+      PrefillDecoderPoolFromFlags(decoder_pool, r);
+    }
+  };
+  auto loader = []() {
+    std::lock_guard<std::mutex> lock(ResourceFlagsMutex());
+    return InitDecodeResourceFromFlags();
+  };
+  ResourceManager::Retire retire = nullptr;
+  if (decoder_pool != nullptr) {
+    retire = [decoder_pool](const std::shared_ptr<DecodeResource>& r) {
+      decoder_pool->Retire(r);
+    };
+  }
+  return std::make_shared<ResourceManager>(std::move(resource), loader,
+                                           warmup, retire);
+}
+
+// Load the resource of the model profile of `flagfile`, whose flags override
+// the ones of the command line. The feature config and the decoding options
+// of the profile are kept in the resource (and its numa replicas).
+std::shared_ptr<DecodeResource> InitDecodeResourceFromFlagfile(
+    const std::string& flagfile) {
+  std::lock_guard<std::mutex> lock(ResourceFlagsMutex());
+  // The flags of the command line are restored at return
+  gflags::FlagSaver flag_saver;
+  if (!gflags::ReadFromFlagsFile(flagfile, gflags::ProgramInvocationName(),
+                                 false)) {
+    throw std::runtime_error("Failed to read flagfile " + flagfile);
+  }
+  auto feature_config = InitFeaturePipelineConfigFromFlags();
+  auto decode_config = InitDecodeOptionsFromFlags();
+  std::shared_ptr<DecodeResource> resource = InitDecodeResourceFromFlags();
+  resource->feature_config = feature_config;
+  resource->decode_config = decode_config;
+  if (resource->worker_groups != nullptr) {
+    for (int i = 0; i < resource->worker_groups->num_groups(); ++i) {
+      resource->worker_groups->resource(i)->feature_config = feature_config;
+      resource->worker_groups->resource(i)->decode_config = decode_config;
+    }
+  }
+  return resource;
+}
+
+// The registry of the model profiles of the servers, the profiles are warmed
+// up at loading and reloading with their own feature config and decoding
+// options, and they share the session pool with the default resource. The
+// sessions of the evicted and the swapped out resources are dropped from the
+// pool.
+std::shared_ptr<ModelRegistry> InitModelRegistryFromFlags(
+    std::shared_ptr<ResourceManager> resource_manager,
+    std::shared_ptr<DecoderPool> decoder_pool) {
+  ResourceManager::Retire retire = nullptr;
+  if (decoder_pool != nullptr) {
+    retire = [decoder_pool](const std::shared_ptr<DecodeResource>& r) {
+      decoder_pool->Retire(r);
+    };
+  }
+  auto factory = [retire](const std::string& flagfile) {
+    auto loader = [flagfile]() {
+      return InitDecodeResourceFromFlagfile(flagfile);
+    };
+    auto warmup = [](const std::shared_ptr<DecodeResource>& r) {
+      WarmupDecodeResourceFromFlags(*r->feature_config, *r->decode_config, r);
+    };
+    std::shared_ptr<DecodeResource> resource = loader();
+    warmup(resource);
+    return std::make_shared<ResourceManager>(std::move(resource), loader,
+                                             warmup, retire);
+  };
+  auto model_registry = std::make_shared<ModelRegistry>(
+      std::move(resource_manager), factory,
+      static_cast<int64_t>(FLAGS_model_memory_budget_mb) << 20, retire);
+  if (!FLAGS_model_registry.empty()) {
+    CHECK(model_registry->ReadConfig(FLAGS_model_registry));
+  }
+  if (FLAGS_reload_on_sighup) {
+    model_registry->ReloadOnSignal();
+  }
+  return model_registry;
+}
+
 }  // namespace wenet
 
 #endif  // DECODER_PARAMS_H_
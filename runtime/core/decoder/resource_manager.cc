@@ -0,0 +1,77 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/resource_manager.h"
+
+#include <exception>
+#include <stdexcept>
+#include <utility>
+
+#include "utils/log.h"
+#include "utils/timer.h"
+
+namespace wenet {
+
+ResourceManager::ResourceManager(std::shared_ptr<DecodeResource> resource,
+                                 Loader loader, Warmup warmup, Retire retire)
+    : resource_(std::move(resource)),
+      loader_(std::move(loader)),
+      warmup_(std::move(warmup)),
+      retire_(std::move(retire)) {
+  CHECK(resource_ != nullptr);
+  CHECK(loader_ != nullptr);
+}
+
+ResourceManager::~ResourceManager() {
+  if (reload_thread_.joinable()) reload_thread_.join();
+}
+
+bool ResourceManager::Reload() {
+  if (reloading_.exchange(true)) {
+    LOG(WARNING) << "A reload is in progress, ignore the new one";
+    return false;
+  }
+  // The last reload is done, see reloading_
+  if (reload_thread_.joinable()) reload_thread_.join();
+  reload_thread_ = std::thread(&ResourceManager::ReloadFunc, this);
+  return true;
+}
+
+void ResourceManager::ReloadFunc() {
+  LOG(INFO) << "Reloading the decode resource";
+  Timer timer;
+  try {
+    std::shared_ptr<DecodeResource> resource = loader_();
+    if (resource == nullptr) {
+      throw std::runtime_error("no resource is loaded");
+    }
+    if (warmup_ != nullptr) {
+      warmup_(resource);
+    }
+    // The old one is kept alive by the live sessions until they are done
+    std::shared_ptr<DecodeResource> old_resource =
+        std::atomic_exchange(&resource_, resource);
+    generation_++;
+    LOG(INFO) << "Swapped in the new decode resource (generation "
+              << generation_ << ") in " << timer.Elapsed() << "ms";
+    if (retire_ != nullptr) {
+      retire_(old_resource);
+    }
+  } catch (const std::exception& e) {
+    LOG(ERROR) << "Failed to reload, keep the current resource: " << e.what();
+  }
+  reloading_ = false;
+}
+
+}  // namespace wenet
@@ -0,0 +1,77 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_RESOURCE_MANAGER_H_
+#define DECODER_RESOURCE_MANAGER_H_
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+
+#include "decoder/asr_decoder.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+// ResourceManager holds the current DecodeResource of the servers, and
+// reloads it at runtime in RCU style. The new resource is loaded and warmed
+// up in the background, then swapped in atomically. The new sessions get the
+// new resource, while the live ones finish on the old one, which is freed
+// when the last of them is done, so a rollout drops no stream.
+class ResourceManager {
+ public:
+  using Loader = std::function<std::shared_ptr<DecodeResource>()>;
+  using Warmup = std::function<void(const std::shared_ptr<DecodeResource>&)>;
+  using Retire = std::function<void(const std::shared_ptr<DecodeResource>&)>;
+
+  // @param loader: loads the new resource, e.g. from the same paths which
+  //        have the new files deployed. It throws or returns nullptr on
+  //        failure, then the current resource is kept
+  // @param warmup: if set, it's run on the new resource before the swap
+  // @param retire: if set, it's run on the old resource after the swap, e.g.
+  //        to drop its idle sessions from DecoderPool
+  ResourceManager(std::shared_ptr<DecodeResource> resource, Loader loader,
+                  Warmup warmup = nullptr, Retire retire = nullptr);
+  ~ResourceManager();
+
+  // The current resource, it's taken once per session
+  std::shared_ptr<DecodeResource> resource() const {
+    return std::atomic_load(&resource_);
+  }
+  // Start to reload in the background, return false if a reload is in
+  // progress already
+  bool Reload();
+  bool reloading() const { return reloading_; }
+  // Number of the reloads done
+  int generation() const { return generation_; }
+
+ private:
+  void ReloadFunc();
+
+  std::shared_ptr<DecodeResource> resource_;
+  Loader loader_;
+  Warmup warmup_;
+  Retire retire_;
+  std::atomic<bool> reloading_{false};
+  std::atomic<int> generation_{0};
+  std::thread reload_thread_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(ResourceManager);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_RESOURCE_MANAGER_H_
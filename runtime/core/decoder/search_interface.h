@@ -15,9 +15,14 @@
 #ifndef DECODER_SEARCH_INTERFACE_H_
 #define DECODER_SEARCH_INTERFACE_H_
 
+#include <memory>
+#include <vector>
+
+#include "decoder/ctc_posterior.h"
+
 namespace wenet {
 
-#include <vector>
+class ContextGraph;
 
 enum SearchType {
   kPrefixBeamSearch = 0x00,
@@ -28,8 +33,13 @@ class SearchInterface {
  public:
   virtual ~SearchInterface() {}
   virtual void Search(const std::vector<std::vector<float>>& logp) = 0;
+  // Search with the sparse (top k) ctc posterior, see SparseCtcFrame
+  virtual void Search(const std::vector<SparseCtcFrame>& logp) = 0;
   virtual void Reset() = 0;
   virtual void FinalizeSearch() = 0;
+  // Replace the context graph (per session hotwords) between the utterances
+  virtual void set_context_graph(
+      const std::shared_ptr<ContextGraph>& context_graph) = 0;
 
   virtual SearchType Type() const = 0;
   // N-best inputs id
@@ -17,6 +17,7 @@
 
 #include <algorithm>
 #include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <utility>
 
@@ -29,10 +30,22 @@
 namespace wenet {
 
 #ifndef IOS
-void TorchAsrModel::InitEngineThreads(int num_threads) {
+void TorchAsrModel::InitEngineThreads(int num_threads,
+                                     int num_inter_op_threads) {
   // For multi-thread performance
   at::set_num_threads(num_threads);
-  VLOG(1) << "Num intra-op threads: " << at::get_num_threads();
+  static std::once_flag inter_op_flag;
+  std::call_once(inter_op_flag, [num_inter_op_threads]() {
+    at::set_num_interop_threads(num_inter_op_threads);
+  });
+  // It can only be set before the first inter-op work, e.g. not at reloads
+  if (at::get_num_interop_threads() != num_inter_op_threads) {
+    LOG(WARNING) << "Inter-op threads stay " << at::get_num_interop_threads()
+                 << " until restart, " << num_inter_op_threads
+                 << " is ignored";
+  }
+  VLOG(1) << "Num intra-op threads: " << at::get_num_threads()
+          << ", inter-op threads: " << at::get_num_interop_threads();
 }
 #endif
 
@@ -92,6 +105,8 @@ TorchAsrModel::TorchAsrModel(const TorchAsrModel& other) {
   is_bidirectional_decoder_ = other.is_bidirectional_decoder_;
   chunk_size_ = other.chunk_size_;
   num_left_chunks_ = other.num_left_chunks_;
+  max_att_cache_frames_ = other.max_att_cache_frames_;
+  state_storage_ = other.state_storage_;
   offset_ = other.offset_;
   // 2. Model copy, just copy the model ptr since:
   // PyTorch allows using multiple CPU threads during TorchScript model
@@ -110,11 +125,29 @@ std::shared_ptr<AsrModel> TorchAsrModel::Copy() const {
   return asr_model;
 }
 
+torch::ScalarType TorchAsrModel::state_dtype() const {
+  switch (state_storage_) {
+    case StorageType::kFloat16:
+      return torch::kHalf;
+    case StorageType::kBFloat16:
+      return torch::kBFloat16;
+    default:
+      CHECK(state_storage_ == StorageType::kFloat32)
+          << "Only fp32, fp16 and bf16 state storage are supported by torch.";
+      return torch::kFloat;
+  }
+}
+
 void TorchAsrModel::Reset() {
   offset_ = 0;
   att_cache_ = std::move(torch::zeros({0, 0, 0, 0}));
   cnn_cache_ = std::move(torch::zeros({0, 0, 0, 0}));
-  encoder_outs_.clear();
+  encoder_out_frames_ = 0;
+  torch::ScalarType dtype = state_dtype();
+  if (encoder_out_.defined() && encoder_out_.scalar_type() != dtype) {
+    encoder_out_ = torch::Tensor();
+  }
+  last_frame_blank_ = false;
   cached_feature_.clear();
 }
 
@@ -122,74 +155,108 @@ void TorchAsrModel::ForwardEncoderFunc(
     const std::vector<std::vector<float>>& chunk_feats,
     std::vector<std::vector<float>>* out_prob) {
   // 1. Prepare libtorch required data, splice cached_feature_ and chunk_feats
+  // into the contiguous feats_, which is wrapped by one tensor without copy.
   // The first dimension is for batchsize, which is 1.
   int num_frames = cached_feature_.size() + chunk_feats.size();
   const int feature_dim = chunk_feats[0].size();
-  torch::Tensor feats =
-      torch::zeros({1, num_frames, feature_dim}, torch::kFloat);
+  feats_.resize(num_frames * feature_dim);
+  float* feats_data = feats_.data();
   for (size_t i = 0; i < cached_feature_.size(); ++i) {
-    torch::Tensor row =
-        torch::from_blob(const_cast<float*>(cached_feature_[i].data()),
-                         {feature_dim}, torch::kFloat)
-            .clone();
-    feats[0][i] = std::move(row);
+    std::copy(cached_feature_[i].begin(), cached_feature_[i].end(),
+              feats_data);
+    feats_data += feature_dim;
   }
   for (size_t i = 0; i < chunk_feats.size(); ++i) {
-    torch::Tensor row =
-        torch::from_blob(const_cast<float*>(chunk_feats[i].data()),
-                         {feature_dim}, torch::kFloat)
-            .clone();
-    feats[0][cached_feature_.size() + i] = std::move(row);
+    std::copy(chunk_feats[i].begin(), chunk_feats[i].end(), feats_data);
+    feats_data += feature_dim;
   }
+  torch::Tensor feats =
+      torch::from_blob(feats_.data(), {1, num_frames, feature_dim},
+                       torch::kFloat);
 
-  // 2. Encoder chunk forward
+  // 2. Encoder chunk forward, the caches stay on the device of the model
+  // across the chunks
 #ifdef USE_GPU
   feats = feats.to(at::kCUDA);
   att_cache_ = att_cache_.to(at::kCUDA);
   cnn_cache_ = cnn_cache_.to(at::kCUDA);
 #endif
   int required_cache_size = chunk_size_ * num_left_chunks_;
+  if (num_left_chunks_ < 0 && max_att_cache_frames_ > 0) {
+    // The model keeps the last required_cache_size frames of the cache
+    required_cache_size = max_att_cache_frames_;
+  }
   torch::NoGradGuard no_grad;
-  std::vector<torch::jit::IValue> inputs = {feats, offset_, required_cache_size,
-                                            att_cache_, cnn_cache_};
+  // The caches are kept in state_dtype() between chunks, it's a no-op for fp32.
+  // The offset is bounded with the sliding window, see encoder_offset().
+  std::vector<torch::jit::IValue> inputs = {
+      feats, encoder_offset(), required_cache_size,
+      att_cache_.to(torch::kFloat), cnn_cache_.to(torch::kFloat)};
 
   // Refer interfaces in wenet/transformer/asr_model.py
   auto outputs =
       model_->get_method("forward_encoder_chunk")(inputs).toTuple()->elements();
   CHECK_EQ(outputs.size(), 3);
-#ifdef USE_GPU
-  torch::Tensor chunk_out = outputs[0].toTensor().to(at::kCPU);
-  att_cache_ = outputs[1].toTensor().to(at::kCPU);
-  cnn_cache_ = outputs[2].toTensor().to(at::kCPU);
-#else
   torch::Tensor chunk_out = outputs[0].toTensor();
-  att_cache_ = outputs[1].toTensor();
-  cnn_cache_ = outputs[2].toTensor();
-#endif
+  att_cache_ = outputs[1].toTensor().to(state_dtype());
+  cnn_cache_ = outputs[2].toTensor().to(state_dtype());
   offset_ += chunk_out.size(1);
 
   // The first dimension of returned value is for batchsize, which is 1
-#ifdef USE_GPU
-  chunk_out = chunk_out.to(at::kCUDA);
-  torch::Tensor ctc_log_probs =
-      model_->run_method("ctc_activation", chunk_out).toTensor();
-  ctc_log_probs = ctc_log_probs.to(at::kCPU)[0];
-  encoder_outs_.push_back(std::move(chunk_out.to(at::kCPU)));
-#else
   torch::Tensor ctc_log_probs =
       model_->run_method("ctc_activation", chunk_out).toTensor()[0];
-  encoder_outs_.push_back(std::move(chunk_out));
+#ifdef USE_GPU
+  ctc_log_probs = ctc_log_probs.to(at::kCPU);
 #endif
+  ctc_log_probs = ctc_log_probs.contiguous();
 
-  // Copy to output
+  // Copy to output, the rows are read from the contiguous data directly
   int num_outputs = ctc_log_probs.size(0);
   int output_dim = ctc_log_probs.size(1);
+  const float* logp_data = ctc_log_probs.data_ptr<float>();
   out_prob->resize(num_outputs);
   for (int i = 0; i < num_outputs; i++) {
-    (*out_prob)[i].resize(output_dim);
-    memcpy((*out_prob)[i].data(), ctc_log_probs[i].data_ptr(),
-           sizeof(float) * output_dim);
+    (*out_prob)[i].assign(logp_data + i * output_dim,
+                          logp_data + (i + 1) * output_dim);
+  }
+  if (keep_encoder_out_) {
+    AppendEncoderOut(chunk_out, *out_prob);
+  }
+}
+
+void TorchAsrModel::AppendEncoderOut(
+    const torch::Tensor& chunk_out,
+    const std::vector<std::vector<float>>& ctc_prob) {
+  torch::Tensor kept_out = chunk_out;
+  if (rescoring_blank_thresh_ < 1.0) {
+    std::vector<float> blank_logp(ctc_prob.size());
+    for (size_t i = 0; i < ctc_prob.size(); ++i) {
+      blank_logp[i] = ctc_prob[i][blank_];
+    }
+    std::vector<int> frames;
+    SelectRescoringFrames(blank_logp, &frames);
+    torch::Tensor index =
+        torch::from_blob(frames.data(), {static_cast<int64_t>(frames.size())},
+                         torch::kInt)
+            .to(chunk_out.device(), torch::kLong);
+    kept_out = chunk_out.index_select(1, index);
+  }
+  int num_frames = kept_out.size(1);
+  int capacity = encoder_out_.defined() ? encoder_out_.size(1) : 0;
+  if (encoder_out_frames_ + num_frames > capacity) {
+    capacity = std::max(capacity * 2, encoder_out_frames_ + num_frames);
+    // The buffer is on the same device as the encoder, in state_dtype()
+    torch::Tensor buffer =
+        torch::empty({1, capacity, kept_out.size(2)},
+                     kept_out.options().dtype(state_dtype()));
+    if (encoder_out_frames_ > 0) {
+      buffer.narrow(1, 0, encoder_out_frames_)
+          .copy_(encoder_out_.narrow(1, 0, encoder_out_frames_));
+    }
+    encoder_out_ = std::move(buffer);
   }
+  encoder_out_.narrow(1, encoder_out_frames_, num_frames).copy_(kept_out);
+  encoder_out_frames_ += num_frames;
 }
 
 float TorchAsrModel::ComputeAttentionScore(const torch::Tensor& prob,
@@ -215,7 +282,7 @@ void TorchAsrModel::AttentionRescoring(
     return;
   }
   // No encoder output
-  if (encoder_outs_.size() == 0) {
+  if (encoder_out_frames_ == 0) {
     return;
   }
 
@@ -238,12 +305,14 @@ void TorchAsrModel::AttentionRescoring(
     }
   }
 
-  // Step 2: Forward attention decoder by hyps and corresponding encoder_outs_
-  torch::Tensor encoder_out = torch::cat(encoder_outs_, 1);
+  // Step 2: Forward attention decoder by hyps and corresponding encoder_out_
+  // A view of the valid frames, it is already on the device, and it's
+  // converted to fp32 if it is stored in reduced precision
+  torch::Tensor encoder_out =
+      encoder_out_.narrow(1, 0, encoder_out_frames_).to(torch::kFloat);
 #ifdef USE_GPU
   hyps_tensor = hyps_tensor.to(at::kCUDA);
   hyps_length = hyps_length.to(at::kCUDA);
-  encoder_out = encoder_out.to(at::kCUDA);
 #endif
   auto outputs = model_
                      ->run_method("forward_attention_decoder", hyps_tensor,
@@ -33,7 +33,10 @@ namespace wenet {
 class TorchAsrModel : public AsrModel {
  public:
 #ifndef IOS
-  static void InitEngineThreads(int num_threads = 1);
+  // The intra/inter-op pools of torch are process wide, they are shared by
+  // all the sessions. The inter-op pool can only be set before its first use.
+  static void InitEngineThreads(int num_threads = 1,
+                                int num_inter_op_threads = 1);
 #endif
 
  public:
@@ -43,6 +46,7 @@ class TorchAsrModel : public AsrModel {
   void Read(const std::string& model_path);
   std::shared_ptr<TorchModule> torch_model() const { return model_; }
   void Reset() override;
+  int num_rescoring_frames() const override { return encoder_out_frames_; }
   void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
                           float reverse_weight,
                           std::vector<float>* rescoring_score) override;
@@ -54,10 +58,24 @@ class TorchAsrModel : public AsrModel {
 
   float ComputeAttentionScore(const torch::Tensor& prob,
                               const std::vector<int>& hyp, int eos);
+  // Torch dtype of the caches and encoder_out_ between chunks, int8 is not
+  // supported, see set_state_storage()
+  torch::ScalarType state_dtype() const;
+  // Append chunk_out to encoder_out_, with the blank frames compressed by
+  // ctc_prob, see set_rescoring_blank_thresh()
+  void AppendEncoderOut(const torch::Tensor& chunk_out,
+                        const std::vector<std::vector<float>>& ctc_prob);
 
  private:
   std::shared_ptr<TorchModule> model_ = nullptr;
-  std::vector<torch::Tensor> encoder_outs_;
+  // Contiguous cached_feature_ and chunk_feats of the chunk, (num_frames,
+  // feature_dim), the input tensor is created over it
+  std::vector<float> feats_;
+  // Encoder outputs of all the chunks, (1, capacity, output_size), the first
+  // encoder_out_frames_ frames are valid. It grows geometrically and is kept
+  // across Reset(), so no torch::cat is required for rescoring.
+  torch::Tensor encoder_out_;
+  int encoder_out_frames_ = 0;
   // transformer/conformer attention cache
   torch::Tensor att_cache_ = torch::zeros({0, 0, 0, 0});
   // conformer-only conv_module cache
@@ -0,0 +1,185 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/warmup.h"
+
+#include <algorithm>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "decoder/worker_groups.h"
+#include "utils/affinity.h"
+#include "utils/log.h"
+#include "utils/timer.h"
+
+namespace wenet {
+
+namespace {
+
+// Max number of the chunks of the warmup utterances
+const int kMaxWarmupChunks = 32;
+
+// Low level white noise, unlike silence it drives the searcher and the
+// rescoring with non-empty hypotheses
+std::vector<int16_t> SyntheticAudio(int num_samples) {
+  std::mt19937 generator(num_samples);
+  std::normal_distribution<float> distribution(0.0, 1000.0);
+  std::vector<int16_t> audio(num_samples);
+  for (auto& sample : audio) {
+    float value = distribution(generator);
+    value = std::max(-32768.0f, std::min(32767.0f, value));
+    sample = static_cast<int16_t>(value);
+  }
+  return audio;
+}
+
+// Number of samples of the warmup utterances
+std::vector<int> WarmupLengths(const FeaturePipelineConfig& feature_config,
+                               const DecodeOptions& decode_config,
+                               const AsrModel& model) {
+  if (decode_config.chunk_size <= 0) {
+    // Non-streaming, the whole utterance is one chunk
+    int sample_rate = feature_config.sample_rate;
+    return {sample_rate / 2, sample_rate * 3 / 2, sample_rate * 4};
+  }
+  int chunk_samples = decode_config.chunk_size * model.subsampling_rate() *
+                      feature_config.frame_shift;
+  // The attention cache grows chunk by chunk until it's full
+  int num_chunks = 4;
+  if (decode_config.num_left_chunks > 0) {
+    num_chunks = decode_config.num_left_chunks + 2;
+  } else if (decode_config.max_att_cache_frames > 0) {
+    num_chunks =
+        decode_config.max_att_cache_frames / decode_config.chunk_size + 2;
+  }
+  num_chunks = std::min(num_chunks, kMaxWarmupChunks);
+  return {chunk_samples / 2, chunk_samples * 2 + chunk_samples / 3,
+          chunk_samples * num_chunks + chunk_samples / 2};
+}
+
+void WarmupDecoding(const FeaturePipelineConfig& feature_config,
+                    const DecodeOptions& decode_config,
+                    const std::shared_ptr<DecodeResource>& resource,
+                    const std::vector<int16_t>& audio) {
+  auto feature_pipeline = std::make_shared<FeaturePipeline>(feature_config);
+  AsrDecoder decoder(feature_pipeline, resource, decode_config);
+  feature_pipeline->AcceptWaveform(audio.data(), audio.size());
+  feature_pipeline->set_input_finished();
+  DecodeState state = DecodeState::kEndBatch;
+  while (state != DecodeState::kEndFeats) {
+    state = decoder.Decode();
+    if (state == DecodeState::kEndpoint) {
+      decoder.Rescoring();
+      decoder.ResetContinuousDecoding();
+    }
+  }
+  decoder.Rescoring();
+}
+
+void WarmupRescoring(const FeaturePipelineConfig& feature_config,
+                     const DecodeOptions& decode_config,
+                     const std::shared_ptr<DecodeResource>& resource,
+                     int num_hyps, int num_units) {
+  std::shared_ptr<AsrModel> model = resource->model->Copy();
+  model->set_chunk_size(decode_config.chunk_size);
+  model->set_num_left_chunks(decode_config.num_left_chunks);
+  model->set_max_att_cache_frames(decode_config.max_att_cache_frames);
+  model->set_keep_encoder_out(true);
+  model->set_state_storage(decode_config.state_storage);
+  // One chunk of random features for the encoder outputs
+  int num_frames =
+      decode_config.chunk_size > 0
+          ? model->num_frames_for_chunk(true) + model->right_context()
+          : 100;
+  std::mt19937 generator(num_frames);
+  std::normal_distribution<float> distribution(0.0, 1.0);
+  std::vector<std::vector<float>> feats(
+      num_frames, std::vector<float>(feature_config.num_bins));
+  for (auto& frame : feats) {
+    for (auto& value : frame) value = distribution(generator);
+  }
+  // The CTC posterior is dense or the sparse top k, see AsrModel::sparse_ctc()
+  if (model->sparse_ctc()) {
+    std::vector<SparseCtcFrame> ctc_prob;
+    model->ForwardEncoder(feats, &ctc_prob);
+  } else {
+    std::vector<std::vector<float>> ctc_prob;
+    model->ForwardEncoder(feats, &ctc_prob);
+  }
+
+  // The units but blank, sos and eos
+  int max_unit = std::max(2, std::min(model->sos(), model->eos()));
+  std::vector<std::vector<int>> hyps(num_hyps, std::vector<int>(num_units));
+  for (int i = 0; i < num_hyps; ++i) {
+    for (int j = 0; j < num_units; ++j) {
+      hyps[i][j] = 1 + (i * num_units + j) % (max_unit - 1);
+    }
+  }
+  std::vector<float> scores;
+  model->AttentionRescoring(hyps, decode_config.reverse_weight, &scores);
+}
+
+void WarmupReplica(const FeaturePipelineConfig& feature_config,
+                   const DecodeOptions& decode_config,
+                   const std::shared_ptr<DecodeResource>& resource) {
+  for (int num_samples :
+       WarmupLengths(feature_config, decode_config, *resource->model)) {
+    std::vector<int16_t> audio = SyntheticAudio(num_samples);
+    Timer timer;
+    WarmupDecoding(feature_config, decode_config, resource, audio);
+    int audio_ms = num_samples * 1000 / feature_config.sample_rate;
+    LOG(INFO) << "Warmup of " << audio_ms << "ms audio takes "
+              << timer.Elapsed() << "ms";
+  }
+  if (decode_config.rescoring_weight != 0.0) {
+    int nbest = resource->fst != nullptr
+                    ? static_cast<int>(decode_config.ctc_wfst_search_opts.nbest)
+                    : decode_config.ctc_prefix_search_opts.second_beam_size;
+    for (int num_hyps : {1, std::max(nbest, 1)}) {
+      for (int num_units : {4, 32}) {
+        Timer timer;
+        WarmupRescoring(feature_config, decode_config, resource, num_hyps,
+                        num_units);
+        LOG(INFO) << "Warmup of the rescoring of " << num_hyps << " x "
+                  << num_units << " units takes " << timer.Elapsed() << "ms";
+      }
+    }
+  }
+}
+
+}  // namespace
+
+int WarmupDecodeResource(const FeaturePipelineConfig& feature_config,
+                         const DecodeOptions& decode_config,
+                         const std::shared_ptr<DecodeResource>& resource) {
+  Timer timer;
+  const std::shared_ptr<WorkerGroups>& groups = resource->worker_groups;
+  if (groups == nullptr) {
+    WarmupReplica(feature_config, decode_config, resource);
+  } else {
+    for (int i = 0; i < groups->num_groups(); ++i) {
+      std::thread warmup([&feature_config, &decode_config, &groups, i]() {
+        SetThreadAffinity(groups->node(i).cpus);
+        WarmupReplica(feature_config, decode_config, groups->resource(i));
+      });
+      warmup.join();
+    }
+  }
+  int elapsed = timer.Elapsed();
+  LOG(INFO) << "Warmup of the decode resource takes " << elapsed << "ms";
+  return elapsed;
+}
+
+}  // namespace wenet
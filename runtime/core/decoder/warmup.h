@@ -0,0 +1,41 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_WARMUP_H_
+#define DECODER_WARMUP_H_
+
+#include <memory>
+
+#include "decoder/asr_decoder.h"
+#include "frontend/feature_pipeline.h"
+
+namespace wenet {
+
+// Warm up `resource` (and its numa replicas, on their nodes) with synthetic
+// audio before it serves, so the lazy initializations of the inference
+// engine (kernel selection, arena growth, the JIT fusion of torch) are not
+// paid by the first requests. It runs
+//   1. the utterances of the first chunk only, the first and later chunks
+//      with a final partial chunk, and the chunks to fill the attention
+//      cache, through the searcher of the resource,
+//   2. the attention rescoring of 1 and nbest hypotheses of short and long
+//      lengths.
+// The timings of the passes are logged, and the total time (ms) returned.
+int WarmupDecodeResource(const FeaturePipelineConfig& feature_config,
+                         const DecodeOptions& decode_config,
+                         const std::shared_ptr<DecodeResource>& resource);
+
+}  // namespace wenet
+
+#endif  // DECODER_WARMUP_H_
@@ -0,0 +1,53 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/worker_groups.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "utils/log.h"
+
+namespace wenet {
+
+WorkerGroups::WorkerGroups(
+    std::vector<NumaNode> nodes,
+    std::vector<std::shared_ptr<DecodeResource>> resources)
+    : nodes_(std::move(nodes)),
+      resources_(std::move(resources)),
+      num_sessions_(nodes_.size(), 0) {
+  CHECK(!nodes_.empty());
+  CHECK_EQ(nodes_.size(), resources_.size());
+}
+
+int WorkerGroups::Join() {
+  int group = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    group = std::min_element(num_sessions_.begin(), num_sessions_.end()) -
+            num_sessions_.begin();
+    num_sessions_[group]++;
+  }
+  SetThreadAffinity(nodes_[group].cpus);
+  VLOG(1) << "Session joins the worker group of numa node "
+          << nodes_[group].id;
+  return group;
+}
+
+void WorkerGroups::Leave(int group) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  num_sessions_[group]--;
+}
+
+}  // namespace wenet
@@ -0,0 +1,82 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DECODER_WORKER_GROUPS_H_
+#define DECODER_WORKER_GROUPS_H_
+
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "utils/affinity.h"
+#include "utils/utils.h"
+
+namespace wenet {
+
+struct DecodeResource;
+
+// WorkerGroups places the decoding sessions on the NUMA nodes. Each group
+// is the cores of one node and the replica of the resource (model weights,
+// fst...) loaded on that node, so the session threads, the GEMM threads
+// and the memory they touch stay on one socket. It is thread safe.
+class WorkerGroups {
+ public:
+  WorkerGroups(std::vector<NumaNode> nodes,
+               std::vector<std::shared_ptr<DecodeResource>> resources);
+
+  int num_groups() const { return nodes_.size(); }
+  const NumaNode& node(int group) const { return nodes_[group]; }
+  const std::shared_ptr<DecodeResource>& resource(int group) const {
+    return resources_[group];
+  }
+
+  // Pin the calling thread to the least loaded group and return it, the
+  // threads created by it later run on the group as well
+  int Join();
+  void Leave(int group);
+
+ private:
+  std::vector<NumaNode> nodes_;
+  std::vector<std::shared_ptr<DecodeResource>> resources_;
+  std::mutex mutex_;
+  std::vector<int> num_sessions_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(WorkerGroups);
+};
+
+// Binds the calling thread to one group of WorkerGroups for its lifetime
+class WorkerGroupBinding {
+ public:
+  explicit WorkerGroupBinding(std::shared_ptr<WorkerGroups> groups)
+      : groups_(std::move(groups)), group_(groups_->Join()) {}
+  ~WorkerGroupBinding() { groups_->Leave(group_); }
+
+  const std::shared_ptr<DecodeResource>& resource() const {
+    return groups_->resource(group_);
+  }
+  int group() const { return group_; }
+
+ private:
+  std::shared_ptr<WorkerGroups> groups_;
+  int group_;
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(WorkerGroupBinding);
+};
+
+}  // namespace wenet
+
+#endif  // DECODER_WORKER_GROUPS_H_
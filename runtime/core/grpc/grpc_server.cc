@@ -25,23 +25,52 @@ GrpcConnectionHandler::GrpcConnectionHandler(
     std::shared_ptr<Request> request, std::shared_ptr<Response> response,
     std::shared_ptr<FeaturePipelineConfig> feature_config,
     std::shared_ptr<DecodeOptions> decode_config,
-    std::shared_ptr<DecodeResource> decode_resource)
+    std::shared_ptr<DecodeResource> decode_resource,
+    std::shared_ptr<DecoderPool> decoder_pool,
+    std::shared_ptr<ModelRegistry> model_registry)
     : stream_(std::move(stream)),
       request_(std::move(request)),
       response_(std::move(response)),
       feature_config_(std::move(feature_config)),
       decode_config_(std::move(decode_config)),
-      decode_resource_(std::move(decode_resource)) {}
+      decode_resource_(std::move(decode_resource)),
+      decoder_pool_(std::move(decoder_pool)),
+      model_registry_(std::move(model_registry)) {}
 
 void GrpcConnectionHandler::OnSpeechStart() {
   LOG(INFO) << "Received speech start signal, start reading speech";
+  if (!model_.empty()) {
+    std::shared_ptr<DecodeResource> resource =
+        model_registry_ == nullptr ? nullptr
+                                   : model_registry_->resource(model_, group_);
+    if (resource == nullptr) {
+      LOG(ERROR) << "Unknown model " << model_;
+      response_->set_status(Response::failed);
+      stream_->Write(*response_);
+      return;
+    }
+    decode_resource_ = resource;
+    // The profile may have its own feature config and decoding options
+    if (resource->decode_config != nullptr) {
+      feature_config_ = resource->feature_config;
+      decode_config_ = resource->decode_config;
+    }
+  }
   got_start_tag_ = true;
   response_->set_status(Response::ok);
   response_->set_type(Response::server_ready);
   stream_->Write(*response_);
-  feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
-  decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, decode_resource_,
-                                          *decode_config_);
+  if (decoder_pool_ != nullptr) {
+    // A built session, it goes back to the pool with the handler
+    session_ = decoder_pool_->Acquire(decode_resource_, contexts_);
+    feature_pipeline_ = session_->feature_pipeline;
+    decoder_ = session_->decoder;
+  } else {
+    feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
+    decoder_ = std::make_shared<AsrDecoder>(
+        feature_pipeline_, GetSessionResource(decode_resource_, contexts_),
+        *decode_config_);
+  }
   // Start decoder thread
   decode_thread_ = std::make_shared<std::thread>(
       &GrpcConnectionHandler::DecodeThreadFunc, this);
@@ -141,13 +170,24 @@ void GrpcConnectionHandler::DecodeThreadFunc() {
 }
 
 void GrpcConnectionHandler::operator()() {
+  // Decode on the cores and the resource replica of one numa node
+  std::unique_ptr<WorkerGroupBinding> binding = nullptr;
+  if (decode_resource_->worker_groups != nullptr) {
+    binding.reset(new WorkerGroupBinding(decode_resource_->worker_groups));
+    decode_resource_ = binding->resource();
+    group_ = binding->group();
+  }
   try {
     while (stream_->Read(request_.get())) {
       if (!got_start_tag_) {
         nbest_ = request_->decode_config().nbest_config();
         continuous_decoding_ =
             request_->decode_config().continuous_decoding_config();
+        contexts_.assign(request_->decode_config().context().begin(),
+                         request_->decode_config().context().end());
+        model_ = request_->decode_config().model();
         OnSpeechStart();
+        if (decoder_ == nullptr) return;
       } else {
         OnSpeechData();
       }
@@ -168,7 +208,8 @@ Status GrpcServer::Recognize(ServerContext* context,
   auto request = std::make_shared<Request>();
   auto response = std::make_shared<Response>();
   GrpcConnectionHandler handler(stream, request, response, feature_config_,
-                                decode_config_, decode_resource_);
+                                decode_config_, model_registry_->resource(),
+                                decoder_pool_, model_registry_);
   std::thread t(std::move(handler));
   t.join();
   return Status::OK;
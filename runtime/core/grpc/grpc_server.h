@@ -23,6 +23,8 @@
 #include <vector>
 
 #include "decoder/asr_decoder.h"
+#include "decoder/decoder_pool.h"
+#include "decoder/model_registry.h"
 #include "frontend/feature_pipeline.h"
 #include "utils/log.h"
 
@@ -39,12 +41,14 @@ using wenet::Response;
 
 class GrpcConnectionHandler {
  public:
-  GrpcConnectionHandler(ServerReaderWriter<Response, Request>* stream,
-                        std::shared_ptr<Request> request,
-                        std::shared_ptr<Response> response,
-                        std::shared_ptr<FeaturePipelineConfig> feature_config,
-                        std::shared_ptr<DecodeOptions> decode_config,
-                        std::shared_ptr<DecodeResource> decode_resource);
+  GrpcConnectionHandler(
+      ServerReaderWriter<Response, Request>* stream,
+      std::shared_ptr<Request> request, std::shared_ptr<Response> response,
+      std::shared_ptr<FeaturePipelineConfig> feature_config,
+      std::shared_ptr<DecodeOptions> decode_config,
+      std::shared_ptr<DecodeResource> decode_resource,
+      std::shared_ptr<DecoderPool> decoder_pool = nullptr,
+      std::shared_ptr<ModelRegistry> model_registry = nullptr);
   void operator()();
 
  private:
@@ -59,17 +63,27 @@ class GrpcConnectionHandler {
 
   bool continuous_decoding_ = false;
   int nbest_ = 1;
+  // Per session contexts (hotwords)
+  std::vector<std::string> contexts_;
+  // Model profile selected by the decode config, empty for the default one
+  std::string model_;
+  // Numa node group of the session, -1 if it's not bound
+  int group_ = -1;
   ServerReaderWriter<Response, Request>* stream_;
   std::shared_ptr<Request> request_;
   std::shared_ptr<Response> response_;
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
   std::shared_ptr<DecodeResource> decode_resource_;
+  // Sessions are taken from it if it's not nullptr
+  std::shared_ptr<DecoderPool> decoder_pool_;
+  std::shared_ptr<ModelRegistry> model_registry_;
 
   bool got_start_tag_ = false;
   bool got_end_tag_ = false;
   // When endpoint is detected, stop recognition, and stop receiving data.
   bool stop_recognition_ = false;
+  std::shared_ptr<DecoderSession> session_ = nullptr;
   std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
   std::shared_ptr<AsrDecoder> decoder_ = nullptr;
   std::shared_ptr<std::thread> decode_thread_ = nullptr;
@@ -79,17 +93,22 @@ class GrpcServer final : public ASR::Service {
  public:
   GrpcServer(std::shared_ptr<FeaturePipelineConfig> feature_config,
              std::shared_ptr<DecodeOptions> decode_config,
-             std::shared_ptr<DecodeResource> decode_resource)
+             std::shared_ptr<ModelRegistry> model_registry,
+             std::shared_ptr<DecoderPool> decoder_pool = nullptr)
       : feature_config_(std::move(feature_config)),
         decode_config_(std::move(decode_config)),
-        decode_resource_(std::move(decode_resource)) {}
+        model_registry_(std::move(model_registry)),
+        decoder_pool_(std::move(decoder_pool)) {}
   Status Recognize(ServerContext* context,
                    ServerReaderWriter<Response, Request>* reader) override;
 
  private:
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
-  std::shared_ptr<DecodeResource> decode_resource_;
+  // Each stream takes the current default resource of it, or the one of
+  // the model profile selected by the decode config
+  std::shared_ptr<ModelRegistry> model_registry_;
+  std::shared_ptr<DecoderPool> decoder_pool_;
   DISALLOW_COPY_AND_ASSIGN(GrpcServer);
 };
 
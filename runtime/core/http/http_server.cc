@@ -32,20 +32,47 @@ namespace json = boost::json;
 ConnectionHandler::ConnectionHandler(
     tcp::socket&& socket, std::shared_ptr<FeaturePipelineConfig> feature_config,
     std::shared_ptr<DecodeOptions> decode_config,
-    std::shared_ptr<DecodeResource> decode_resource)
+    std::shared_ptr<DecodeResource> decode_resource,
+    std::shared_ptr<DecoderPool> decoder_pool,
+    std::shared_ptr<ModelRegistry> model_registry)
     : socket_(std::move(socket)),
       feature_config_(std::move(feature_config)),
       decode_config_(std::move(decode_config)),
       decode_resource_(std::move(decode_resource)),
+      decoder_pool_(std::move(decoder_pool)),
+      model_registry_(std::move(model_registry)),
       req_(std::make_shared<http::request<http::string_body>>(
           http::verb::post, target_, version_)),
       res_(std::make_shared<http::response<http::string_body>>(http::status::ok,
                                                                version_)) {}
 
 void ConnectionHandler::OnSpeechStart() {
-  feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
-  decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, decode_resource_,
-                                          *decode_config_);
+  if (!model_.empty()) {
+    std::shared_ptr<DecodeResource> resource =
+        model_registry_ == nullptr ? nullptr
+                                   : model_registry_->resource(model_, group_);
+    if (resource == nullptr) {
+      OnError("Unknown model " + model_);
+      return;
+    }
+    decode_resource_ = resource;
+    // The profile may have its own feature config and decoding options
+    if (resource->decode_config != nullptr) {
+      feature_config_ = resource->feature_config;
+      decode_config_ = resource->decode_config;
+    }
+  }
+  if (decoder_pool_ != nullptr) {
+    // A built session, it goes back to the pool with the handler
+    session_ = decoder_pool_->Acquire(decode_resource_, contexts_);
+    feature_pipeline_ = session_->feature_pipeline;
+    decoder_ = session_->decoder;
+  } else {
+    feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
+    decoder_ = std::make_shared<AsrDecoder>(
+        feature_pipeline_, GetSessionResource(decode_resource_, contexts_),
+        *decode_config_);
+  }
   // Start decoder thread
   decode_thread_ =
       std::make_shared<std::thread>(&ConnectionHandler::DecodeThreadFunc, this);
@@ -139,12 +166,38 @@ void ConnectionHandler::OnText(const std::string& message) {
         OnError("integer is expected for nbest option");
       }
     }
+    if (obj.find("context") != obj.end()) {
+      if (obj["context"].is_array()) {
+        contexts_.clear();
+        for (const auto& context : obj["context"].as_array()) {
+          if (context.is_string()) {
+            contexts_.emplace_back(context.as_string().c_str());
+          }
+        }
+      } else {
+        OnError("array of strings is expected for context option");
+      }
+    }
+    if (obj.find("model") != obj.end()) {
+      if (obj["model"].is_string()) {
+        model_ = obj["model"].as_string().c_str();
+      } else {
+        OnError("string is expected for model option");
+      }
+    }
   } else {
     OnError("Wrong protocol");
   }
 }
 
 void ConnectionHandler::operator()() {
+  // Decode on the cores and the resource replica of one numa node
+  std::unique_ptr<WorkerGroupBinding> binding = nullptr;
+  if (decode_resource_->worker_groups != nullptr) {
+    binding.reset(new WorkerGroupBinding(decode_resource_->worker_groups));
+    decode_resource_ = binding->resource();
+    group_ = binding->group();
+  }
   try {
     http::read(socket_, buffer_, *req_.get(), ec_);
     if (ec_) {
@@ -152,8 +205,10 @@ void ConnectionHandler::operator()() {
     } else {
       OnText(req_.get()->base()["config"].to_string());
       OnSpeechStart();
-      OnSpeechData(req_.get()->body());
-      OnSpeechEnd();
+      if (decoder_ != nullptr) {
+        OnSpeechData(req_.get()->body());
+        OnSpeechEnd();
+      }
     }
     LOG(INFO) << "Read all pcm data, wait for decoding thread";
     if (decode_thread_ != nullptr) {
@@ -170,7 +225,57 @@ void ConnectionHandler::operator()() {
   socket_.shutdown(tcp::socket::shutdown_send, ec_);
 }
 
+void HttpServer::OnAdminRequest(tcp::socket* socket) {
+  beast::flat_buffer buffer;
+  http::request<http::string_body> req;
+  beast::error_code ec;
+  http::read(*socket, buffer, req, ec);
+  if (ec) {
+    LOG(ERROR) << ec;
+    return;
+  }
+  http::response<http::string_body> res{http::status::ok, req.version()};
+  if (req.target() != "/reload") {
+    res.result(http::status::not_found);
+  } else if (req.method() != http::verb::post) {
+    res.result(http::status::method_not_allowed);
+    res.set(http::field::allow, "POST");
+  } else {
+    bool started = model_registry_->Reload();
+    std::string message = started ? "reloading" : "failed to start reloading";
+    json::value rv = {{"status", started ? "ok" : "failed"},
+                      {"type", "reload"},
+                      {"message", message}};
+    res.body() = json::serialize(rv);
+  }
+  res.prepare_payload();
+  http::write(*socket, res, ec);
+  socket->shutdown(tcp::socket::shutdown_send, ec);
+}
+
+void HttpServer::ServeAdmin() {
+  try {
+    // Not exposed beyond the host
+    auto const address = net::ip::make_address("127.0.0.1");
+    tcp::acceptor acceptor{admin_ioc_,
+                           {address, static_cast<uint16_t>(admin_port_)}};
+    for (;;) {
+      tcp::socket socket{admin_ioc_};
+      acceptor.accept(socket);
+      // The requests are rare and fast, they are served one by one
+      OnAdminRequest(&socket);
+    }
+  } catch (const std::exception& e) {
+    LOG(FATAL) << e.what();
+  }
+}
+
 void HttpServer::Start() {
+  if (admin_port_ > 0) {
+    std::thread admin(&HttpServer::ServeAdmin, this);
+    admin.detach();
+    LOG(INFO) << "Admin requests at localhost port " << admin_port_;
+  }
   try {
     auto const address = net::ip::make_address("0.0.0.0");
     tcp::acceptor acceptor{ioc_, {address, static_cast<uint16_t>(port_)}};
@@ -181,7 +286,8 @@ void HttpServer::Start() {
       acceptor.accept(socket);
       // Launch the session, transferring ownership of the socket
       ConnectionHandler handler(std::move(socket), feature_config_,
-                                decode_config_, decode_resource_);
+                                decode_config_, model_registry_->resource(),
+                                decoder_pool_, model_registry_);
       std::thread t(std::move(handler));
       t.detach();
     }
@@ -20,6 +20,7 @@
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/beast/core.hpp>
@@ -29,6 +30,8 @@
 #include <boost/config.hpp>
 
 #include "decoder/asr_decoder.h"
+#include "decoder/decoder_pool.h"
+#include "decoder/model_registry.h"
 #include "frontend/feature_pipeline.h"
 #include "utils/log.h"
 
@@ -41,10 +44,13 @@ using tcp = boost::asio::ip::tcp;  // from <boost/asio/ip/tcp.hpp>
 
 class ConnectionHandler {
  public:
-  ConnectionHandler(tcp::socket&& socket,
-                    std::shared_ptr<FeaturePipelineConfig> feature_config,
-                    std::shared_ptr<DecodeOptions> decode_config,
-                    std::shared_ptr<DecodeResource> decode_resource_);
+  ConnectionHandler(
+      tcp::socket&& socket,
+      std::shared_ptr<FeaturePipelineConfig> feature_config,
+      std::shared_ptr<DecodeOptions> decode_config,
+      std::shared_ptr<DecodeResource> decode_resource_,
+      std::shared_ptr<DecoderPool> decoder_pool = nullptr,
+      std::shared_ptr<ModelRegistry> model_registry = nullptr);
   void operator()();
 
  private:
@@ -61,6 +67,12 @@ class ConnectionHandler {
   int version_ = 11;
   const bool continuous_decoding_ = false;
   int nbest_ = 1;
+  // Per session contexts (hotwords)
+  std::vector<std::string> contexts_;
+  // Model profile selected by the config, empty for the default one
+  std::string model_;
+  // Numa node group of the session, -1 if it's not bound
+  int group_ = -1;
   tcp::socket socket_;
   beast::flat_buffer buffer_;
   beast::error_code ec_;
@@ -69,7 +81,11 @@ class ConnectionHandler {
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
   std::shared_ptr<DecodeResource> decode_resource_;
+  // Sessions are taken from it if it's not nullptr
+  std::shared_ptr<DecoderPool> decoder_pool_;
+  std::shared_ptr<ModelRegistry> model_registry_;
 
+  std::shared_ptr<DecoderSession> session_ = nullptr;
   std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
   std::shared_ptr<AsrDecoder> decoder_ = nullptr;
   std::shared_ptr<std::thread> decode_thread_ = nullptr;
@@ -77,23 +93,38 @@ class ConnectionHandler {
 
 class HttpServer {
  public:
+  // @param admin_port: if > 0, the admin requests (POST /reload, which
+  //        reloads the resources in the background) are served on it, and it
+  //        is bound to localhost only
   HttpServer(int port, std::shared_ptr<FeaturePipelineConfig> feature_config,
              std::shared_ptr<DecodeOptions> decode_config,
-             std::shared_ptr<DecodeResource> decode_resource)
+             std::shared_ptr<ModelRegistry> model_registry,
+             std::shared_ptr<DecoderPool> decoder_pool = nullptr,
+             int admin_port = 0)
       : port_(port),
+        admin_port_(admin_port),
         feature_config_(std::move(feature_config)),
         decode_config_(std::move(decode_config)),
-        decode_resource_(std::move(decode_resource)) {}
+        model_registry_(std::move(model_registry)),
+        decoder_pool_(std::move(decoder_pool)) {}
 
   void Start();
 
  private:
+  void ServeAdmin();
+  void OnAdminRequest(tcp::socket* socket);
+
   int port_;
+  int admin_port_;
   // The io_context is required for all I/O
   net::io_context ioc_{1};
+  net::io_context admin_ioc_{1};
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
-  std::shared_ptr<DecodeResource> decode_resource_;
+  // Each connection takes the current default resource of it, or the one
+  // of the model profile selected by the config
+  std::shared_ptr<ModelRegistry> model_registry_;
+  std::shared_ptr<DecoderPool> decoder_pool_;
   WENET_DISALLOW_COPY_AND_ASSIGN(HttpServer);
 };
 
@@ -284,6 +284,14 @@ class LatticeFasterDecoderTpl {
     config_ = config;
   }
 
+  /// Replaces the context graph (the per session hotwords), the context
+  /// states of the tokens refer to it, so it must be followed by
+  /// InitDecoding().
+  void set_context_graph(
+      const std::shared_ptr<wenet::ContextGraph>& context_graph) {
+    context_graph_ = context_graph;
+  }
+
   const LatticeFasterDecoderConfig& GetOptions() const { return config_; }
 
   ~LatticeFasterDecoderTpl();
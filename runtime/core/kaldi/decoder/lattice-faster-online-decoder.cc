@@ -24,10 +24,14 @@
 // see note at the top of lattice-faster-decoder.cc, about how to maintain this
 // file in sync with lattice-faster-decoder.cc
 
+#include <functional>
 #include <limits>
 #include <queue>
+#include <set>
+#include <tuple>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "decoder/lattice-faster-online-decoder.h"
 
@@ -176,6 +180,203 @@ LatticeFasterOnlineDecoderTpl<FST>::TraceBackBestPath(BestPathIterator iter,
   return BestPathIterator(tok->backpointer, cur_t + step_t);
 }
 
+template <typename FST>
+bool LatticeFasterOnlineDecoderTpl<FST>::GetNBestPaths(
+    int32 n, Label blank, std::vector<Lattice>* nbest_lats,
+    bool use_final_probs, int32 max_expansions) const {
+  KALDI_ASSERT(nbest_lats != NULL && n > 0);
+  nbest_lats->clear();
+  if (this->decoding_finalized_ && !use_final_probs)
+    KALDI_ERR << "You cannot call FinalizeDecoding() and then call "
+              << "GetNBestPaths() with use_final_probs == false";
+
+  unordered_map<Token*, BaseFloat> final_costs_local;
+
+  const unordered_map<Token*, BaseFloat>& final_costs =
+      (this->decoding_finalized_ ? this->final_costs_ : final_costs_local);
+  if (!this->decoding_finalized_ && use_final_probs)
+    this->ComputeFinalCosts(&final_costs_local, NULL, NULL);
+
+  int32 num_frames = this->active_toks_.size() - 1;
+  KALDI_ASSERT(num_frames > 0);
+
+  // Links are traversed backward in the search, so collect the incoming links
+  // of the tokens, together with the forward costs (the cost of the best path
+  // from the start token) in the same pass.  Costs here are the same as the
+  // ones of GetRawLattice(), i.e. without the cost offsets.
+  struct InLink {
+    Token* tok;  // source token
+    ForwardLinkT* link;
+    int32 frame;  // frame of the source token
+  };
+  const int32 bucket_count = this->num_toks_ / 2 + 3;
+  unordered_map<Token*, BaseFloat> forward_costs(bucket_count);
+  unordered_map<Token*, std::vector<InLink> > in_links(bucket_count);
+  Token* start_tok = NULL;
+  std::vector<Token*> token_list;
+  for (int32 f = 0; f <= num_frames; f++) {
+    if (this->active_toks_[f].toks == NULL) {
+      KALDI_WARN << "GetNBestPaths: no tokens active on frame " << f;
+      return false;
+    }
+    this->TopSortTokens(this->active_toks_[f].toks, &token_list);
+    for (size_t i = 0; i < token_list.size(); i++) {
+      Token* tok = token_list[i];
+      if (tok == NULL) continue;
+      if (start_tok == NULL) {  // the first one after topological sorting
+        start_tok = tok;
+        forward_costs[tok] = 0.0;
+      }
+      typename unordered_map<Token*, BaseFloat>::const_iterator iter =
+          forward_costs.find(tok);
+      if (iter == forward_costs.end()) continue;  // not reachable
+      BaseFloat forward_cost = iter->second;
+      for (ForwardLinkT* l = tok->links; l != NULL; l = l->next) {
+        BaseFloat cost_offset =
+            (l->ilabel != 0 ? this->cost_offsets_[f] : 0.0);
+        BaseFloat cost =
+            forward_cost + l->graph_cost + l->acoustic_cost - cost_offset;
+        typename unordered_map<Token*, BaseFloat>::iterator next_iter =
+            forward_costs.find(l->next_tok);
+        if (next_iter == forward_costs.end()) {
+          forward_costs[l->next_tok] = cost;
+        } else if (cost < next_iter->second) {
+          next_iter->second = cost;
+        }
+        in_links[l->next_tok].push_back({tok, l, f});
+      }
+    }
+  }
+
+  // The partial paths share their suffixes, which are stored as a tree of
+  // nodes pointing towards the end of the utterance.
+  struct PathNode {
+    ForwardLinkT* link;
+    int32 frame;
+    int32 next;  // -1 means the end
+  };
+  struct PartialPath {
+    BaseFloat cost;  // cost of the suffix plus the forward cost of tok
+    BaseFloat suffix_cost;
+    BaseFloat final_cost;
+    Token* tok;
+    int32 node;
+    // The first emitting label of the suffix and the id of the input label
+    // sequence of the suffix, a repeated label is merged only if it is the
+    // same as the first label of the suffix
+    Label first_label;
+    int32 label_seq_id;
+    bool operator>(const PartialPath& other) const {
+      return cost > other.cost;
+    }
+  };
+  std::vector<PathNode> nodes;
+  std::priority_queue<PartialPath, std::vector<PartialPath>,
+                      std::greater<PartialPath> >
+      path_queue;
+  for (Token* tok = this->active_toks_[num_frames].toks; tok != NULL;
+       tok = tok->next) {
+    typename unordered_map<Token*, BaseFloat>::const_iterator iter =
+        forward_costs.find(tok);
+    if (iter == forward_costs.end()) continue;
+    BaseFloat final_cost = 0.0;
+    if (use_final_probs && !final_costs.empty()) {
+      typename unordered_map<Token*, BaseFloat>::const_iterator final_iter =
+          final_costs.find(tok);
+      if (final_iter == final_costs.end()) continue;
+      final_cost = final_iter->second;
+    }
+    path_queue.push({iter->second + final_cost, final_cost, final_cost, tok,
+                     -1, 0, 0});
+  }
+
+  // The deduplicated input label sequences of the suffixes are interned as
+  // a tree, keyed by (id of the rest of the sequence, first label), so equal
+  // ids mean equal sequences. 0 is the empty sequence.
+  unordered_map<uint64, int32> label_seq_ids;
+  // A suffix is dominated by the one popped earlier if they start from the
+  // same token with the same first label and input label sequence, since any
+  // prefix results in the same deduplicated sequence with a worse cost.
+  std::set<std::tuple<Token*, Label, int32> > expanded;
+  std::set<std::vector<Label> > label_seqs;
+  int32 num_expansions = 0;
+  while (!path_queue.empty() &&
+         static_cast<int32>(nbest_lats->size()) < n &&
+         num_expansions < max_expansions) {
+    PartialPath path = path_queue.top();
+    path_queue.pop();
+    if (!expanded.insert(std::make_tuple(path.tok, path.first_label,
+                                         path.label_seq_id))
+             .second) {
+      continue;
+    }
+    num_expansions++;
+    if (path.tok == start_tok) {
+      // A complete path, convert it to linear lattice
+      Lattice lat;
+      std::vector<Label> label_seq;
+      Label prev_label = 0;
+      StateId state = lat.AddState();
+      lat.SetStart(state);
+      for (int32 i = path.node; i >= 0; i = nodes[i].next) {
+        const ForwardLinkT* l = nodes[i].link;
+        BaseFloat cost_offset =
+            (l->ilabel != 0 ? this->cost_offsets_[nodes[i].frame] : 0.0);
+        StateId next_state = lat.AddState();
+        lat.AddArc(state,
+                   LatticeArc(l->ilabel, l->olabel,
+                              LatticeWeight(l->graph_cost,
+                                            l->acoustic_cost - cost_offset),
+                              next_state));
+        state = next_state;
+        if (l->ilabel != 0) {
+          if (l->ilabel != blank && l->ilabel != prev_label) {
+            label_seq.push_back(l->ilabel);
+          }
+          prev_label = l->ilabel;
+        }
+      }
+      lat.SetFinal(state, LatticeWeight(path.final_cost, 0.0));
+      if (label_seqs.insert(label_seq).second) {
+        nbest_lats->push_back(std::move(lat));
+      }
+      continue;
+    }
+    typename unordered_map<Token*, std::vector<InLink> >::const_iterator
+        iter = in_links.find(path.tok);
+    if (iter == in_links.end()) continue;
+    for (const InLink& in_link : iter->second) {
+      const ForwardLinkT* l = in_link.link;
+      BaseFloat cost_offset =
+          (l->ilabel != 0 ? this->cost_offsets_[in_link.frame] : 0.0);
+      BaseFloat suffix_cost =
+          path.suffix_cost + l->graph_cost + l->acoustic_cost - cost_offset;
+      Label first_label = path.first_label;
+      int32 label_seq_id = path.label_seq_id;
+      if (l->ilabel != 0) {
+        if (l->ilabel != blank && l->ilabel != path.first_label) {
+          uint64 key = (static_cast<uint64>(label_seq_id) << 32) |
+                       static_cast<uint32>(l->ilabel);
+          label_seq_id =
+              label_seq_ids.emplace(key, label_seq_ids.size() + 1)
+                  .first->second;
+        }
+        first_label = l->ilabel;
+      }
+      nodes.push_back({in_link.link, in_link.frame, path.node});
+      path_queue.push({suffix_cost + forward_costs[in_link.tok], suffix_cost,
+                       path.final_cost, in_link.tok,
+                       static_cast<int32>(nodes.size() - 1), first_label,
+                       label_seq_id});
+    }
+  }
+  if (num_expansions >= max_expansions) {
+    KALDI_VLOG(2) << "GetNBestPaths: stopped after " << num_expansions
+                  << " expansions with " << nbest_lats->size() << " paths";
+  }
+  return !nbest_lats->empty();
+}
+
 template <typename FST>
 bool LatticeFasterOnlineDecoderTpl<FST>::GetRawLatticePruned(
     Lattice* ofst, bool use_final_probs, BaseFloat beam) const {
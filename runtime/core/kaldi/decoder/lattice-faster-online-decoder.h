@@ -29,6 +29,7 @@
 #include "decoder/lattice-faster-decoder.h"
 
 #include <memory>
+#include <vector>
 
 namespace kaldi {
 
@@ -113,6 +114,19 @@ class LatticeFasterOnlineDecoderTpl
   BestPathIterator TraceBackBestPath(BestPathIterator iter,
                                      LatticeArc* arc) const;
 
+  /// Outputs the n-best paths as linear lattices directly from the token
+  /// graph, which avoids the lattice determinization in GetLattice().  The
+  /// paths are traced back from the final tokens by A* search, where the
+  /// forward costs of the tokens are the exact heuristic, so they come out in
+  /// the order of their costs.  The paths with the same input label sequence
+  /// (after merging the repeated labels and removing the `blank` label, as
+  /// for CTC) are deduplicated, only the best one is kept.  The search stops
+  /// after expanding `max_expansions` partial paths, so there may be less
+  /// than n paths.  Returns true if result is nonempty.
+  bool GetNBestPaths(int32 n, Label blank, std::vector<Lattice>* nbest_lats,
+                     bool use_final_probs = true,
+                     int32 max_expansions = 100000) const;
+
   /// Behaves the same as GetRawLattice but only processes tokens whose
   /// extra_cost is smaller than the best-cost plus the specified beam.
   /// It is only worthwhile to call this function if beam is less than
@@ -0,0 +1,196 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/asr_decoder.h"
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Blank frames but the frames of the units, where unit 1 ("a") and unit 2
+// ("b") are close, so the nbest is of several hypotheses. The attention
+// rescoring prefers "b".
+class FakeAsrModel : public wenet::AsrModel {
+ public:
+  FakeAsrModel() {
+    subsampling_rate_ = 1;
+    right_context_ = 0;
+    sos_ = eos_ = 3;
+  }
+  int num_rescoring_frames() const override { return rescoring_frames_; }
+  void Reset() override {
+    offset_ = 0;
+    rescoring_frames_ = 0;
+    last_frame_blank_ = false;
+    cached_feature_.clear();
+  }
+  void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score) override {
+    rescoring_score->resize(hyps.size());
+    for (size_t i = 0; i < hyps.size(); ++i) {
+      float score = -1.0;
+      for (int unit : hyps[i]) score -= unit == 2 ? 0.5 : 1.0;
+      (*rescoring_score)[i] = score;
+    }
+  }
+  std::shared_ptr<wenet::AsrModel> Copy() const override {
+    return std::make_shared<FakeAsrModel>(*this);
+  }
+
+ protected:
+  void ForwardEncoderFunc(
+      const std::vector<std::vector<float>>& chunk_feats,
+      std::vector<std::vector<float>>* ctc_prob) override {
+    int num_frames = chunk_feats.size();
+    ctc_prob->resize(num_frames);
+    std::vector<float> blank_logp(num_frames);
+    for (int i = 0; i < num_frames; ++i) {
+      int frame = offset_ + i;
+      std::vector<float>& logp = (*ctc_prob)[i];
+      if (frame == 4 || frame == 16) {
+        logp = {std::log(0.05f), std::log(0.5f), std::log(0.44f),
+                std::log(0.01f)};
+      } else if (frame == 10) {
+        logp = {std::log(0.05f), std::log(0.44f), std::log(0.5f),
+                std::log(0.01f)};
+      } else {
+        logp = {std::log(0.997f), std::log(0.001f), std::log(0.001f),
+                std::log(0.001f)};
+      }
+      blank_logp[i] = logp[0];
+    }
+    // The kept encoder frames, see set_rescoring_blank_thresh()
+    std::vector<int> frames;
+    SelectRescoringFrames(blank_logp, &frames);
+    rescoring_frames_ += frames.size();
+    offset_ += num_frames;
+  }
+
+ private:
+  int rescoring_frames_ = 0;
+};
+
+class AsrDecoderTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    resource_ = std::make_shared<wenet::DecodeResource>();
+    resource_->model = std::make_shared<FakeAsrModel>();
+    auto unit_table = std::make_shared<fst::SymbolTable>();
+    unit_table->AddSymbol("<blank>", 0);
+    unit_table->AddSymbol("a", 1);
+    unit_table->AddSymbol("b", 2);
+    unit_table->AddSymbol("<sos/eos>", 3);
+    resource_->unit_table = unit_table;
+    resource_->symbol_table = unit_table;
+    decode_config_.chunk_size = 4;
+    decode_config_.rescoring_weight = 1.0;
+  }
+
+  // The final (rescored) results of 0.5s audio of 48 frames
+  std::vector<wenet::DecodeResult> Decode(const wenet::DecodeOptions& opts) {
+    auto feature_pipeline =
+        std::make_shared<wenet::FeaturePipeline>(feature_config_);
+    wenet::AsrDecoder decoder(feature_pipeline, resource_, opts);
+    std::vector<int16_t> audio(8000, 0);
+    feature_pipeline->AcceptWaveform(audio.data(), audio.size());
+    feature_pipeline->set_input_finished();
+    while (decoder.Decode() != wenet::DecodeState::kEndFeats) {
+    }
+    decoder.Rescoring();
+    return decoder.result();
+  }
+
+  void ExpectSameResults(const std::vector<wenet::DecodeResult>& expected,
+                         const std::vector<wenet::DecodeResult>& results) {
+    ASSERT_EQ(results.size(), expected.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+      EXPECT_EQ(results[i].sentence, expected[i].sentence);
+      EXPECT_FLOAT_EQ(results[i].score, expected[i].score);
+    }
+  }
+
+  wenet::FeaturePipelineConfig feature_config_{80, 16000};
+  wenet::DecodeOptions decode_config_;
+  std::shared_ptr<wenet::DecodeResource> resource_;
+};
+
+}  // namespace
+
+TEST_F(AsrDecoderTest, BackgroundRescoringTest) {
+  decode_config_.rescoring_blank_thresh = 0.9;
+  std::vector<wenet::DecodeResult> expected = Decode(decode_config_);
+  ASSERT_GT(expected.size(), 1);
+
+  wenet::RescoringStats& stats = wenet::AsrDecoder::rescoring_stats();
+  int64_t num_background = stats.num_background;
+  int64_t num_cached_hyps = stats.num_cached_hyps;
+  wenet::DecodeOptions background_config = decode_config_;
+  background_config.rescoring_interval = 2;
+  ExpectSameResults(expected, Decode(background_config));
+  EXPECT_GT(stats.num_background, num_background);
+  // The trailing blank frames are merged, so the nbest rescored in the
+  // background after the last unit is reused at the end
+  EXPECT_GT(stats.num_cached_hyps, num_cached_hyps);
+}
+
+TEST_F(AsrDecoderTest, PipelinedSearchTest) {
+  std::vector<wenet::DecodeResult> expected = Decode(decode_config_);
+  ASSERT_GT(expected.size(), 1);
+
+  // The search of each chunk overlaps the encoder of the next one
+  wenet::DecodeOptions pipelined_config = decode_config_;
+  pipelined_config.pipelined_search = true;
+  ExpectSameResults(expected, Decode(pipelined_config));
+  // And the background rescoring as well
+  pipelined_config.rescoring_interval = 2;
+  ExpectSameResults(expected, Decode(pipelined_config));
+}
+
+TEST_F(AsrDecoderTest, AdaptiveRescoringTest) {
+  wenet::DecodeOptions ctc_config = decode_config_;
+  ctc_config.rescoring_weight = 0.0;
+  std::vector<wenet::DecodeResult> ctc_results = Decode(ctc_config);
+  ASSERT_GT(ctc_results.size(), 2);
+
+  // The best one wins by more than the margin, the ctc results are kept
+  wenet::RescoringStats& stats = wenet::AsrDecoder::rescoring_stats();
+  int64_t num_skipped = stats.num_skipped;
+  wenet::DecodeOptions skip_config = decode_config_;
+  skip_config.rescoring_skip_margin = 1e-3;
+  ExpectSameResults(ctc_results, Decode(skip_config));
+  EXPECT_EQ(stats.num_skipped, num_skipped + 1);
+
+  // Only the best one is rescored, the pruned ones stay below it in the
+  // order and by the gaps of their ctc scores
+  int64_t num_pruned_hyps = stats.num_pruned_hyps;
+  wenet::DecodeOptions prune_config = decode_config_;
+  prune_config.rescoring_prune_beam = 1e-3;
+  std::vector<wenet::DecodeResult> results = Decode(prune_config);
+  ASSERT_EQ(results.size(), ctc_results.size());
+  EXPECT_EQ(stats.num_pruned_hyps, num_pruned_hyps + results.size() - 1);
+  for (size_t i = 0; i < results.size(); ++i) {
+    EXPECT_EQ(results[i].sentence, ctc_results[i].sentence);
+  }
+  for (size_t i = 2; i < results.size(); ++i) {
+    EXPECT_NEAR(results[i].score - results[1].score,
+                ctc_results[i].score - ctc_results[1].score, 1e-4);
+  }
+}
@@ -0,0 +1,123 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/asr_model.h"
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+class FakeAsrModel : public wenet::AsrModel {
+ public:
+  FakeAsrModel(int subsampling_rate, int right_context, int chunk_size) {
+    subsampling_rate_ = subsampling_rate;
+    right_context_ = right_context;
+    chunk_size_ = chunk_size;
+  }
+  void Reset() override {}
+  void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score) override {}
+  std::shared_ptr<wenet::AsrModel> Copy() const override { return nullptr; }
+  // The range of the positions read from the positional encoding of the
+  // encoders, which is [offset - cache frames, offset + chunk frames)
+  int min_position() const { return min_position_; }
+  int max_position() const { return max_position_; }
+
+ protected:
+  // It advances the offset as the real models, with the attention cache of
+  // all the previous frames or the last max_att_cache_frames frames
+  void ForwardEncoderFunc(
+      const std::vector<std::vector<float>>& chunk_feats,
+      std::vector<std::vector<float>>* ctc_prob) override {
+    int num_frames =
+        num_output_frames(cached_feature_.size() + chunk_feats.size());
+    int cache_frames = offset_;
+    if (max_att_cache_frames_ > 0) {
+      cache_frames = std::min(cache_frames, max_att_cache_frames_);
+    }
+    min_position_ = std::min(min_position_, encoder_offset() - cache_frames);
+    max_position_ = std::max(max_position_, encoder_offset() + num_frames);
+    ctc_prob->resize(num_frames);
+    offset_ += num_frames;
+  }
+
+ private:
+  int min_position_ = 0;
+  int max_position_ = 0;
+};
+
+// Output length of the convolutions of the subsampling layers of wenet
+int ConvSubsampledFrames(int num_frames, int subsampling_rate) {
+  switch (subsampling_rate) {
+    case 4:  // Conv2dSubsampling4, two 3x3 convs with stride 2
+      return ((num_frames - 1) / 2 - 1) / 2;
+    case 6:  // Conv2dSubsampling6, 3x3 stride 2, 5x5 stride 3
+      return ((num_frames - 1) / 2 - 2) / 3;
+    case 8:  // Conv2dSubsampling8, three 3x3 convs with stride 2
+      return (((num_frames - 1) / 2 - 1) / 2 - 1) / 2;
+  }
+  return -1;
+}
+
+}  // namespace
+
+TEST(AsrModelTest, NumOutputFramesTest) {
+  const int chunk_size = 16;
+  // (subsampling_rate, right_context) of the subsampling layers
+  for (auto config : {std::make_pair(4, 6), std::make_pair(6, 10),
+                      std::make_pair(8, 14)}) {
+    FakeAsrModel model(config.first, config.second, chunk_size);
+    // A full chunk
+    EXPECT_EQ(model.num_output_frames(model.num_frames_for_chunk(false)),
+              chunk_size);
+    // The final partial chunks, and the ones too short for any output
+    for (int num_frames = 1; num_frames <= model.num_frames_for_chunk(false);
+         ++num_frames) {
+      EXPECT_EQ(model.num_output_frames(num_frames),
+                std::max(ConvSubsampledFrames(num_frames, config.first), 0))
+          << "subsampling_rate " << config.first << " num_frames "
+          << num_frames;
+    }
+  }
+}
+
+TEST(AsrModelTest, SlidingWindowEncoderOffsetTest) {
+  // max_len of the positional encoding of the encoders
+  const int max_len = 5000;
+  const int chunk_size = 16;
+  FakeAsrModel model(4, 6, chunk_size);
+  model.set_max_att_cache_frames(4 * chunk_size);
+  std::vector<std::vector<float>> chunk_feats(
+      model.num_frames_for_chunk(true), std::vector<float>(80, 0.0));
+  std::vector<std::vector<float>> ctc_prob;
+  while (model.offset() <= 2 * max_len) {
+    model.ForwardEncoder(chunk_feats, &ctc_prob);
+    ASSERT_FALSE(ctc_prob.empty());
+  }
+  // The positions are relative to the window rather than the stream
+  EXPECT_EQ(model.encoder_offset(), 4 * chunk_size);
+  EXPECT_GE(model.min_position(), 0);
+  EXPECT_LE(model.max_position(), 5 * chunk_size);
+
+  // Unbounded without the window
+  model.set_max_att_cache_frames(-1);
+  EXPECT_EQ(model.encoder_offset(), model.offset());
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/context_graph_cache.h"
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+class ContextGraphCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    unit_table_ = std::make_shared<fst::SymbolTable>();
+    unit_table_->AddSymbol("<blank>", 0);
+    unit_table_->AddSymbol("你", 1);
+    unit_table_->AddSymbol("好", 2);
+    unit_table_->AddSymbol("世", 3);
+    unit_table_->AddSymbol("界", 4);
+    config_.context_score = 3.0;
+  }
+
+  std::shared_ptr<fst::SymbolTable> unit_table_;
+  wenet::ContextConfig config_;
+};
+
+TEST_F(ContextGraphCacheTest, HitMissAndEvictionTest) {
+  wenet::ContextGraphCache cache(config_, unit_table_, 2);
+  auto world = cache.GetContextGraph({"世界"});
+  ASSERT_NE(world, nullptr);
+  EXPECT_EQ(cache.misses(), 1);
+  // The same list after the normalization
+  EXPECT_EQ(cache.GetContextGraph({" 世界", "世界", ""}), world);
+  EXPECT_EQ(cache.hits(), 1);
+  auto hello_world = cache.GetContextGraph({"好世", "世界"});
+  EXPECT_EQ(cache.GetContextGraph({"世界", "好世"}), hello_world);
+  EXPECT_EQ(cache.hits(), 2);
+  EXPECT_EQ(cache.misses(), 2);
+  // "世界" is used again, so ["世界", "好世"] is the least recently used one
+  // when the third one exceeds the capacity
+  EXPECT_EQ(cache.GetContextGraph({"世界"}), world);
+  cache.GetContextGraph({"你好"});
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.GetContextGraph({"世界"}), world);
+  EXPECT_NE(cache.GetContextGraph({"好世", "世界"}), hello_world);
+  EXPECT_EQ(cache.hits(), 4);
+  EXPECT_EQ(cache.misses(), 4);
+  // No context at all
+  EXPECT_EQ(cache.GetContextGraph({" "}), nullptr);
+  EXPECT_EQ(cache.misses(), 4);
+}
+
+TEST_F(ContextGraphCacheTest, LayeredGlobalContextsTest) {
+  using ::testing::ElementsAre;
+  using ::testing::UnorderedElementsAre;
+  auto global_graph = std::make_shared<wenet::ContextGraph>(config_);
+  global_graph->BuildContextGraph({"你好"}, unit_table_);
+  wenet::ContextGraphCache cache(config_, unit_table_, 2, global_graph);
+  // Nothing beyond the global contexts
+  EXPECT_EQ(cache.GetContextGraph({"你好"}), global_graph);
+  EXPECT_EQ(cache.misses(), 0);
+
+  // Only the request contexts are compiled, and the graph matches both
+  auto context_graph = cache.GetContextGraph({"世界", "你好"});
+  EXPECT_THAT(context_graph->contexts(), ElementsAre("世界"));
+  float score = 0;
+  std::unordered_set<std::string> contexts;
+  int state = 0;
+  for (int unit_id : {1, 2, 3, 4}) {
+    state = context_graph->GetNextState(state, unit_id, &score, &contexts);
+  }
+  EXPECT_EQ(state, 0);
+  EXPECT_FLOAT_EQ(score, 12.0);
+  EXPECT_THAT(contexts, UnorderedElementsAre("你好", "世界"));
+  // Partial match of the request context, then backoff
+  score = 0;
+  state = context_graph->GetNextState(0, 3, &score);
+  EXPECT_GT(state, 0);
+  EXPECT_FALSE(context_graph->IsFinalState(state));
+  state = context_graph->GetNextState(state, fst::kNoLabel, &score);
+  EXPECT_EQ(state, 0);
+  EXPECT_FLOAT_EQ(score, 0.0);
+}
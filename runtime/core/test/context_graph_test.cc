@@ -0,0 +1,203 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/context_graph.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+class ContextGraphTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    unit_table_ = std::make_shared<fst::SymbolTable>();
+    unit_table_->AddSymbol("<blank>", 0);
+    unit_table_->AddSymbol("你", 1);
+    unit_table_->AddSymbol("好", 2);
+    unit_table_->AddSymbol("世", 3);
+    unit_table_->AddSymbol("界", 4);
+    wenet::ContextConfig config;
+    config.context_score = 3.0;
+    context_graph_ = std::make_shared<wenet::ContextGraph>(config);
+    std::vector<std::string> contexts = {"你好", "好世"};
+    context_graph_->BuildContextGraph(contexts, unit_table_);
+  }
+
+  std::shared_ptr<fst::SymbolTable> unit_table_;
+  std::shared_ptr<wenet::ContextGraph> context_graph_;
+};
+
+TEST_F(ContextGraphTest, MatchAndFallbackTest) {
+  using ::testing::UnorderedElementsAre;
+  float score = 0;
+  std::unordered_set<std::string> contexts;
+  int state = context_graph_->GetNextState(0, 1, &score, &contexts);
+  EXPECT_GT(state, 0);
+  EXPECT_FLOAT_EQ(score, 3.0);
+  // "你好" is matched, and the state falls back to "好" later
+  state = context_graph_->GetNextState(state, 2, &score, &contexts);
+  EXPECT_GT(state, 0);
+  EXPECT_TRUE(context_graph_->IsFinalState(state));
+  EXPECT_FLOAT_EQ(score, 6.0);
+  // "好世" is matched by the fallback arc, and the leaf goes back to start
+  state = context_graph_->GetNextState(state, 3, &score, &contexts);
+  EXPECT_EQ(state, 0);
+  EXPECT_FLOAT_EQ(score, 9.0);
+  EXPECT_THAT(contexts, UnorderedElementsAre("你好", "好世"));
+}
+
+TEST_F(ContextGraphTest, MismatchAndBackoffTest) {
+  float score = 0;
+  // No arc from the start state
+  int state = context_graph_->GetNextState(0, 4, &score);
+  EXPECT_EQ(state, 0);
+  EXPECT_FLOAT_EQ(score, 0.0);
+  // Partial match, then backoff the context score at the end
+  state = context_graph_->GetNextState(0, 1, &score);
+  EXPECT_FLOAT_EQ(score, 3.0);
+  state = context_graph_->GetNextState(state, fst::kNoLabel, &score);
+  EXPECT_EQ(state, 0);
+  EXPECT_FLOAT_EQ(score, 0.0);
+}
+
+TEST_F(ContextGraphTest, WriteReadTest) {
+  std::string filename = testing::TempDir() + "context_graph.bin";
+  ASSERT_TRUE(context_graph_->Write(filename));
+  wenet::ContextGraph context_graph(wenet::ContextConfig{});
+  ASSERT_TRUE(context_graph.Read(filename));
+  std::remove(filename.c_str());
+  EXPECT_EQ(context_graph.contexts(), context_graph_->contexts());
+  float score = 0;
+  int state = context_graph.GetNextState(0, 1, &score);
+  state = context_graph.GetNextState(state, 2, &score);
+  state = context_graph.GetNextState(state, 3, &score);
+  EXPECT_EQ(state, 0);
+  EXPECT_FLOAT_EQ(score, 9.0);
+}
+
+TEST_F(ContextGraphTest, StaleAndMalformedReadTest) {
+  std::string filename = testing::TempDir() + "context_graph.bin";
+  wenet::ContextGraphSource source;
+  source.context_hash = wenet::ContextGraph::HashContexts({"你好", "好世"});
+  source.num_units = 5;
+  ASSERT_TRUE(context_graph_->Write(filename, source));
+  wenet::ContextConfig config;
+  config.context_score = 3.0;
+  wenet::ContextGraph context_graph(config);
+  EXPECT_TRUE(context_graph.Read(filename, source));
+  // The context list or the unit table changed
+  wenet::ContextGraphSource changed = source;
+  changed.context_hash = wenet::ContextGraph::HashContexts({"你好好世"});
+  EXPECT_FALSE(context_graph.Read(filename, changed));
+  changed = source;
+  changed.num_units = 6;
+  EXPECT_FALSE(context_graph.Read(filename, changed));
+  // The context score changed
+  config.context_score = 2.0;
+  wenet::ContextGraph rescored_graph(config);
+  EXPECT_FALSE(rescored_graph.Read(filename, source));
+
+  // Corrupted tables
+  std::string content;
+  {
+    std::ifstream is(filename, std::ios::binary);
+    content.assign(std::istreambuf_iterator<char>(is),
+                   std::istreambuf_iterator<char>());
+  }
+  std::string corrupted = content;
+  for (size_t i = content.size() / 2; i < content.size(); i += 4) {
+    corrupted[i] = '\x7f';
+  }
+  {
+    std::ofstream os(filename, std::ios::binary);
+    os.write(corrupted.data(), corrupted.size());
+  }
+  EXPECT_FALSE(context_graph.Read(filename, source));
+  // Truncated
+  {
+    std::ofstream os(filename, std::ios::binary);
+    os.write(content.data(), content.size() / 2);
+  }
+  EXPECT_FALSE(context_graph.Read(filename, source));
+  std::remove(filename.c_str());
+}
+
+TEST(UnitTrieTest, SplitTest) {
+  fst::SymbolTable unit_table;
+  unit_table.AddSymbol("<blank>", 0);
+  unit_table.AddSymbol("你", 1);
+  unit_table.AddSymbol("你好", 2);
+  unit_table.AddSymbol("▁HE", 3);
+  unit_table.AddSymbol("LLO", 4);
+  unit_table.AddSymbol("▁", 5);
+  unit_table.AddSymbol("W", 6);
+  wenet::UnitTrie unit_trie(unit_table);
+  std::vector<int> units;
+  // Longest match, and '▁' at the beginning of English word
+  EXPECT_TRUE(unit_trie.Split("你好 HELLO W", &units));
+  EXPECT_EQ(units, std::vector<int>({2, 3, 4, 5, 6}));
+  units.clear();
+  EXPECT_FALSE(unit_trie.Split("好", &units));
+}
+
+TEST_F(ContextGraphTest, SplitContextToUnitsTest) {
+  // By the unit trie the graph is built with
+  std::vector<int> units;
+  EXPECT_TRUE(context_graph_->SplitContextToUnits("世界你好", &units));
+  EXPECT_EQ(units, std::vector<int>({3, 4, 1, 2}));
+}
+
+TEST(ContextGraphFallbackTest, FallbackChainTest) {
+  using ::testing::UnorderedElementsAre;
+  auto unit_table = std::make_shared<fst::SymbolTable>();
+  unit_table->AddSymbol("<blank>", 0);
+  unit_table->AddSymbol("你", 1);
+  unit_table->AddSymbol("好", 2);
+  unit_table->AddSymbol("世", 3);
+  unit_table->AddSymbol("界", 4);
+  unit_table->AddSymbol("的", 5);
+  wenet::ContextConfig config;
+  config.context_score = 3.0;
+  wenet::ContextGraph context_graph(config);
+  context_graph.BuildContextGraph({"你好世的", "好世的", "世界"}, unit_table);
+
+  // "界" is matched after two fallbacks, "你好世" -> "好世" -> "世"
+  float score = 0;
+  std::unordered_set<std::string> contexts;
+  int state = 0;
+  for (int unit_id : {1, 2, 3}) {
+    state = context_graph.GetNextState(state, unit_id, &score, &contexts);
+  }
+  EXPECT_FLOAT_EQ(score, 9.0);
+  state = context_graph.GetNextState(state, 4, &score, &contexts);
+  EXPECT_EQ(state, 0);
+  EXPECT_FLOAT_EQ(score, 6.0);
+  EXPECT_THAT(contexts, UnorderedElementsAre("世界"));
+
+  // "你" is matched from the start state at the end of the fallback chain
+  score = 0;
+  state = 0;
+  for (int unit_id : {1, 2, 3, 1}) {
+    state = context_graph.GetNextState(state, unit_id, &score);
+  }
+  EXPECT_GT(state, 0);
+  EXPECT_FLOAT_EQ(score, 3.0);
+}
@@ -71,3 +71,31 @@ TEST(CtcPrefixBeamSearchTest, CtcPrefixBeamSearchLogicTest) {
   ASSERT_THAT(times[1], ElementsAre(0, 2));
   ASSERT_THAT(times[2], ElementsAre(2));
 }
+
+TEST(CtcPrefixBeamSearchTest, SparseCtcPosteriorTest) {
+  std::vector<std::vector<float>> data = {
+      {0.25, 0.40, 0.35}, {0.40, 0.35, 0.25}, {0.10, 0.50, 0.40}};
+  // The top 3 of each frame in descending order, which covers all the units
+  std::vector<wenet::SparseCtcFrame> sparse_data(data.size());
+  for (int i = 0; i < data.size(); i++) {
+    for (int j = 0; j < data[i].size(); j++) {
+      data[i][j] = std::log(data[i][j]);
+    }
+    std::vector<float> values;
+    std::vector<int32_t> indices;
+    wenet::TopK(data[i], 3, &values, &indices);
+    sparse_data[i].blank_logp = data[i][0];
+    sparse_data[i].values = values;
+    sparse_data[i].indices = indices;
+  }
+  wenet::CtcPrefixBeamSearchOptions option;
+  option.first_beam_size = 3;
+  option.second_beam_size = 3;
+  wenet::CtcPrefixBeamSearch dense_search(option);
+  dense_search.Search(data);
+  wenet::CtcPrefixBeamSearch sparse_search(option);
+  sparse_search.Search(sparse_data);
+  EXPECT_EQ(sparse_search.Outputs(), dense_search.Outputs());
+  EXPECT_EQ(sparse_search.Likelihood(), dense_search.Likelihood());
+  EXPECT_EQ(sparse_search.Times(), dense_search.Times());
+}
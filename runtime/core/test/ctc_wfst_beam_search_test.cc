@@ -0,0 +1,143 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/ctc_wfst_beam_search.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+std::vector<std::vector<float>> LogData() {
+  std::vector<std::vector<float>> data = {{0.22, 0.43, 0.35},
+                                          {0.41, 0.36, 0.23},
+                                          {0.12, 0.51, 0.37},
+                                          {0.58, 0.13, 0.29}};
+  for (auto& frame : data) {
+    for (auto& prob : frame) prob = std::log(prob);
+  }
+  return data;
+}
+
+// The loop of the units without LM, so the score of a path is the one of its
+// alignment, and every alignment is in the token graph
+fst::StdVectorFst UnitLoopFst(int num_units) {
+  fst::StdVectorFst fst;
+  int state = fst.AddState();
+  fst.SetStart(state);
+  fst.SetFinal(state, fst::StdArc::Weight::One());
+  // The input labels are the units + 1, 0 is epsilon
+  for (int unit = 0; unit < num_units; ++unit) {
+    fst.AddArc(state, fst::StdArc(unit + 1, 0, 0.0, state));
+  }
+  return fst;
+}
+
+wenet::CtcWfstBeamSearchOptions SearchOptions(int nbest) {
+  wenet::CtcWfstBeamSearchOptions opts;
+  opts.nbest = nbest;
+  opts.blank_skip_thresh = 1.0;
+  // Wide enough to keep all the alignments
+  opts.beam = 100.0;
+  opts.lattice_beam = 100.0;
+  return opts;
+}
+
+}  // namespace
+
+TEST(CtcWfstBeamSearchTest, NBestPathsTest) {
+  using ::testing::ElementsAre;
+  fst::StdVectorFst fst = UnitLoopFst(3);
+  wenet::CtcWfstBeamSearch searcher(fst, SearchOptions(5), nullptr);
+  searcher.Search(LogData());
+  searcher.FinalizeSearch();
+  /* The best alignment of each label sequence, the ones of the same
+     sequence, such as "1 0 1 0" and "1 1 0 1" of [1, 1], are merged
+  | top k | inputs | alignment | viterbi score | timestamp |
+  |-------|--------|-----------|---------------|-----------|
+  | top 1 | [1, 1] | 1 0 1 0   | 0.052150      | [0, 2]    |
+  | top 2 | [1]    | 1 1 1 0   | 0.045790      | [0]       |
+  | top 3 | [2, 1] | 2 0 1 0   | 0.042447      | [0, 2]    |
+  | top 4 | [1, 2] | 1 0 2 0   | 0.037834      | [0, 2]    |
+  | top 5 | [2, 2] | 2 0 2 0   | 0.030795      | [0, 2]    |
+  */
+  const std::vector<std::vector<int>>& inputs = searcher.Inputs();
+  ASSERT_EQ(inputs.size(), 5);
+  EXPECT_THAT(inputs[0], ElementsAre(1, 1));
+  EXPECT_THAT(inputs[1], ElementsAre(1));
+  EXPECT_THAT(inputs[2], ElementsAre(2, 1));
+  EXPECT_THAT(inputs[3], ElementsAre(1, 2));
+  EXPECT_THAT(inputs[4], ElementsAre(2, 2));
+
+  const std::vector<float>& likelihood = searcher.Likelihood();
+  ASSERT_EQ(likelihood.size(), 5);
+  EXPECT_NEAR(std::exp(likelihood[0]), 0.43 * 0.41 * 0.51 * 0.58, 1e-6);
+  EXPECT_NEAR(std::exp(likelihood[1]), 0.43 * 0.36 * 0.51 * 0.58, 1e-6);
+  EXPECT_NEAR(std::exp(likelihood[2]), 0.35 * 0.41 * 0.51 * 0.58, 1e-6);
+  EXPECT_NEAR(std::exp(likelihood[3]), 0.43 * 0.41 * 0.37 * 0.58, 1e-6);
+  EXPECT_NEAR(std::exp(likelihood[4]), 0.35 * 0.41 * 0.37 * 0.58, 1e-6);
+
+  const std::vector<std::vector<int>>& times = searcher.Times();
+  ASSERT_EQ(times.size(), 5);
+  EXPECT_THAT(times[0], ElementsAre(0, 2));
+  EXPECT_THAT(times[1], ElementsAre(0));
+}
+
+TEST(CtcWfstBeamSearchTest, ExhaustiveNBestPathsTest) {
+  std::vector<std::vector<float>> data = LogData();
+  int num_frames = data.size();
+  int num_units = data[0].size();
+  // The best score of each label sequence over all the alignments
+  std::map<std::vector<int>, float> best_scores;
+  std::vector<int> alignment(num_frames, 0);
+  while (true) {
+    std::vector<int> labels;
+    float score = 0;
+    for (int t = 0; t < num_frames; ++t) {
+      score += data[t][alignment[t]];
+      if (alignment[t] != 0 && (t == 0 || alignment[t] != alignment[t - 1])) {
+        labels.push_back(alignment[t]);
+      }
+    }
+    auto it = best_scores.find(labels);
+    if (it == best_scores.end() || it->second < score) {
+      best_scores[labels] = score;
+    }
+    int t = 0;
+    while (t < num_frames && ++alignment[t] == num_units) alignment[t++] = 0;
+    if (t == num_frames) break;
+  }
+  std::vector<std::pair<float, std::vector<int>>> expected;
+  for (const auto& item : best_scores) {
+    expected.emplace_back(item.second, item.first);
+  }
+  std::sort(expected.rbegin(), expected.rend());
+
+  const int nbest = 10;
+  fst::StdVectorFst fst = UnitLoopFst(num_units);
+  wenet::CtcWfstBeamSearch searcher(fst, SearchOptions(nbest), nullptr);
+  searcher.Search(data);
+  searcher.FinalizeSearch();
+  ASSERT_EQ(searcher.Inputs().size(), nbest);
+  for (int i = 0; i < nbest; ++i) {
+    EXPECT_EQ(searcher.Inputs()[i], expected[i].second);
+    EXPECT_NEAR(searcher.Likelihood()[i], expected[i].first, 1e-4);
+  }
+}
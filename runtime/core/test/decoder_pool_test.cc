@@ -0,0 +1,193 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/decoder_pool.h"
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+// Blank frames but the middle one, where unit 1 ("a") slightly wins over
+// unit 2 ("b"), so a context of "b" flips the result
+class FakeAsrModel : public wenet::AsrModel {
+ public:
+  FakeAsrModel() {
+    subsampling_rate_ = 1;
+    right_context_ = 0;
+  }
+  void Reset() override {}
+  void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score) override {
+    rescoring_score->assign(hyps.size(), 0.0);
+  }
+  std::shared_ptr<wenet::AsrModel> Copy() const override {
+    return std::make_shared<FakeAsrModel>(*this);
+  }
+
+ protected:
+  void ForwardEncoderFunc(
+      const std::vector<std::vector<float>>& chunk_feats,
+      std::vector<std::vector<float>>* ctc_prob) override {
+    int num_frames = chunk_feats.size();
+    ctc_prob->assign(num_frames, {std::log(0.998f), std::log(0.001f),
+                                  std::log(0.001f)});
+    if (num_frames > 0) {
+      (*ctc_prob)[num_frames / 2] = {std::log(0.05f), std::log(0.5f),
+                                     std::log(0.45f)};
+    }
+  }
+};
+
+class DecoderPoolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    feature_config_ = std::make_shared<wenet::FeaturePipelineConfig>(80, 16000);
+    decode_config_ = std::make_shared<wenet::DecodeOptions>();
+    decode_config_->chunk_size = -1;
+    decode_config_->rescoring_weight = 0.0;
+  }
+
+  // A resource of the word loop of "a" and "b", searched by the WFST decoder
+  std::shared_ptr<wenet::DecodeResource> NewResource() {
+    auto resource = std::make_shared<wenet::DecodeResource>();
+    resource->model = std::make_shared<FakeAsrModel>();
+    auto unit_table = std::make_shared<fst::SymbolTable>();
+    unit_table->AddSymbol("<blank>", 0);
+    unit_table->AddSymbol("a", 1);
+    unit_table->AddSymbol("b", 2);
+    resource->unit_table = unit_table;
+    auto symbol_table = std::make_shared<fst::SymbolTable>();
+    symbol_table->AddSymbol("<eps>", 0);
+    symbol_table->AddSymbol("a", 1);
+    symbol_table->AddSymbol("b", 2);
+    resource->symbol_table = symbol_table;
+    // The input labels are the units + 1, 0 is epsilon
+    auto fst = std::make_shared<fst::StdVectorFst>();
+    int state = fst->AddState();
+    fst->SetStart(state);
+    fst->SetFinal(state, fst::StdArc::Weight::One());
+    fst->AddArc(state, fst::StdArc(1, 0, 0.0, state));
+    fst->AddArc(state, fst::StdArc(2, 1, 0.0, state));
+    fst->AddArc(state, fst::StdArc(3, 2, 0.0, state));
+    resource->fst = fst;
+    resource->context_graph_cache =
+        std::make_shared<wenet::ContextGraphCache>(wenet::ContextConfig(),
+                                                   unit_table);
+    return resource;
+  }
+
+  std::string Decode(wenet::DecoderSession* session) {
+    std::vector<int16_t> audio(8000, 0);
+    session->feature_pipeline->AcceptWaveform(audio.data(), audio.size());
+    session->feature_pipeline->set_input_finished();
+    while (session->decoder->Decode() != wenet::DecodeState::kEndFeats) {
+    }
+    session->decoder->Rescoring();
+    const auto& result = session->decoder->result();
+    return result.empty() ? "" : result[0].sentence;
+  }
+
+  std::shared_ptr<wenet::FeaturePipelineConfig> feature_config_;
+  std::shared_ptr<wenet::DecodeOptions> decode_config_;
+};
+
+}  // namespace
+
+TEST_F(DecoderPoolTest, CapacityTest) {
+  auto pool = std::make_shared<wenet::DecoderPool>(feature_config_,
+                                                   decode_config_, 2);
+  auto resource = NewResource();
+  pool->Prefill(resource, 3);
+  EXPECT_EQ(pool->num_idle(), 2);
+  {
+    std::vector<std::shared_ptr<wenet::DecoderSession>> sessions;
+    for (int i = 0; i < 3; ++i) {
+      sessions.push_back(pool->Acquire(resource, {}));
+    }
+    EXPECT_EQ(pool->num_idle(), 0);
+  }
+  // The released sessions beyond the capacity are dropped
+  EXPECT_EQ(pool->num_idle(), 2);
+}
+
+TEST_F(DecoderPoolTest, WfstSessionContextsTest) {
+  auto pool = std::make_shared<wenet::DecoderPool>(feature_config_,
+                                                   decode_config_, 1);
+  auto resource = NewResource();
+  wenet::AsrDecoder* decoder = nullptr;
+  {
+    auto session = pool->Acquire(resource, {});
+    decoder = session->decoder.get();
+    EXPECT_EQ(Decode(session.get()), " a");
+  }
+  // The pooled session decodes with the contexts of the new request
+  {
+    auto session = pool->Acquire(resource, {"b"});
+    EXPECT_EQ(session->decoder.get(), decoder);
+    EXPECT_EQ(Decode(session.get()), " b");
+  }
+  // And without them again
+  {
+    auto session = pool->Acquire(resource, {});
+    EXPECT_EQ(session->decoder.get(), decoder);
+    EXPECT_EQ(Decode(session.get()), " a");
+  }
+}
+
+TEST_F(DecoderPoolTest, RetiredResourceTest) {
+  auto pool = std::make_shared<wenet::DecoderPool>(feature_config_,
+                                                   decode_config_, 2);
+  auto old_resource = NewResource();
+  pool->Prefill(old_resource, 2);
+  auto session = pool->Acquire(old_resource, {});
+  EXPECT_EQ(pool->num_idle(), 1);
+  // Swapped out by a reload, the idle sessions of it are dropped
+  auto new_resource = NewResource();
+  pool->Prefill(new_resource, 1);
+  pool->Retire(old_resource);
+  EXPECT_EQ(pool->num_idle(), 1);
+  // And the live one is dropped at release, not kept in the place of the
+  // current ones
+  session = nullptr;
+  EXPECT_EQ(pool->num_idle(), 1);
+  session = pool->Acquire(new_resource, {});
+  EXPECT_EQ(pool->num_idle(), 0);
+  session = nullptr;
+  EXPECT_EQ(pool->num_idle(), 1);
+}
+
+TEST_F(DecoderPoolTest, ProfileConfigsTest) {
+  auto pool = std::make_shared<wenet::DecoderPool>(feature_config_,
+                                                   decode_config_, 2);
+  // The sessions of a model profile are built with its own configs
+  auto profile_resource = NewResource();
+  profile_resource->feature_config =
+      std::make_shared<wenet::FeaturePipelineConfig>(40, 8000);
+  profile_resource->decode_config =
+      std::make_shared<wenet::DecodeOptions>(*decode_config_);
+  auto session = pool->Acquire(profile_resource, {});
+  EXPECT_EQ(session->feature_pipeline->config().num_bins, 40);
+  EXPECT_EQ(session->decode_config, profile_resource->decode_config);
+  // And the others with the ones of the pool
+  auto default_session = pool->Acquire(NewResource(), {});
+  EXPECT_EQ(default_session->feature_pipeline->config().num_bins, 80);
+  EXPECT_EQ(default_session->decode_config, decode_config_);
+}
@@ -0,0 +1,112 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/lookahead_fst.h"
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "decoder/ctc_wfst_beam_search.h"
+
+namespace {
+
+// The loop of the units "<blank>", "a" and "b" to the words 1 ("a") and
+// 2 ("b"), the input labels are the units + 1, 0 is epsilon. The arcs are
+// not sorted by the output label.
+fst::StdVectorFst TL() {
+  fst::StdVectorFst tl;
+  int state = tl.AddState();
+  tl.SetStart(state);
+  tl.SetFinal(state, fst::StdArc::Weight::One());
+  tl.AddArc(state, fst::StdArc(3, 2, 0.0, state));
+  tl.AddArc(state, fst::StdArc(1, 0, 0.0, state));
+  tl.AddArc(state, fst::StdArc(2, 1, 0.0, state));
+  return tl;
+}
+
+// The bigram of the words, "b" is likely, "a" is unlikely and even less so
+// after "b"
+fst::StdVectorFst G() {
+  fst::StdVectorFst g;
+  int start = g.AddState();
+  int after_a = g.AddState();
+  int after_b = g.AddState();
+  g.SetStart(start);
+  for (int state : {start, after_a, after_b}) {
+    g.SetFinal(state, fst::StdArc::Weight::One());
+    g.AddArc(state, fst::StdArc(1, 1, state == after_b ? 4.0 : 1.5, after_a));
+    g.AddArc(state, fst::StdArc(2, 2, 0.3, after_b));
+  }
+  return g;
+}
+
+std::vector<std::vector<float>> LogData() {
+  std::vector<std::vector<float>> data = {{0.21, 0.44, 0.35},
+                                          {0.62, 0.17, 0.21},
+                                          {0.13, 0.52, 0.35},
+                                          {0.57, 0.19, 0.24}};
+  for (auto& frame : data) {
+    for (auto& prob : frame) prob = std::log(prob);
+  }
+  return data;
+}
+
+std::unique_ptr<wenet::CtcWfstBeamSearch> Search(const fst::StdFst& fst) {
+  wenet::CtcWfstBeamSearchOptions opts;
+  opts.nbest = 5;
+  opts.blank_skip_thresh = 1.0;
+  // Wide enough to keep all the alignments
+  opts.beam = 100.0;
+  opts.lattice_beam = 100.0;
+  std::unique_ptr<wenet::CtcWfstBeamSearch> searcher(
+      new wenet::CtcWfstBeamSearch(fst, opts, nullptr));
+  searcher->Search(LogData());
+  searcher->FinalizeSearch();
+  return searcher;
+}
+
+}  // namespace
+
+TEST(LookAheadFstTest, ComposeLookAheadFstTest) {
+  using ::testing::ElementsAre;
+  fst::StdVectorFst tl = TL();
+  fst::StdVectorFst g = G();
+  // The static TLG as the reference
+  fst::StdVectorFst sorted_tl(tl);
+  fst::ArcSort(&sorted_tl, fst::OLabelCompare<fst::StdArc>());
+  fst::StdVectorFst tlg;
+  fst::Compose(sorted_tl, g, &tlg);
+
+  auto lookahead_tl = wenet::ConvertToLookAheadFst(tl);
+  ASSERT_NE(lookahead_tl, nullptr);
+  std::shared_ptr<fst::StdFst> lookahead_tlg =
+      wenet::ComposeLookAheadFst(*lookahead_tl, &g);
+  ASSERT_NE(lookahead_tlg, nullptr);
+
+  auto expected = Search(tlg);
+  auto searcher = Search(*lookahead_tlg);
+  // "a a" by the ctc posteriors, but "b b" with G
+  ASSERT_FALSE(expected->Outputs().empty());
+  EXPECT_THAT(expected->Outputs()[0], ElementsAre(2, 2));
+  EXPECT_EQ(searcher->Inputs(), expected->Inputs());
+  EXPECT_EQ(searcher->Outputs(), expected->Outputs());
+  ASSERT_EQ(searcher->Likelihood().size(), expected->Likelihood().size());
+  for (size_t i = 0; i < expected->Likelihood().size(); ++i) {
+    EXPECT_NEAR(searcher->Likelihood()[i], expected->Likelihood()[i], 1e-4);
+  }
+}
@@ -0,0 +1,93 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/model_registry.h"
+
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+const int64_t kProfileBytes = 100 << 20;
+
+std::shared_ptr<wenet::ResourceManager> NewManager() {
+  return std::make_shared<wenet::ResourceManager>(
+      std::make_shared<wenet::DecodeResource>(),
+      []() { return std::make_shared<wenet::DecodeResource>(); });
+}
+
+class ModelRegistryTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    // Each loading takes kProfileBytes, the broken flagfiles fail
+    auto factory = [this](const std::string& flagfile)
+        -> std::shared_ptr<wenet::ResourceManager> {
+      if (flagfile == "throw.flags") {
+        throw std::runtime_error("Failed to read fst");
+      }
+      if (flagfile == "null.flags") return nullptr;
+      memory_ += kProfileBytes;
+      auto manager = NewManager();
+      loaded_[flagfile] = manager->resource();
+      return manager;
+    };
+    registry_ = std::make_shared<wenet::ModelRegistry>(
+        NewManager(), factory, kProfileBytes * 5 / 2,
+        [this](const std::shared_ptr<wenet::DecodeResource>& r) {
+          retired_.push_back(r);
+        },
+        [this]() { return memory_; });
+    for (std::string name : {"a", "b", "c", "throw", "null"}) {
+      registry_->AddProfile(name, name + ".flags");
+    }
+  }
+
+  int64_t memory_ = 0;
+  std::map<std::string, std::shared_ptr<wenet::DecodeResource>> loaded_;
+  std::vector<std::shared_ptr<wenet::DecodeResource>> retired_;
+  std::shared_ptr<wenet::ModelRegistry> registry_;
+};
+
+}  // namespace
+
+TEST_F(ModelRegistryTest, LruEvictionTest) {
+  EXPECT_EQ(registry_->resource("a"), loaded_["a.flags"]);
+  EXPECT_EQ(registry_->resource("b"), loaded_["b.flags"]);
+  EXPECT_EQ(registry_->num_loaded(), 2);
+  // "b" is the least recently used one when "c" exceeds the budget
+  EXPECT_EQ(registry_->resource("a"), loaded_["a.flags"]);
+  EXPECT_EQ(registry_->resource("c"), loaded_["c.flags"]);
+  EXPECT_EQ(registry_->num_loaded(), 2);
+  EXPECT_THAT(retired_, ::testing::ElementsAre(loaded_["b.flags"]));
+  // It's loaded again at its next session
+  EXPECT_EQ(registry_->resource("b"), loaded_["b.flags"]);
+  EXPECT_EQ(memory_, 4 * kProfileBytes);
+  EXPECT_EQ(registry_->num_loaded(), 2);
+  EXPECT_EQ(retired_.size(), 2);
+}
+
+TEST_F(ModelRegistryTest, LoadFailureTest) {
+  EXPECT_NE(registry_->resource(), nullptr);
+  EXPECT_EQ(registry_->resource("unknown"), nullptr);
+  EXPECT_EQ(registry_->resource("throw"), nullptr);
+  EXPECT_EQ(registry_->resource("null"), nullptr);
+  EXPECT_EQ(registry_->num_loaded(), 0);
+  EXPECT_TRUE(retired_.empty());
+}
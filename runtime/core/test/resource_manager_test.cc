@@ -0,0 +1,93 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/resource_manager.h"
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+void WaitReload(const wenet::ResourceManager& manager) {
+  while (manager.reloading()) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+}  // namespace
+
+TEST(ResourceManagerTest, SwapWhileLiveTest) {
+  auto old_resource = std::make_shared<wenet::DecodeResource>();
+  auto new_resource = std::make_shared<wenet::DecodeResource>();
+  std::vector<std::shared_ptr<wenet::DecodeResource>> warmed, retired;
+  wenet::ResourceManager manager(
+      old_resource, [new_resource]() { return new_resource; },
+      [&warmed](const std::shared_ptr<wenet::DecodeResource>& r) {
+        warmed.push_back(r);
+      },
+      [&retired](const std::shared_ptr<wenet::DecodeResource>& r) {
+        retired.push_back(r);
+      });
+  // A live session holds the current resource
+  std::shared_ptr<wenet::DecodeResource> live = manager.resource();
+  std::weak_ptr<wenet::DecodeResource> weak_old = old_resource;
+  old_resource = nullptr;
+
+  EXPECT_TRUE(manager.Reload());
+  WaitReload(manager);
+  EXPECT_EQ(manager.generation(), 1);
+  EXPECT_EQ(manager.resource(), new_resource);
+  EXPECT_THAT(warmed, ::testing::ElementsAre(new_resource));
+  // The live session goes on with the old one, which is retired
+  EXPECT_EQ(live, weak_old.lock());
+  EXPECT_THAT(retired, ::testing::ElementsAre(live));
+  // And it's freed after the session
+  live = nullptr;
+  retired.clear();
+  EXPECT_TRUE(weak_old.expired());
+}
+
+TEST(ResourceManagerTest, ReloadFailureTest) {
+  auto resource = std::make_shared<wenet::DecodeResource>();
+  int num_loads = 0;
+  int num_retired = 0;
+  wenet::ResourceManager manager(
+      resource,
+      [&num_loads]() -> std::shared_ptr<wenet::DecodeResource> {
+        // Broken files are reported by exceptions or nullptr
+        if (++num_loads == 1) {
+          throw std::runtime_error("Failed to read fst");
+        }
+        return nullptr;
+      },
+      nullptr,
+      [&num_retired](const std::shared_ptr<wenet::DecodeResource>& r) {
+        num_retired++;
+      });
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(manager.Reload());
+    WaitReload(manager);
+    // The current resource is kept
+    EXPECT_EQ(manager.resource(), resource);
+    EXPECT_EQ(manager.generation(), 0);
+  }
+  EXPECT_EQ(num_loads, 2);
+  EXPECT_EQ(num_retired, 0);
+}
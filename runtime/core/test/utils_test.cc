@@ -14,8 +14,17 @@
 
 #include "utils/utils.h"
 
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "utils/affinity.h"
+#include "utils/compact_buffer.h"
+#include "utils/file.h"
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -30,3 +39,99 @@ TEST(UtilsTest, TopKTest) {
   EXPECT_THAT(values, Pointwise(FloatNear(1e-8), {10, 9, 8}));
   ASSERT_THAT(indices, ElementsAre(9, 4, 8));
 }
+
+TEST(UtilsTest, ParseCpuListTest) {
+  using ::testing::ElementsAre;
+  std::vector<int> cpus;
+  EXPECT_TRUE(wenet::ParseCpuList("0-3,8,10-11\n", &cpus));
+  ASSERT_THAT(cpus, ElementsAre(0, 1, 2, 3, 8, 10, 11));
+  EXPECT_FALSE(wenet::ParseCpuList("", &cpus));
+  EXPECT_FALSE(wenet::ParseCpuList("3-1", &cpus));
+  EXPECT_FALSE(wenet::ParseCpuList("a-b", &cpus));
+}
+
+TEST(UtilsTest, CompactBufferTest) {
+  std::vector<float> data;
+  for (int i = 0; i < 200; ++i) data.push_back((i % 17 - 8) * 0.37f);
+  // Special values of fp16: max, subnormal, overflow
+  data.push_back(65504.0f);
+  data.push_back(3e-6f);
+  data.push_back(70000.0f);
+  std::vector<float> out(data.size());
+
+  wenet::CompactBuffer fp16(wenet::StorageType::kFloat16);
+  fp16.Assign(data.data(), 100);
+  fp16.Append(data.data() + 100, data.size() - 100);
+  EXPECT_EQ(fp16.size(), data.size());
+  EXPECT_EQ(fp16.bytes(), data.size() * 2);
+  fp16.CopyTo(out.data());
+  for (size_t i = 0; i < 200; ++i) EXPECT_NEAR(out[i], data[i], 2e-3);
+  EXPECT_EQ(out[200], 65504.0f);
+  EXPECT_NEAR(out[201], 3e-6f, 6e-8);
+  EXPECT_TRUE(std::isinf(out[202]));
+
+  wenet::CompactBuffer bf16(wenet::StorageType::kBFloat16);
+  bf16.Assign(data.data(), 200);
+  bf16.CopyTo(out.data());
+  for (size_t i = 0; i < 200; ++i) EXPECT_NEAR(out[i], data[i], 2e-2);
+
+  // The partial block is quantized again when appended
+  wenet::CompactBuffer int8(wenet::StorageType::kInt8);
+  int8.Assign(data.data(), 30);
+  int8.Append(data.data() + 30, 170);
+  EXPECT_EQ(int8.size(), 200);
+  int8.CopyTo(out.data());
+  for (size_t i = 0; i < 200; ++i) EXPECT_NEAR(out[i], data[i], 2e-2);
+
+  int8.AssignZeros(10);
+  int8.CopyTo(out.data());
+  for (size_t i = 0; i < 10; ++i) EXPECT_EQ(out[i], 0);
+}
+
+TEST(UtilsTest, FileStampTest) {
+  std::string path = testing::TempDir() + "stamp.txt";
+  std::remove(path.c_str());
+  EXPECT_EQ(wenet::FileStamp(path), "");
+  std::ofstream(path) << "a\n";
+  std::string stamp = wenet::FileStamp(path);
+  EXPECT_NE(stamp, "");
+  EXPECT_EQ(wenet::FileStamp(path), stamp);
+  // Changed within the same second of the modified time
+  std::ofstream(path) << "ab\n";
+  EXPECT_NE(wenet::FileStamp(path), stamp);
+  std::remove(path.c_str());
+}
+
+TEST(UtilsTest, ReadSymbolTableTest) {
+  std::string path = testing::TempDir() + "words.txt";
+  std::string binary_path = testing::TempDir() + "words.bin";
+  std::remove(binary_path.c_str());
+  std::remove((binary_path + ".stamp").c_str());
+  std::ofstream(path) << "a 1\nb 2\n";
+  // The binary copy is written at the first read
+  auto symbol_table = wenet::ReadSymbolTable(path, binary_path);
+  ASSERT_NE(symbol_table, nullptr);
+  EXPECT_EQ(symbol_table->Find("b"), 2);
+  EXPECT_TRUE(wenet::FileExists(binary_path));
+  EXPECT_TRUE(wenet::FileExists(binary_path + ".stamp"));
+
+  // And read instead of the text file while the latter is unchanged
+  fst::SymbolTable other;
+  other.AddSymbol("c", 3);
+  ASSERT_TRUE(other.Write(binary_path));
+  symbol_table = wenet::ReadSymbolTable(path, binary_path);
+  ASSERT_NE(symbol_table, nullptr);
+  EXPECT_EQ(symbol_table->Find("c"), 3);
+
+  // The text file is changed, even in the same second
+  std::ofstream(path, std::ios::app) << "d 4\n";
+  symbol_table = wenet::ReadSymbolTable(path, binary_path);
+  ASSERT_NE(symbol_table, nullptr);
+  EXPECT_EQ(symbol_table->Find("d"), 4);
+  symbol_table = wenet::ReadSymbolTable(path, binary_path);
+  ASSERT_NE(symbol_table, nullptr);
+  EXPECT_EQ(symbol_table->Find("d"), 4);
+  std::remove(path.c_str());
+  std::remove(binary_path.c_str());
+  std::remove((binary_path + ".stamp").c_str());
+}
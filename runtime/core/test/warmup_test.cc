@@ -0,0 +1,101 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "decoder/warmup.h"
+
+#include <cmath>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+namespace {
+
+struct ForwardCounts {
+  int dense = 0;
+  int sparse = 0;
+  int rescoring = 0;
+};
+
+// A model of the sparse top k CTC posterior, which only supports the sparse
+// ForwardEncoder() as the onnx models exported with --ctc_topk
+class FakeSparseAsrModel : public wenet::AsrModel {
+ public:
+  explicit FakeSparseAsrModel(std::shared_ptr<ForwardCounts> counts)
+      : counts_(std::move(counts)) {
+    subsampling_rate_ = 4;
+    right_context_ = 6;
+    sos_ = eos_ = 3;
+  }
+  bool sparse_ctc() const override { return true; }
+  void Reset() override {}
+  void AttentionRescoring(const std::vector<std::vector<int>>& hyps,
+                          float reverse_weight,
+                          std::vector<float>* rescoring_score) override {
+    counts_->rescoring++;
+    rescoring_score->assign(hyps.size(), 0.0);
+  }
+  std::shared_ptr<wenet::AsrModel> Copy() const override {
+    return std::make_shared<FakeSparseAsrModel>(*this);
+  }
+
+ protected:
+  void ForwardEncoderFunc(
+      const std::vector<std::vector<float>>& chunk_feats,
+      std::vector<std::vector<float>>* ctc_prob) override {
+    counts_->dense++;
+  }
+  void ForwardEncoderSparseFunc(
+      const std::vector<std::vector<float>>& chunk_feats,
+      std::vector<wenet::SparseCtcFrame>* ctc_prob) override {
+    counts_->sparse++;
+    int num_frames = num_output_frames(cached_feature_.size() +
+                                       chunk_feats.size());
+    ctc_prob->resize(num_frames);
+    for (auto& frame : *ctc_prob) {
+      frame.blank_logp = std::log(0.9f);
+      frame.values = {std::log(0.9f), std::log(0.06f)};
+      frame.indices = {0, 1};
+    }
+  }
+
+ private:
+  std::shared_ptr<ForwardCounts> counts_;
+};
+
+}  // namespace
+
+TEST(WarmupTest, SparseCtcModelTest) {
+  auto counts = std::make_shared<ForwardCounts>();
+  auto resource = std::make_shared<wenet::DecodeResource>();
+  resource->model = std::make_shared<FakeSparseAsrModel>(counts);
+  auto unit_table = std::make_shared<fst::SymbolTable>();
+  unit_table->AddSymbol("<blank>", 0);
+  unit_table->AddSymbol("a", 1);
+  unit_table->AddSymbol("b", 2);
+  unit_table->AddSymbol("<sos/eos>", 3);
+  resource->unit_table = unit_table;
+  resource->symbol_table = unit_table;
+  wenet::FeaturePipelineConfig feature_config(80, 16000);
+  wenet::DecodeOptions decode_config;
+  decode_config.rescoring_weight = 1.0;
+
+  wenet::WarmupDecodeResource(feature_config, decode_config, resource);
+  // Both the decoding and the rescoring passes use the sparse posterior
+  EXPECT_EQ(counts->dense, 0);
+  EXPECT_GT(counts->sparse, 0);
+  EXPECT_GT(counts->rescoring, 0);
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/affinity.h"
+
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "utils/log.h"
+#include "utils/string.h"
+
+namespace wenet {
+
+bool ParseCpuList(const std::string& cpu_list, std::vector<int>* cpus) {
+  cpus->clear();
+  std::vector<std::string> ranges;
+  SplitStringToVector(Trim(cpu_list), ",", true, &ranges);
+  for (const std::string& range : ranges) {
+    size_t pos = range.find('-');
+    try {
+      int first = std::stoi(range.substr(0, pos));
+      int last = pos == std::string::npos ? first
+                                          : std::stoi(range.substr(pos + 1));
+      if (first < 0 || last < first) return false;
+      for (int cpu = first; cpu <= last; ++cpu) cpus->push_back(cpu);
+    } catch (const std::exception&) {
+      return false;
+    }
+  }
+  return !cpus->empty();
+}
+
+std::vector<NumaNode> GetNumaNodes() {
+  std::vector<NumaNode> nodes;
+#ifdef __linux__
+  std::string online;
+  std::ifstream is("/sys/devices/system/node/online");
+  std::vector<int> node_ids;
+  if (std::getline(is, online) && ParseCpuList(online, &node_ids)) {
+    for (int id : node_ids) {
+      std::ifstream cpu_is("/sys/devices/system/node/node" +
+                           std::to_string(id) + "/cpulist");
+      std::string cpu_list;
+      NumaNode node;
+      node.id = id;
+      // The memory only nodes have no cpus
+      if (std::getline(cpu_is, cpu_list) &&
+          ParseCpuList(cpu_list, &node.cpus)) {
+        nodes.emplace_back(std::move(node));
+      }
+    }
+  }
+#endif
+  if (nodes.empty()) {
+    NumaNode node;
+    int num_cpus = std::max(1u, std::thread::hardware_concurrency());
+    for (int i = 0; i < num_cpus; ++i) node.cpus.push_back(i);
+    nodes.emplace_back(std::move(node));
+  }
+  return nodes;
+}
+
+bool SetThreadAffinity(const std::vector<int>& cpus) {
+#ifdef __linux__
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpu_set);
+  }
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (ret != 0) {
+    LOG(WARNING) << "Failed to set the thread affinity, error " << ret;
+  }
+  return ret == 0;
+#else
+  return false;
+#endif
+}
+
+}  // namespace wenet
@@ -0,0 +1,42 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_AFFINITY_H_
+#define UTILS_AFFINITY_H_
+
+#include <string>
+#include <vector>
+
+namespace wenet {
+
+struct NumaNode {
+  int id = 0;
+  std::vector<int> cpus;
+};
+
+// Parse the cpu list of sysfs, such as "0-3,8-11", return false if it is
+// malformed
+bool ParseCpuList(const std::string& cpu_list, std::vector<int>* cpus);
+
+// The NUMA nodes with cpus of the machine, read from sysfs on Linux. It is
+// one node of all the cpus if the topology is unknown.
+std::vector<NumaNode> GetNumaNodes();
+
+// Pin the calling thread to cpus, the threads created by it later inherit
+// the affinity. Return false if it fails or it's not supported.
+bool SetThreadAffinity(const std::vector<int>& cpus);
+
+}  // namespace wenet
+
+#endif  // UTILS_AFFINITY_H_
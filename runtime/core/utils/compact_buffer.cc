@@ -0,0 +1,258 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "utils/compact_buffer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__F16C__) && defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace wenet {
+
+namespace {
+
+inline uint32_t FloatBits(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  return x;
+}
+
+inline float BitsToFloat(uint32_t x) {
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+// Round to nearest even, the overflows are inf and the NaNs are kept
+inline uint16_t FloatToHalfScalar(float f) {
+  uint32_t x = FloatBits(f);
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t abs = x & 0x7fffffff;
+  if (abs >= 0x7f800000) {  // inf or NaN
+    return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+  }
+  if (abs >= 0x477ff000) {  // >= 65520, rounded to inf
+    return sign | 0x7c00;
+  }
+  if (abs < 0x38800000) {  // < 2^-14, subnormal half, the unit is 2^-24
+    return sign | static_cast<uint16_t>(std::nearbyint(
+                      BitsToFloat(abs) * 16777216.0f));
+  }
+  // Rebias the exponent from 127 to 15, and round the 13 dropped bits
+  abs += 0xc8000fff + ((abs >> 13) & 1);
+  return sign | static_cast<uint16_t>(abs >> 13);
+}
+
+inline float HalfToFloatScalar(uint16_t h) {
+  uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  if (exp == 0) {  // zero or subnormal
+    return BitsToFloat(sign | FloatBits(mant * (1.0f / 16777216.0f)));
+  }
+  if (exp == 31) {  // inf or NaN
+    return BitsToFloat(sign | 0x7f800000 | (mant << 13));
+  }
+  return BitsToFloat(sign | ((exp + 112) << 23) | (mant << 13));
+}
+
+}  // namespace
+
+bool StringToStorageType(const std::string& str, StorageType* type) {
+  if (str == "fp32") {
+    *type = StorageType::kFloat32;
+  } else if (str == "fp16") {
+    *type = StorageType::kFloat16;
+  } else if (str == "bf16") {
+    *type = StorageType::kBFloat16;
+  } else if (str == "int8") {
+    *type = StorageType::kInt8;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void FloatToHalf(const float* src, size_t size, uint16_t* dst) {
+  size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+  for (; i + 8 <= size; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i),
+                                _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), h);
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  for (; i + 4 <= size; i += 4) {
+    float16x4_t h = vcvt_f16_f32(vld1q_f32(src + i));
+    vst1_u16(dst + i, vreinterpret_u16_f16(h));
+  }
+#endif
+  for (; i < size; ++i) dst[i] = FloatToHalfScalar(src[i]);
+}
+
+void HalfToFloat(const uint16_t* src, size_t size, float* dst) {
+  size_t i = 0;
+#if defined(__F16C__) && defined(__AVX__)
+  for (; i + 8 <= size; i += 8) {
+    __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  for (; i + 4 <= size; i += 4) {
+    float16x4_t h = vreinterpret_f16_u16(vld1_u16(src + i));
+    vst1q_f32(dst + i, vcvt_f32_f16(h));
+  }
+#endif
+  for (; i < size; ++i) dst[i] = HalfToFloatScalar(src[i]);
+}
+
+void FloatToBFloat16(const float* src, size_t size, uint16_t* dst) {
+  for (size_t i = 0; i < size; ++i) {
+    uint32_t x = FloatBits(src[i]);
+    if ((x & 0x7fffffff) > 0x7f800000) {
+      dst[i] = static_cast<uint16_t>((x >> 16) | 0x40);  // quiet NaN
+    } else {
+      // Round to nearest even
+      dst[i] = static_cast<uint16_t>((x + 0x7fff + ((x >> 16) & 1)) >> 16);
+    }
+  }
+}
+
+void BFloat16ToFloat(const uint16_t* src, size_t size, float* dst) {
+  for (size_t i = 0; i < size; ++i) {
+    dst[i] = BitsToFloat(static_cast<uint32_t>(src[i]) << 16);
+  }
+}
+
+void QuantizeInt8(const float* src, size_t size, int8_t* dst, float* scale) {
+  float max_abs = 0;
+  for (size_t i = 0; i < size; ++i) {
+    max_abs = std::max(max_abs, std::fabs(src[i]));
+  }
+  *scale = max_abs / 127.0f;
+  float inv_scale = max_abs > 0 ? 127.0f / max_abs : 0;
+  for (size_t i = 0; i < size; ++i) {
+    dst[i] = static_cast<int8_t>(std::lrint(src[i] * inv_scale));
+  }
+}
+
+void DequantizeInt8(const int8_t* src, size_t size, float scale, float* dst) {
+  for (size_t i = 0; i < size; ++i) dst[i] = src[i] * scale;
+}
+
+const size_t CompactBuffer::kInt8BlockSize;
+
+size_t CompactBuffer::bytes() const {
+  return fp32_.size() * sizeof(float) + fp16_.size() * sizeof(uint16_t) +
+         int8_.size() * sizeof(int8_t) + scales_.size() * sizeof(float);
+}
+
+void CompactBuffer::Assign(const float* data, size_t size) {
+  size_ = 0;
+  fp32_.clear();
+  fp16_.clear();
+  int8_.clear();
+  scales_.clear();
+  Append(data, size);
+}
+
+void CompactBuffer::Append(const float* data, size_t size) {
+  switch (type_) {
+    case StorageType::kFloat32:
+      fp32_.insert(fp32_.end(), data, data + size);
+      break;
+    case StorageType::kFloat16:
+      fp16_.resize(size_ + size);
+      FloatToHalf(data, size, fp16_.data() + size_);
+      break;
+    case StorageType::kBFloat16:
+      fp16_.resize(size_ + size);
+      FloatToBFloat16(data, size, fp16_.data() + size_);
+      break;
+    case StorageType::kInt8: {
+      // The last partial block is quantized again with the new data
+      size_t start = size_ / kInt8BlockSize * kInt8BlockSize;
+      std::vector<float> block_data(size_ - start);
+      for (size_t i = start; i < size_; ++i) {
+        block_data[i - start] = int8_[i] * scales_.back();
+      }
+      if (start < size_) scales_.pop_back();
+      block_data.insert(block_data.end(), data, data + size);
+      int8_.resize(size_ + size);
+      for (size_t i = 0; i < block_data.size(); i += kInt8BlockSize) {
+        size_t block_size = std::min(kInt8BlockSize, block_data.size() - i);
+        float scale = 0;
+        QuantizeInt8(block_data.data() + i, block_size,
+                     int8_.data() + start + i, &scale);
+        scales_.push_back(scale);
+      }
+      break;
+    }
+  }
+  size_ += size;
+}
+
+void CompactBuffer::AssignZeros(size_t size) {
+  Clear();
+  size_ = size;
+  switch (type_) {
+    case StorageType::kFloat32:
+      fp32_.assign(size, 0);
+      break;
+    case StorageType::kFloat16:
+    case StorageType::kBFloat16:
+      fp16_.assign(size, 0);  // +0 in both
+      break;
+    case StorageType::kInt8:
+      int8_.assign(size, 0);
+      scales_.assign((size + kInt8BlockSize - 1) / kInt8BlockSize, 0);
+      break;
+  }
+}
+
+void CompactBuffer::CopyTo(float* data) const {
+  switch (type_) {
+    case StorageType::kFloat32:
+      std::copy(fp32_.begin(), fp32_.end(), data);
+      break;
+    case StorageType::kFloat16:
+      HalfToFloat(fp16_.data(), size_, data);
+      break;
+    case StorageType::kBFloat16:
+      BFloat16ToFloat(fp16_.data(), size_, data);
+      break;
+    case StorageType::kInt8:
+      for (size_t i = 0; i < size_; i += kInt8BlockSize) {
+        DequantizeInt8(int8_.data() + i, std::min(kInt8BlockSize, size_ - i),
+                       scales_[i / kInt8BlockSize], data + i);
+      }
+      break;
+  }
+}
+
+void CompactBuffer::Clear() {
+  size_ = 0;
+  std::vector<float>().swap(fp32_);
+  std::vector<uint16_t>().swap(fp16_);
+  std::vector<int8_t>().swap(int8_);
+  std::vector<float>().swap(scales_);
+}
+
+}  // namespace wenet
@@ -0,0 +1,90 @@
+// Copyright (c) 2023 WeNet Community
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef UTILS_COMPACT_BUFFER_H_
+#define UTILS_COMPACT_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "utils/utils.h"
+
+namespace wenet {
+
+// Storage type of the float states kept between chunks
+enum class StorageType {
+  kFloat32 = 0,
+  kFloat16,   // IEEE half
+  kBFloat16,  // the upper 16 bits of float
+  kInt8,      // symmetric int8 with one float scale per block
+};
+
+// "fp32", "fp16", "bf16" or "int8", return false if unknown
+bool StringToStorageType(const std::string& str, StorageType* type);
+
+// Conversion kernels, they use F16C/NEON for fp16 when available, and the
+// others are plain loops the compiler vectorizes.
+void FloatToHalf(const float* src, size_t size, uint16_t* dst);
+void HalfToFloat(const uint16_t* src, size_t size, float* dst);
+void FloatToBFloat16(const float* src, size_t size, uint16_t* dst);
+void BFloat16ToFloat(const uint16_t* src, size_t size, float* dst);
+// scale = max(|src|) / 127
+void QuantizeInt8(const float* src, size_t size, int8_t* dst, float* scale);
+void DequantizeInt8(const int8_t* src, size_t size, float scale, float* dst);
+
+// CompactBuffer keeps a float array in the reduced precision storage type,
+// the values are converted at the boundary (Assign/Append/CopyTo).
+class CompactBuffer {
+ public:
+  // Number of the elements sharing one int8 scale
+  static const size_t kInt8BlockSize = 64;
+
+  explicit CompactBuffer(StorageType type = StorageType::kFloat16)
+      : type_(type) {}
+
+  StorageType type() const { return type_; }
+  // Change the type, the buffer is cleared
+  void set_type(StorageType type) {
+    Clear();
+    type_ = type;
+  }
+  size_t size() const { return size_; }
+  // Bytes of the storage
+  size_t bytes() const;
+
+  void Assign(const float* data, size_t size);
+  void Append(const float* data, size_t size);
+  void AssignZeros(size_t size);
+  // Convert back to size() floats in data
+  void CopyTo(float* data) const;
+  // Clear and release the memory
+  void Clear();
+
+ private:
+  StorageType type_;
+  size_t size_ = 0;
+  std::vector<float> fp32_;
+  std::vector<uint16_t> fp16_;  // kFloat16 and kBFloat16
+  std::vector<int8_t> int8_;
+  std::vector<float> scales_;   // one per kInt8BlockSize elements of int8_
+
+ public:
+  WENET_DISALLOW_COPY_AND_ASSIGN(CompactBuffer);
+};
+
+}  // namespace wenet
+
+#endif  // UTILS_COMPACT_BUFFER_H_
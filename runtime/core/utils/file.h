@@ -15,8 +15,28 @@
 #ifndef UTILS_FILE_H_
 #define UTILS_FILE_H_
 
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <fstream>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef _MSC_VER
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "fst/symbol-table.h"
+
+#include "utils/log.h"
 
 namespace wenet {
 
@@ -25,6 +45,146 @@ inline bool FileExists(const std::string& path) {
   return f.good();
 }
 
+// Stamp of the file version by the file system, it's the size, the
+// modification time, and the status change time and the inode, which no
+// copy (rsync -a, tar) keeps, so a replaced file has another stamp. Empty if
+// the file does not exist.
+inline std::string FileStamp(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return "";
+  return std::to_string(st.st_size) + " " + std::to_string(st.st_mtime) +
+         " " + std::to_string(st.st_ctime) + " " + std::to_string(st.st_ino);
+}
+
+// Canonical absolute path of the file, the path itself if it can't be
+// resolved
+inline std::string CanonicalPath(const std::string& path) {
+#ifndef _MSC_VER
+  char* resolved = realpath(path.c_str(), nullptr);
+#else
+  char* resolved = _fullpath(nullptr, path.c_str(), 0);
+#endif
+  if (resolved == nullptr) return path;
+  std::string canonical_path(resolved);
+  free(resolved);
+  return canonical_path;
+}
+
+// Temporary path next to `path` unique to the process, the file written to
+// it is renamed to `path`, so the other processes never see a partial one
+inline std::string TempPath(const std::string& path) {
+#ifdef _MSC_VER
+  return path + "." + std::to_string(_getpid()) + ".tmp";
+#else
+  return path + "." + std::to_string(getpid()) + ".tmp";
+#endif
+}
+
+// Read the text symbol table of `path`, or its binary copy `binary_path`,
+// which loads much faster for the large word tables. The copy is read if
+// the FileStamp() of the text file saved with it in `binary_path`.stamp
+// matches, otherwise it's written again. Failing to write it only costs the
+// speed up.
+inline std::shared_ptr<fst::SymbolTable> ReadSymbolTable(
+    const std::string& path, const std::string& binary_path) {
+  std::string stamp = FileStamp(path);
+  std::string stamp_path = binary_path + ".stamp";
+  if (!binary_path.empty() && !stamp.empty()) {
+    std::ifstream is(stamp_path);
+    std::string saved_stamp;
+    if (std::getline(is, saved_stamp) && saved_stamp == stamp) {
+      LOG(INFO) << "Reading binary symbol table " << binary_path;
+      auto symbol_table = std::shared_ptr<fst::SymbolTable>(
+          fst::SymbolTable::Read(binary_path));
+      if (symbol_table != nullptr) return symbol_table;
+      LOG(WARNING) << "Failed to read " << binary_path << ", read " << path;
+    }
+  }
+  LOG(INFO) << "Reading symbol table " << path;
+  auto symbol_table =
+      std::shared_ptr<fst::SymbolTable>(fst::SymbolTable::ReadText(path));
+  if (symbol_table == nullptr || binary_path.empty()) return symbol_table;
+  // The copy is renamed before its stamp, so a stamp never goes with the
+  // copy of another version
+  LOG(INFO) << "Writing binary symbol table " << binary_path;
+  std::string tmp_path = TempPath(binary_path);
+  bool written = symbol_table->Write(tmp_path) &&
+                 std::rename(tmp_path.c_str(), binary_path.c_str()) == 0;
+  if (written) {
+    tmp_path = TempPath(stamp_path);
+    std::ofstream os(tmp_path);
+    os << stamp << "\n";
+    os.close();
+    written = os.good() &&
+              std::rename(tmp_path.c_str(), stamp_path.c_str()) == 0;
+  }
+  if (!written) {
+    LOG(WARNING) << "Failed to write binary symbol table " << binary_path;
+    std::remove(tmp_path.c_str());
+  }
+  return symbol_table;
+}
+
+// Read only view of the whole file, it is mmapped on POSIX systems, so the
+// pages are loaded on demand and shared by the processes, and read into
+// memory otherwise.
+class MappedFile {
+ public:
+  MappedFile() = default;
+  ~MappedFile() { Close(); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool Open(const std::string& path) {
+    Close();
+#ifndef _MSC_VER
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return false;
+    }
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) return false;
+    data_ = static_cast<const char*>(addr);
+    size_ = st.st_size;
+#else
+    std::ifstream is(path, std::ios::binary | std::ios::ate);
+    if (!is.good()) return false;
+    buffer_.resize(is.tellg());
+    is.seekg(0);
+    is.read(buffer_.data(), buffer_.size());
+    if (!is.good() || buffer_.empty()) return false;
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+#endif
+    return true;
+  }
+
+  void Close() {
+#ifndef _MSC_VER
+    if (data_ != nullptr) munmap(const_cast<char*>(data_), size_);
+#else
+    std::vector<char>().swap(buffer_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+  }
+
+  bool is_open() const { return data_ != nullptr; }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+ private:
+  const char* data_ = nullptr;
+  size_t size_ = 0;
+#ifdef _MSC_VER
+  std::vector<char> buffer_;
+#endif
+};
+
 }  // namespace wenet
 
 #endif  // UTILS_FILE_H_
@@ -33,6 +33,14 @@ float LogAdd(float x, float y) {
   return std::log(std::exp(x - xmax) + std::exp(y - xmax)) + xmax;
 }
 
+uint64_t HashBytes(const char* data, size_t size, uint64_t hash) {
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
 template <typename T>
 struct ValueComp {
   bool operator()(const std::pair<T, int32_t>& lhs,
@@ -15,6 +15,7 @@
 #ifndef UTILS_UTILS_H_
 #define UTILS_UTILS_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <limits>
 #include <vector>
@@ -32,6 +33,10 @@ const char kSpaceSymbol[] = "\xe2\x96\x81";
 // Return the sum of two probabilities in log scale
 float LogAdd(float x, float y);
 
+// 64-bit FNV-1a hash of the bytes, `hash` chains the hash of the former ones
+uint64_t HashBytes(const char* data, size_t size,
+                   uint64_t hash = 14695981039346656037ULL);
+
 template <typename T>
 void TopK(const std::vector<T>& data, int32_t k, std::vector<T>* values,
           std::vector<int>* indices);
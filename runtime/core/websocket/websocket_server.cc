@@ -33,21 +33,48 @@ namespace json = boost::json;
 ConnectionHandler::ConnectionHandler(
     tcp::socket&& socket, std::shared_ptr<FeaturePipelineConfig> feature_config,
     std::shared_ptr<DecodeOptions> decode_config,
-    std::shared_ptr<DecodeResource> decode_resource)
+    std::shared_ptr<DecodeResource> decode_resource,
+    std::shared_ptr<DecoderPool> decoder_pool,
+    std::shared_ptr<ModelRegistry> model_registry)
     : ws_(std::move(socket)),
       feature_config_(std::move(feature_config)),
       decode_config_(std::move(decode_config)),
-      decode_resource_(std::move(decode_resource)) {}
+      decode_resource_(std::move(decode_resource)),
+      decoder_pool_(std::move(decoder_pool)),
+      model_registry_(std::move(model_registry)) {}
 
 void ConnectionHandler::OnSpeechStart() {
   LOG(INFO) << "Received speech start signal, start reading speech";
+  if (!model_.empty()) {
+    std::shared_ptr<DecodeResource> resource =
+        model_registry_ == nullptr ? nullptr
+                                   : model_registry_->resource(model_, group_);
+    if (resource == nullptr) {
+      OnError("Unknown model " + model_);
+      return;
+    }
+    decode_resource_ = resource;
+    // The profile may have its own feature config and decoding options
+    if (resource->decode_config != nullptr) {
+      feature_config_ = resource->feature_config;
+      decode_config_ = resource->decode_config;
+    }
+  }
   got_start_tag_ = true;
   json::value rv = {{"status", "ok"}, {"type", "server_ready"}};
   ws_.text(true);
   ws_.write(asio::buffer(json::serialize(rv)));
-  feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
-  decoder_ = std::make_shared<AsrDecoder>(feature_pipeline_, decode_resource_,
-                                          *decode_config_);
+  if (decoder_pool_ != nullptr) {
+    // A built session, it goes back to the pool with the handler
+    session_ = decoder_pool_->Acquire(decode_resource_, contexts_);
+    feature_pipeline_ = session_->feature_pipeline;
+    decoder_ = session_->decoder;
+  } else {
+    feature_pipeline_ = std::make_shared<FeaturePipeline>(*feature_config_);
+    decoder_ = std::make_shared<AsrDecoder>(
+        feature_pipeline_, GetSessionResource(decode_resource_, contexts_),
+        *decode_config_);
+  }
   // Start decoder thread
   decode_thread_ =
       std::make_shared<std::thread>(&ConnectionHandler::DecodeThreadFunc, this);
@@ -184,6 +211,25 @@ void ConnectionHandler::OnText(const std::string& message) {
                 "continuous_decoding option");
           }
         }
+        if (obj.find("context") != obj.end()) {
+          if (obj["context"].is_array()) {
+            contexts_.clear();
+            for (const auto& context : obj["context"].as_array()) {
+              if (context.is_string()) {
+                contexts_.emplace_back(context.as_string().c_str());
+              }
+            }
+          } else {
+            OnError("array of strings is expected for context option");
+          }
+        }
+        if (obj.find("model") != obj.end()) {
+          if (obj["model"].is_string()) {
+            model_ = obj["model"].as_string().c_str();
+          } else {
+            OnError("string is expected for model option");
+          }
+        }
         OnSpeechStart();
       } else if (signal == "end") {
         OnSpeechEnd();
@@ -199,6 +245,13 @@ void ConnectionHandler::OnText(const std::string& message) {
 }
 
 void ConnectionHandler::operator()() {
+  // Decode on the cores and the resource replica of one numa node
+  std::unique_ptr<WorkerGroupBinding> binding = nullptr;
+  if (decode_resource_->worker_groups != nullptr) {
+    binding.reset(new WorkerGroupBinding(decode_resource_->worker_groups));
+    decode_resource_ = binding->resource();
+    group_ = binding->group();
+  }
   try {
     // Accept the websocket handshake
     ws_.accept();
@@ -255,7 +308,8 @@ void WebSocketServer::Start() {
       acceptor.accept(socket);
       // Launch the session, transferring ownership of the socket
       ConnectionHandler handler(std::move(socket), feature_config_,
-                                decode_config_, decode_resource_);
+                                decode_config_, model_registry_->resource(),
+                                decoder_pool_, model_registry_);
       std::thread t(std::move(handler));
       t.detach();
     }
@@ -20,6 +20,7 @@
 #include <string>
 #include <thread>
 #include <utility>
+#include <vector>
 
 #include "boost/asio/connect.hpp"
 #include "boost/asio/ip/tcp.hpp"
@@ -27,6 +28,8 @@
 #include "boost/beast/websocket.hpp"
 
 #include "decoder/asr_decoder.h"
+#include "decoder/decoder_pool.h"
+#include "decoder/model_registry.h"
 #include "frontend/feature_pipeline.h"
 #include "utils/log.h"
 
@@ -43,7 +46,9 @@ class ConnectionHandler {
   ConnectionHandler(tcp::socket&& socket,
                     std::shared_ptr<FeaturePipelineConfig> feature_config,
                     std::shared_ptr<DecodeOptions> decode_config,
-                    std::shared_ptr<DecodeResource> decode_resource_);
+                    std::shared_ptr<DecodeResource> decode_resource_,
+                    std::shared_ptr<DecoderPool> decoder_pool = nullptr,
+                    std::shared_ptr<ModelRegistry> model_registry = nullptr);
   void operator()();
 
  private:
@@ -60,15 +65,25 @@ class ConnectionHandler {
 
   bool continuous_decoding_ = false;
   int nbest_ = 1;
+  // Per session contexts (hotwords)
+  std::vector<std::string> contexts_;
+  // Model profile selected by the start message, empty for the default one
+  std::string model_;
+  // Numa node group of the session, -1 if it's not bound
+  int group_ = -1;
   websocket::stream<tcp::socket> ws_;
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
   std::shared_ptr<DecodeResource> decode_resource_;
+  // Sessions are taken from it if it's not nullptr
+  std::shared_ptr<DecoderPool> decoder_pool_;
+  std::shared_ptr<ModelRegistry> model_registry_;
 
   bool got_start_tag_ = false;
   bool got_end_tag_ = false;
   // When endpoint is detected, stop recognition, and stop receiving data.
   bool stop_recognition_ = false;
+  std::shared_ptr<DecoderSession> session_ = nullptr;
   std::shared_ptr<FeaturePipeline> feature_pipeline_ = nullptr;
   std::shared_ptr<AsrDecoder> decoder_ = nullptr;
   std::shared_ptr<std::thread> decode_thread_ = nullptr;
@@ -79,11 +94,13 @@ class WebSocketServer {
   WebSocketServer(int port,
                   std::shared_ptr<FeaturePipelineConfig> feature_config,
                   std::shared_ptr<DecodeOptions> decode_config,
-                  std::shared_ptr<DecodeResource> decode_resource)
+                  std::shared_ptr<ModelRegistry> model_registry,
+                  std::shared_ptr<DecoderPool> decoder_pool = nullptr)
       : port_(port),
         feature_config_(std::move(feature_config)),
         decode_config_(std::move(decode_config)),
-        decode_resource_(std::move(decode_resource)) {}
+        model_registry_(std::move(model_registry)),
+        decoder_pool_(std::move(decoder_pool)) {}
 
   void Start();
 
@@ -93,7 +110,10 @@ class WebSocketServer {
   asio::io_context ioc_{1};
   std::shared_ptr<FeaturePipelineConfig> feature_config_;
   std::shared_ptr<DecodeOptions> decode_config_;
-  std::shared_ptr<DecodeResource> decode_resource_;
+  // Each connection takes the current default resource of it, or the one
+  // of the model profile selected by the start message
+  std::shared_ptr<ModelRegistry> model_registry_;
+  std::shared_ptr<DecoderPool> decoder_pool_;
   WENET_DISALLOW_COPY_AND_ASSIGN(WebSocketServer);
 };
 
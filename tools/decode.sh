@@ -11,6 +11,8 @@ chunk_size=-1
 ctc_weight=0.0
 reverse_weight=0.0
 rescoring_weight=1.0
+# Merge the blank encoder frames for rescoring, 1.0 means no merging
+rescoring_blank_thresh=1.0
 # For CTC WFST based decoding
 fst_path=
 dict_path=
@@ -21,6 +23,9 @@ min_active=200
 max_active=7000
 blank_skip_thresh=1.0
 length_penalty=0.0
+# Decode with the onnx model of the dir instead of the libtorch model_file,
+# which is then ignored
+onnx_dir=
 
 . tools/parse_options.sh || exit 1;
 if [ $# != 5 ]; then
@@ -49,6 +54,10 @@ done
 tools/data/split_scp.pl ${scp} ${split_scps}
 
 # Step 2. Parallel decoding
+model_opts="--model_path $model_file"
+if [ ! -z $onnx_dir ]; then
+  model_opts="--onnx_dir $onnx_dir"
+fi
 wfst_decode_opts=
 if [ ! -z $fst_path ]; then
   wfst_decode_opts="--fst_path $fst_path"
@@ -66,11 +75,12 @@ for n in $(seq ${nj}); do
 {
   decoder_main \
      --rescoring_weight $rescoring_weight \
+     --rescoring_blank_thresh $rescoring_blank_thresh \
      --ctc_weight $ctc_weight \
      --reverse_weight $reverse_weight \
      --chunk_size $chunk_size \
      --wav_scp ${dir}/split${nj}/wav.${n}.scp \
-     --model_path $model_file \
+     $model_opts \
      --unit_path $unit_file \
      $wfst_decode_opts \
      --result ${dir}/split${nj}/${n}.text &> ${dir}/split${nj}/${n}.log
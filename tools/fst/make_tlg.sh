@@ -36,3 +36,13 @@ fsttablecompose $tgt_lang/T.fst $tgt_lang/LG.fst > $tgt_lang/TLG.fst || exit 1;
 
 echo "Composing decoding graph TLG.fst succeeded"
 #rm -r $tgt_lang/LG.fst   # We don't need to keep this intermediate FST
+
+# Compose the static TL graph, which can be composed with G on the fly in
+# runtime by lookahead composition (--fst_path TL.fst --g_path G.fst), so
+# one TL can be shared by many G without building the TLG for each of them.
+fstdeterminizestar --use-log=true $tgt_lang/L.fst | fstminimizeencoded | \
+    fstarcsort --sort_type=olabel > $tgt_lang/L_det.fst || exit 1;
+fsttablecompose $tgt_lang/T.fst $tgt_lang/L_det.fst | \
+    fstarcsort --sort_type=olabel > $tgt_lang/TL.fst || exit 1;
+
+echo "Composing decoding graph TL.fst succeeded"
@@ -0,0 +1,59 @@
+#!/usr/bin/env bash
+# Copyright (c) 2023 WeNet Community
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Benchmark the blank frame compression of attention rescoring, it decodes
+# the test set with tools/decode.sh for each rescoring_blank_thresh, and
+# reports the WER and RTF of them.
+
+set -e
+
+# onnx (the model is the onnx dir) or libtorch (the model is the zip file)
+runtime=libtorch
+nj=1
+chunk_size=-1
+ctc_weight=0.5
+rescoring_weight=1.0
+threshes="1.0 0.999 0.99 0.98 0.95"
+
+. tools/parse_options.sh || exit 1;
+if [ $# != 5 ]; then
+  echo "Usage: $0 [options] <wav.scp> <label_file> <model> <unit_file> <output_dir>"
+  exit 1;
+fi
+
+scp=$1
+label_file=$2
+model=$3
+unit_file=$4
+dir=$5
+
+if [ $runtime == "onnx" ]; then
+  model_opts="--onnx_dir $model"
+else
+  model_opts=
+fi
+
+for thresh in $threshes; do
+  tools/decode.sh --nj $nj --chunk_size $chunk_size \
+    --ctc_weight $ctc_weight --rescoring_weight $rescoring_weight \
+    --rescoring_blank_thresh $thresh $model_opts \
+    $scp $label_file $model $unit_file $dir/blank_thresh_$thresh
+done
+
+for thresh in $threshes; do
+  echo "rescoring_blank_thresh $thresh" \
+    "$(grep Overall $dir/blank_thresh_$thresh/wer)" \
+    "RTF $(cat $dir/blank_thresh_$thresh/rtf)"
+done | tee $dir/summary
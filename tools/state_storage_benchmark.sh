@@ -0,0 +1,77 @@
+#!/usr/bin/env bash
+# Copyright (c) 2023 WeNet Community
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+# Benchmark the reduced precision state storage, it decodes the test set by
+# `sessions` concurrent streaming sessions of decoder_main for each
+# state_storage, and reports the WER, RTF and the resident memory per
+# session of them, which is the peak RSS above the one of decoder_main with
+# the model loaded but no session. int8 is only supported by onnx, it is
+# skipped for libtorch.
+
+set -e
+
+# onnx (the model is the onnx dir) or libtorch (the model is the zip file)
+runtime=onnx
+sessions=8
+chunk_size=16
+ctc_weight=0.5
+rescoring_weight=1.0
+storages="fp32 fp16 bf16 int8"
+
+. tools/parse_options.sh || exit 1;
+if [ $# != 5 ]; then
+  echo "Usage: $0 [options] <wav.scp> <label_file> <model> <unit_file> <output_dir>"
+  exit 1;
+fi
+
+scp=$1
+label_file=$2
+model=$3
+unit_file=$4
+dir=$5
+
+if [ $runtime == "onnx" ]; then
+  model_opts="--onnx_dir $model"
+else
+  model_opts="--model_path $model"
+  storages=$(echo $storages | tr ' ' '\n' | grep -v int8 | xargs)
+fi
+
+mkdir -p $dir
+touch $dir/empty.scp
+for storage in $storages; do
+  mkdir -p $dir/$storage
+  opts="--chunk_size $chunk_size --ctc_weight $ctc_weight"
+  opts="$opts --rescoring_weight $rescoring_weight --state_storage $storage"
+  opts="$opts $model_opts --unit_path $unit_file"
+  # The 0 session baseline, decoder_main exits on the empty wav.scp after
+  # the model is loaded
+  /usr/bin/time -v decoder_main --thread_num $sessions $opts \
+    --wav_scp $dir/empty.scp &> $dir/$storage/baseline.log || true
+  /usr/bin/time -v decoder_main --thread_num $sessions $opts \
+    --wav_scp $scp --result $dir/$storage/text &> $dir/$storage/log
+  python3 tools/compute-wer.py --char=1 --v=1 \
+    $label_file $dir/$storage/text > $dir/$storage/wer
+done
+
+for storage in $storages; do
+  rss_kb=$(grep "Maximum resident set size" $dir/$storage/log | awk '{print $NF}')
+  base_kb=$(grep "Maximum resident set size" $dir/$storage/baseline.log |
+    awk '{print $NF}')
+  echo "state_storage $storage" \
+    "$(grep Overall $dir/$storage/wer)" \
+    "RTF $(grep RTF $dir/$storage/log | awk '{print $NF}')" \
+    "RSS/session $(((rss_kb - base_kb) / sessions)) KB"
+done | tee $dir/summary
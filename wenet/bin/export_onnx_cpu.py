@@ -52,6 +52,16 @@ def get_args():
                         default=0.5,
                         type=float,
                         help='reverse_weight in attention_rescoing')
+    parser.add_argument('--fuse_ctc',
+                        action='store_true',
+                        help='fuse ctc into encoder.onnx, which outputs '
+                        'ctc_log_probs as well, and ctc.onnx is not exported')
+    parser.add_argument('--ctc_topk',
+                        default=0,
+                        type=int,
+                        help='if > 0, ctc outputs the sparse top k posterior, '
+                        'that is ctc_topk_values, ctc_topk_indices and '
+                        'ctc_blank_logp, instead of the full log probs')
     args = parser.parse_args()
     return args
 
@@ -76,10 +86,59 @@ def print_input_output_info(onnx_model, name, prefix="\t\t"):
     print("{}{} output shapes : {}".format(prefix, name, output_shapes))
 
 
+class CtcTopK(torch.nn.Module):
+    """ Ctc log_softmax with the sparse top k posterior outputs, the runtime
+        copies and searches k units instead of the whole vocabulary per frame.
+    """
+    def __init__(self, ctc, k, blank_id=0):
+        super().__init__()
+        self.ctc = ctc
+        self.k = k
+        self.blank_id = blank_id
+
+    def forward(self, hidden):
+        logp = self.ctc.log_softmax(hidden)
+        values, indices = logp.topk(self.k, dim=2)
+        return values, indices.to(torch.int32), logp[:, :, self.blank_id]
+
+
+class EncoderWithCtc(torch.nn.Module):
+    """ Encoder with ctc log_softmax, so the runtime runs one session
+        per chunk.
+    """
+    def __init__(self, encoder, ctc, ctc_topk=0, blank_id=0):
+        super().__init__()
+        self.encoder = encoder
+        self.ctc = CtcTopK(ctc, ctc_topk, blank_id) \
+            if ctc_topk > 0 else ctc.log_softmax
+
+    def forward(self, chunk, offset, required_cache_size, att_cache,
+                cnn_cache, att_mask):
+        out, r_att_cache, r_cnn_cache = self.encoder.forward_chunk(
+            chunk, offset, required_cache_size, att_cache, cnn_cache,
+            att_mask)
+        ctc_outs = self.ctc(out)
+        if not isinstance(ctc_outs, tuple):
+            ctc_outs = (ctc_outs, )
+        return (out, r_att_cache, r_cnn_cache) + ctc_outs
+
+
+def ctc_output_names(args):
+    if args['ctc_topk'] > 0:
+        return ['ctc_topk_values', 'ctc_topk_indices', 'ctc_blank_logp']
+    return ['ctc_log_probs']
+
+
 def export_encoder(asr_model, args):
     print("Stage-1: export encoder")
     encoder = asr_model.encoder
     encoder.forward = encoder.forward_chunk
+    export_model = encoder
+    output_names = ['output', 'r_att_cache', 'r_cnn_cache']
+    if args['fuse_ctc']:
+        export_model = EncoderWithCtc(encoder, asr_model.ctc,
+                                      args['ctc_topk'], args['blank_id'])
+        output_names += ctc_output_names(args)
     encoder_outpath = os.path.join(args['output_dir'], 'encoder.onnx')
 
     print("\tStage-1.1: prepare inputs for encoder")
@@ -153,6 +212,9 @@ def export_encoder(asr_model, args):
             2: 'T_CACHE'
         },
     }
+    if args['fuse_ctc']:
+        for name in ctc_output_names(args):
+            dynamic_axes[name] = {1: 'T'}
     # NOTE(xcsong): We keep dynamic axes even if in 16/4 mode, this is
     #   to avoid padding the last chunk (which usually contains less
     #   frames than required). For users who want static axes, just pop
@@ -166,7 +228,7 @@ def export_encoder(asr_model, args):
     #     #   be changed.
     #     dynamic_axes.pop('att_cache')
     #     dynamic_axes.pop('r_att_cache')
-    torch.onnx.export(encoder,
+    torch.onnx.export(export_model,
                       inputs,
                       encoder_outpath,
                       opset_version=13,
@@ -176,7 +238,7 @@ def export_encoder(asr_model, args):
                           'chunk', 'offset', 'required_cache_size',
                           'att_cache', 'cnn_cache', 'att_mask'
                       ],
-                      output_names=['output', 'r_att_cache', 'r_cnn_cache'],
+                      output_names=output_names,
                       dynamic_axes=dynamic_axes,
                       verbose=False)
     onnx_encoder = onnx.load(encoder_outpath)
@@ -275,6 +337,10 @@ def export_ctc(asr_model, args):
     print("Stage-2: export ctc")
     ctc = asr_model.ctc
     ctc.forward = ctc.log_softmax
+    if args['ctc_topk'] > 0:
+        ctc = CtcTopK(ctc, args['ctc_topk'], args['blank_id'])
+    output_names = ['probs'] if args['ctc_topk'] <= 0 else \
+        ctc_output_names(args)
     ctc_outpath = os.path.join(args['output_dir'], 'ctc.onnx')
 
     print("\tStage-2.1: prepare inputs for ctc")
@@ -283,7 +349,9 @@ def export_ctc(asr_model, args):
          args['output_size']))
 
     print("\tStage-2.2: torch.onnx.export")
-    dynamic_axes = {'hidden': {1: 'T'}, 'probs': {1: 'T'}}
+    dynamic_axes = {'hidden': {1: 'T'}}
+    for name in output_names:
+        dynamic_axes[name] = {1: 'T'}
     torch.onnx.export(ctc,
                       hidden,
                       ctc_outpath,
@@ -291,7 +359,7 @@ def export_ctc(asr_model, args):
                       export_params=True,
                       do_constant_folding=True,
                       input_names=['hidden'],
-                      output_names=['probs'],
+                      output_names=output_names,
                       dynamic_axes=dynamic_axes,
                       verbose=False)
     onnx_ctc = onnx.load(ctc_outpath)
@@ -310,11 +378,14 @@ def export_ctc(asr_model, args):
 
     print("\tStage-2.3: check onnx_ctc and torch_ctc")
     torch_output = ctc(hidden)
+    if not isinstance(torch_output, tuple):
+        torch_output = (torch_output, )
     ort_session = onnxruntime.InferenceSession(
         ctc_outpath, providers=['CPUExecutionProvider'])
     onnx_output = ort_session.run(None, {'hidden': to_numpy(hidden)})
 
-    np.testing.assert_allclose(to_numpy(torch_output),
+    # NOTE: the top k values are compared, the indices may differ on ties
+    np.testing.assert_allclose(to_numpy(torch_output[0]),
                                onnx_output[0],
                                rtol=1e-03,
                                atol=1e-05)
@@ -433,6 +504,8 @@ def main():
     arguments['chunk_size'] = args.chunk_size
     arguments['left_chunks'] = args.num_decoding_left_chunks
     arguments['reverse_weight'] = args.reverse_weight
+    arguments['fuse_ctc'] = args.fuse_ctc
+    arguments['ctc_topk'] = args.ctc_topk
     arguments['output_size'] = configs['encoder_conf']['output_size']
     arguments['num_blocks'] = configs['encoder_conf']['num_blocks']
     arguments['cnn_module_kernel'] = configs['encoder_conf'].get(
@@ -440,6 +513,7 @@ def main():
     arguments['head'] = configs['encoder_conf']['attention_heads']
     arguments['feature_size'] = configs['input_dim']
     arguments['vocab_size'] = configs['output_dim']
+    arguments['blank_id'] = configs.get('ctc_conf', {}).get('ctc_blank_id', 0)
     # NOTE(xcsong): if chunk_size == -1, hardcode to 67
     arguments['decoding_window'] = (args.chunk_size - 1) * \
         model.encoder.embed.subsampling_rate + \
@@ -462,7 +536,8 @@ def main():
         assert arguments['chunk_size'] > 0  # -1/4 not supported
 
     export_encoder(model, arguments)
-    export_ctc(model, arguments)
+    if not args.fuse_ctc:
+        export_ctc(model, arguments)
     export_decoder(model, arguments)
 
 